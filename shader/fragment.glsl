@@ -15,6 +15,10 @@ in vec4 gl_FragCoord;  // Fragment coordinates (unused in this example)
 uniform vec3 lightPos;  // Light position in world space
 uniform vec3 viewPos;   // Camera position in world space
 uniform float shininess; // Shininess factor for specular reflection
+uniform vec3 diffuseColor;  // Kd of the material
+uniform vec3 specularColor; // Ks of the material
+uniform sampler2D diffuseTexture; // map_Kd of the material, unit 0
+uniform bool useDiffuseTexture;   // false while it loads or without one
 
 void main() {
     // Ambient lighting (global illumination)
@@ -37,12 +41,7 @@ void main() {
     float specularStrength = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     vec3 specular = specularStrength * lightColor;
 
-    // Combine all lighting components
-    vec3 lighting = ambient + diffuse + specular;
-
-    // Base color of the model
-    vec3 modelColor = vec3(0.75, 0.75, 0.75); // Gray color
-
     // Final color
-    color = modelColor * lighting;
+    vec3 albedo = useDiffuseTexture ? diffuseColor * texture(diffuseTexture, UV).rgb : diffuseColor;
+    color = albedo * (ambient + diffuse) + specularColor * specular;
 }
\ No newline at end of file
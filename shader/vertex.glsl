@@ -2,8 +2,9 @@
 
 // Input vertex data
 layout(location = 0) in vec3 vertexPosition_modelspace;
-layout(location = 1) in vec3 vertexNormal_modelspace;
+layout(location = 1) in vec3 vertexNormal_modelspace; // xy only for oct normals
 layout(location = 2) in vec2 vertexUV;
+layout(location = 3) in vec4 vertexTangent_modelspace; // w = bitangent sign
 
 // Uniforms
 uniform mat4 M;          // Model matrix
@@ -12,14 +13,31 @@ uniform mat4 P;          // Projection matrix
 uniform vec3 lightPos;   // Light position in world space
 uniform float fTime;     // Time (optional)
 
+// Vertex decoding
+uniform vec3 positionOffset; // bounds minimum for quantized positions
+uniform vec3 positionScale;  // bounds extent for quantized positions
+uniform bool octNormals;     // normals are octahedral encoded
+
 // Output variables
 out vec3 fNormal;        // Transformed normal
 out vec3 fPosition;      // Transformed position
 out vec3 fLight;         // Transformed light position
 out vec2 UV;             // UV coordinates
+out vec4 fTangent;       // Transformed tangent, w = bitangent sign
 out float iTime;         // Time (optional)
 
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
 void main() {
+    // Decode the packed attributes
+    vec3 position = positionOffset + vertexPosition_modelspace * positionScale;
+    vec3 normal = octNormals ? octDecode(vertexNormal_modelspace.xy) : vertexNormal_modelspace;
+
     // Model-view matrix
     mat4 MV = V * M;
 
@@ -27,18 +45,22 @@ void main() {
     mat4 MVP = P * MV;
 
     // Transform position to camera space
-    vec4 positionHom = MV * vec4(vertexPosition_modelspace, 1.0);
+    vec4 positionHom = MV * vec4(position, 1.0);
     fPosition = positionHom.xyz;
 
     // Transform normal to camera space
     mat3 normalMatrix = transpose(inverse(mat3(MV)));
-    fNormal = normalize(normalMatrix * vertexNormal_modelspace);
+    fNormal = normalize(normalMatrix * normal);
+    // Meshes without tangents read the attribute default (0, 0, 0, 1); a
+    // zero tangent stays zero instead of being normalized
+    vec3 tangent = mat3(MV) * vertexTangent_modelspace.xyz;
+    fTangent = vec4(dot(tangent, tangent) > 0.0 ? normalize(tangent) : vec3(0.0), vertexTangent_modelspace.w);
 
     // Transform light position to camera space
     fLight = (V * vec4(lightPos, 1.0)).xyz;
 
     // Output position of the vertex, in clip space
-    gl_Position = MVP * vec4(vertexPosition_modelspace, 1.0);
+    gl_Position = MVP * vec4(position, 1.0);
 
     // Pass UV coordinates to the fragment shader
     UV = vertexUV;
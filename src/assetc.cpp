@@ -0,0 +1,132 @@
+// SmallRendererAssetc: compiles .obj, .glb, .ply and .stl files into one scene
+// pack, so viewers map finished vertex and index buffers instead of parsing text.
+#include "bufferdiff.h"
+#include "meshbuilder.h"
+#include "scenepack.h"
+#include "textureloader.h"
+
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+  const char* usage =
+    "Usage: SmallRendererAssetc -o <pack.srpack> <model.obj|.glb|.ply|.stl>... [--weld-tolerance <t>] "
+    "[--crease-angle <deg>] [--loader-threads <n>] [--no-optimize] [--no-lods] [--compress-textures] "
+    "[--mip-filter <box|kaiser>]";
+
+  // Texture names in a .mtl are relative to the .obj; in the pack they are
+  // relative to the pack, so both can live in different directories
+  void rebaseTextures(LoadedMesh& mesh, const std::filesystem::path& packDir) {
+    const std::filesystem::path sourceDir = std::filesystem::absolute(mesh.path).parent_path();
+    auto rebase = [&](std::string& name) {
+      if (name.empty())
+	return;
+      std::filesystem::path texture = (sourceDir / name).lexically_normal();
+      if (!std::filesystem::exists(texture))
+	std::cerr << "Warning: texture " << texture.string() << " of " << mesh.path << " not found\n";
+      name = texture.lexically_relative(packDir).generic_string();
+    };
+    for (auto& material : mesh.materials) {
+      rebase(material.ambient_texname);
+      rebase(material.diffuse_texname);
+      rebase(material.specular_texname);
+      rebase(material.normal_texname);
+      rebase(material.bump_texname);
+      rebase(material.alpha_texname);
+    }
+  }
+
+  // Writes the compressed cache of every diffuse texture of a rebased mesh,
+  // so the viewer finds them compressed with their mipmaps on the first run
+  void compressTextures(const LoadedMesh& mesh, const std::filesystem::path& packDir,
+			const TextureOptions& textureOptions, unsigned numThreads, std::set<std::string>& compressed) {
+    for (const auto& material : mesh.materials) {
+      if (material.diffuse_texname.empty())
+	continue;
+      const std::string path = (packDir / material.diffuse_texname).lexically_normal().string();
+      if (!compressed.insert(path).second)
+	continue;
+      MappedFile file;
+      if (!file.open(path))
+	continue;  // reported by rebaseTextures
+      try {
+	TextureData texture;
+	loadTexture(path, file, hashBytes(file.data(), file.size(), numThreads), textureOptions, texture, numThreads);
+      } catch (const std::exception& e) {
+	std::cerr << "Warning: " << e.what() << std::endl;
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  LoadOptions options;
+  // Packs are the cache; sidecars next to the inputs would only be litter
+  options.useMeshCache = false;
+  // Compiling is the time to optimize and build levels of detail for .glb and .ply files too
+  options.mapSourceBuffers = false;
+  std::string output;
+  std::vector<std::string> inputs;
+  bool textures = false;
+  TextureOptions textureOptions;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-o") {
+      if (++i >= argc)
+	throw std::runtime_error("-o expects the path of the pack");
+      output = argv[i];
+    } else if (arg == "--weld-tolerance") {
+      if (++i >= argc)
+	throw std::runtime_error("--weld-tolerance expects a value");
+      options.weldTolerance = std::stof(argv[i]);
+    } else if (arg == "--crease-angle") {
+      if (++i >= argc)
+	throw std::runtime_error("--crease-angle expects a value in degrees");
+      options.creaseAngle = std::stof(argv[i]);
+    } else if (arg == "--loader-threads") {
+      if (++i >= argc)
+	throw std::runtime_error("--loader-threads expects a value");
+      options.loaderThreads = static_cast<unsigned>(std::stoul(argv[i]));
+    } else if (arg == "--no-optimize") {
+      options.optimizeMesh = false;
+    } else if (arg == "--no-lods") {
+      options.generateLods = false;
+    } else if (arg == "--compress-textures") {
+      textures = true;
+    } else if (arg == "--mip-filter") {
+      if (++i >= argc)
+	throw std::runtime_error("--mip-filter expects box or kaiser");
+      textureOptions.mipFilter = mipFilterByName(argv[i]);
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  if (output.empty() || inputs.empty())
+    throw std::runtime_error(usage);
+  if (!isScenePack(output))
+    throw std::runtime_error("The output needs the .srpack extension: " + output);
+
+  const std::filesystem::path packDir = std::filesystem::absolute(output).parent_path();
+  std::vector<std::unique_ptr<LoadedMesh>> meshes;
+  std::vector<const LoadedMesh*> packed;
+  std::set<std::string> compressed;
+  for (const std::string& input : inputs) {
+    meshes.emplace_back(new LoadedMesh());
+    loadMesh(input, options, *meshes.back());
+    rebaseTextures(*meshes.back(), packDir);
+    if (textures)
+      compressTextures(*meshes.back(), packDir, textureOptions, options.loaderThreads, compressed);
+    packed.push_back(meshes.back().get());
+  }
+
+  if (!writeScenePack(output, packed, options))
+    throw std::runtime_error("Failed to write " + output);
+  std::cout << "Wrote " << output << " with " << packed.size() << " meshes ("
+	    << std::filesystem::file_size(output) << " bytes)\n";
+  return 0;
+}
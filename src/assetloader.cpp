@@ -0,0 +1,87 @@
+#include "assetloader.h"
+#include "bufferdiff.h"
+#include "scenepack.h"
+
+#include <iostream>
+#include <stdexcept>
+
+AssetLoader::AssetLoader(unsigned numWorkers) {
+  for (unsigned i = 0; i < numWorkers; i++)
+    m_workers.emplace_back(&AssetLoader::work, this);
+}
+
+AssetLoader::~AssetLoader() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_jobs.clear();
+  }
+  m_wake.notify_all();
+  // a worker finishes the mesh it is loading before it sees the flag
+  for (auto& worker : m_workers)
+    worker.join();
+}
+
+void AssetLoader::load(const std::string& path, const LoadOptions& options, bool hashBuffers) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back({path, options, hashBuffers});
+  }
+  m_wake.notify_one();
+}
+
+std::unique_ptr<LoadedMesh> AssetLoader::pop() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_finished.empty())
+    return nullptr;
+  std::unique_ptr<LoadedMesh> mesh = std::move(m_finished.front());
+  m_finished.pop_front();
+  return mesh;
+}
+
+size_t AssetLoader::pending() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_jobs.size() + m_running + m_finished.size();
+}
+
+void AssetLoader::work() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+      if (m_stop)
+	return;
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+      m_running++;
+    }
+
+    // A scene pack yields all of its meshes at once
+    std::vector<std::unique_ptr<LoadedMesh>> meshes;
+    try {
+      if (isScenePack(job.path)) {
+	meshes = loadScenePack(job.path);
+      } else {
+	meshes.emplace_back(new LoadedMesh());
+	loadMesh(job.path, job.options, *meshes.back());
+      }
+      for (auto& mesh : meshes)
+	if (job.hashBuffers) {
+	  const MeshView& view = mesh->view;
+	  mesh->vertexChunkHashes = hashChunks(view.vertexData, view.numVertices * view.layout.stride,
+					       job.options.loaderThreads);
+	  mesh->indexChunkHashes = hashChunks(view.indices, view.numIndices * sizeof(unsigned int),
+					      job.options.loaderThreads);
+	}
+    } catch (const std::exception& e) {
+      std::cerr << "Failed to load " << job.path << ": " << e.what() << std::endl;
+      meshes.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running--;
+    for (auto& mesh : meshes)
+      m_finished.push_back(std::move(mesh));
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "meshbuilder.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads meshes on background threads. Everything up to the GPU upload
+// (parsing, welding, cache access) runs on a worker; finished meshes wait in
+// a queue until the GL thread takes them with pop(). A scene pack is mapped
+// by a worker and queues one mesh per entry.
+class AssetLoader {
+public:
+  explicit AssetLoader(unsigned numWorkers = 2);
+  ~AssetLoader();
+  AssetLoader(const AssetLoader&) = delete;
+  AssetLoader& operator=(const AssetLoader&) = delete;
+
+  // With hashBuffers the chunk hashes of the finished buffers are filled in,
+  // for delta uploads when the file is reloaded later
+  void load(const std::string& path, const LoadOptions& options, bool hashBuffers = false);
+  // Returns the next finished mesh, or nullptr when none is ready
+  std::unique_ptr<LoadedMesh> pop();
+  // Number of meshes that were requested but not popped yet
+  size_t pending();
+
+private:
+  struct Job {
+    std::string path;
+    LoadOptions options;
+    bool hashBuffers;
+  };
+
+  void work();
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::deque<Job> m_jobs;
+  std::deque<std::unique_ptr<LoadedMesh>> m_finished;
+  std::vector<std::thread> m_workers;
+  size_t m_running = 0;
+  bool m_stop = false;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "bcencode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+  // Mean and principal axis of the first channels of 16 RGBA pixels, by
+  // power iteration on their covariance. The axis is zero for a flat block.
+  void fitLine(const uint8_t rgba[64], int channels, float mean[4], float axis[4]) {
+    for (int c = 0; c < 4; c++)
+      mean[c] = axis[c] = 0.0f;
+    for (int p = 0; p < 16; p++)
+      for (int c = 0; c < channels; c++)
+	mean[c] += rgba[p * 4 + c] / 16.0f;
+    float covariance[4][4] = {};
+    for (int p = 0; p < 16; p++)
+      for (int i = 0; i < channels; i++)
+	for (int j = 0; j < channels; j++)
+	  covariance[i][j] += (rgba[p * 4 + i] - mean[i]) * (rgba[p * 4 + j] - mean[j]);
+
+    float v[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++) {
+      float next[4] = {};
+      for (int i = 0; i < channels; i++)
+	for (int j = 0; j < channels; j++)
+	  next[i] += covariance[i][j] * v[j];
+      float length = 0.0f;
+      for (int i = 0; i < channels; i++)
+	length += next[i] * next[i];
+      length = std::sqrt(length);
+      if (length < 1e-6f)
+	return;
+      for (int i = 0; i < channels; i++)
+	v[i] = next[i] / length;
+    }
+    for (int i = 0; i < channels; i++)
+      axis[i] = v[i];
+  }
+
+  // Endpoints at the extremes of the pixels projected onto the axis, pulled
+  // in by inset of the range: interpolated colors reach the extremes anyway
+  void lineEndpoints(const uint8_t rgba[64], int channels, float inset, float e0[4], float e1[4]) {
+    float mean[4], axis[4];
+    fitLine(rgba, channels, mean, axis);
+    float lo = 0.0f, hi = 0.0f;
+    for (int p = 0; p < 16; p++) {
+      float t = 0.0f;
+      for (int c = 0; c < channels; c++)
+	t += (rgba[p * 4 + c] - mean[c]) * axis[c];
+      lo = std::min(lo, t);
+      hi = std::max(hi, t);
+    }
+    const float pull = (hi - lo) * inset;
+    for (int c = 0; c < 4; c++) {
+      e0[c] = std::min(std::max(mean[c] + axis[c] * (hi - pull), 0.0f), 255.0f);
+      e1[c] = std::min(std::max(mean[c] + axis[c] * (lo + pull), 0.0f), 255.0f);
+    }
+  }
+
+  // Least squares endpoints for fixed indices, weights[p] being the share
+  // of e1 in pixel p. Returns false when the weights do not determine them.
+  bool refitEndpoints(const uint8_t rgba[64], int channels, const float weights[16], float e0[4], float e1[4]) {
+    float a = 0.0f, b = 0.0f, c = 0.0f;
+    for (int p = 0; p < 16; p++) {
+      const float w1 = weights[p], w0 = 1.0f - w1;
+      a += w0 * w0;
+      b += w0 * w1;
+      c += w1 * w1;
+    }
+    const float det = a * c - b * b;
+    if (std::fabs(det) < 1e-6f)
+      return false;
+    for (int ch = 0; ch < channels; ch++) {
+      float d0 = 0.0f, d1 = 0.0f;
+      for (int p = 0; p < 16; p++) {
+	d0 += (1.0f - weights[p]) * rgba[p * 4 + ch];
+	d1 += weights[p] * rgba[p * 4 + ch];
+      }
+      e0[ch] = std::min(std::max((c * d0 - b * d1) / det, 0.0f), 255.0f);
+      e1[ch] = std::min(std::max((a * d1 - b * d0) / det, 0.0f), 255.0f);
+    }
+    return true;
+  }
+
+  uint16_t pack565(const float color[4]) {
+    const int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+    const int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+    const int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+  }
+
+  void unpack565(uint16_t c, int color[3]) {
+    const int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+  }
+
+  // Nearest four color mode indices for the endpoints c0 > c1, or all 0
+  // for c0 == c1; returns the squared error
+  int bc1Indices(const uint8_t rgba[64], uint16_t c0, uint16_t c1, uint32_t& indices) {
+    int palette[4][3];
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    const int numColors = c0 == c1 ? 1 : 4;
+    indices = 0;
+    int total = 0;
+    for (int p = 0; p < 16; p++) {
+      int best = 0, bestError = 1 << 30;
+      for (int i = 0; i < numColors; i++) {
+	int error = 0;
+	for (int c = 0; c < 3; c++) {
+	  const int d = rgba[p * 4 + c] - palette[i][c];
+	  error += d * d;
+	}
+	if (error < bestError) {
+	  best = i;
+	  bestError = error;
+	}
+      }
+      indices |= uint32_t(best) << (2 * p);
+      total += bestError;
+    }
+    return total;
+  }
+
+  int encodeBc1(const uint8_t rgba[64], const float e0[4], const float e1[4], uint16_t& c0, uint16_t& c1,
+		uint32_t& indices) {
+    c0 = pack565(e0);
+    c1 = pack565(e1);
+    if (c0 < c1)
+      std::swap(c0, c1);
+    return bc1Indices(rgba, c0, c1, indices);
+  }
+
+  // Values of the BC7 4 bit index interpolation, in 64ths of the second endpoint
+  const int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  // A mode 6 endpoint: 7 bits per channel and a shared low bit, picked for
+  // the smaller error
+  void quantizeBc7(const float endpoint[4], int bits[4], int& pbit, int value[4]) {
+    int bestError = 1 << 30;
+    for (int p = 0; p < 2; p++) {
+      int error = 0, candidate[4];
+      for (int c = 0; c < 4; c++) {
+	candidate[c] = std::min(std::max(static_cast<int>(std::lround((endpoint[c] - p) / 2.0f)), 0), 127);
+	const float d = (candidate[c] * 2 + p) - endpoint[c];
+	error += static_cast<int>(d * d);
+      }
+      if (error < bestError) {
+	bestError = error;
+	pbit = p;
+	std::memcpy(bits, candidate, sizeof(candidate));
+      }
+    }
+    for (int c = 0; c < 4; c++)
+      value[c] = bits[c] * 2 + pbit;
+  }
+
+  struct Bc7Fit {
+    int bits[2][4];
+    int pbits[2];
+    uint8_t indices[16];
+    int error;
+  };
+
+  Bc7Fit fitBc7(const uint8_t rgba[64], const float e0[4], const float e1[4]) {
+    Bc7Fit fit;
+    int ends[2][4];
+    quantizeBc7(e0, fit.bits[0], fit.pbits[0], ends[0]);
+    quantizeBc7(e1, fit.bits[1], fit.pbits[1], ends[1]);
+    int palette[16][4];
+    for (int i = 0; i < 16; i++)
+      for (int c = 0; c < 4; c++)
+	palette[i][c] = ((64 - bc7Weights[i]) * ends[0][c] + bc7Weights[i] * ends[1][c] + 32) >> 6;
+    fit.error = 0;
+    for (int p = 0; p < 16; p++) {
+      int best = 0, bestError = 1 << 30;
+      for (int i = 0; i < 16; i++) {
+	int error = 0;
+	for (int c = 0; c < 4; c++) {
+	  const int d = rgba[p * 4 + c] - palette[i][c];
+	  error += d * d;
+	}
+	if (error < bestError) {
+	  best = i;
+	  bestError = error;
+	}
+      }
+      fit.indices[p] = static_cast<uint8_t>(best);
+      fit.error += bestError;
+    }
+    return fit;
+  }
+
+  // Writes fields of up to 64 bits into a block, least significant bit first
+  struct BitWriter {
+    uint8_t* out;
+    int position = 0;
+    void write(uint32_t value, int bits) {
+      for (int i = 0; i < bits; i++, position++)
+	if (value >> i & 1)
+	  out[position >> 3] |= uint8_t(1u << (position & 7));
+    }
+  };
+}
+
+void encodeBc1Block(const uint8_t rgba[64], uint8_t out[8]) {
+  float e0[4], e1[4];
+  lineEndpoints(rgba, 3, 1.0f / 16.0f, e0, e1);
+  uint16_t c0, c1;
+  uint32_t indices;
+  int error = encodeBc1(rgba, e0, e1, c0, c1, indices);
+
+  // One least squares pass over the chosen indices
+  static const float shareOfC1[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+  float weights[16];
+  for (int p = 0; p < 16; p++)
+    weights[p] = shareOfC1[indices >> (2 * p) & 3];
+  if (c0 != c1 && refitEndpoints(rgba, 3, weights, e0, e1)) {
+    uint16_t r0, r1;
+    uint32_t refitIndices;
+    if (encodeBc1(rgba, e0, e1, r0, r1, refitIndices) < error) {
+      c0 = r0;
+      c1 = r1;
+      indices = refitIndices;
+    }
+  }
+
+  out[0] = uint8_t(c0);
+  out[1] = uint8_t(c0 >> 8);
+  out[2] = uint8_t(c1);
+  out[3] = uint8_t(c1 >> 8);
+  for (int i = 0; i < 4; i++)
+    out[4 + i] = uint8_t(indices >> (8 * i));
+}
+
+void encodeBc4Block(const uint8_t values[16], uint8_t out[8]) {
+  const int hi = *std::max_element(values, values + 16);
+  const int lo = *std::min_element(values, values + 16);
+  std::memset(out, 0, 8);
+  out[0] = uint8_t(hi);
+  out[1] = uint8_t(lo);
+  if (hi == lo)
+    return;
+
+  // Eight value mode: both endpoints and six values between them
+  int palette[8] = {hi, lo};
+  for (int i = 2; i < 8; i++)
+    palette[i] = ((8 - i) * hi + (i - 1) * lo) / 7;
+  uint64_t indices = 0;
+  for (int p = 0; p < 16; p++) {
+    int best = 0;
+    for (int i = 1; i < 8; i++)
+      if (std::abs(values[p] - palette[i]) < std::abs(values[p] - palette[best]))
+	best = i;
+    indices |= uint64_t(best) << (3 * p);
+  }
+  for (int i = 0; i < 6; i++)
+    out[2 + i] = uint8_t(indices >> (8 * i));
+}
+
+void encodeBc7Block(const uint8_t rgba[64], uint8_t out[16]) {
+  float e0[4], e1[4];
+  lineEndpoints(rgba, 4, 1.0f / 32.0f, e0, e1);
+  Bc7Fit fit = fitBc7(rgba, e0, e1);
+
+  float weights[16];
+  for (int p = 0; p < 16; p++)
+    weights[p] = bc7Weights[fit.indices[p]] / 64.0f;
+  if (fit.error > 0 && refitEndpoints(rgba, 4, weights, e0, e1)) {
+    const Bc7Fit refit = fitBc7(rgba, e0, e1);
+    if (refit.error < fit.error)
+      fit = refit;
+  }
+
+  // The top bit of the first index is implied zero
+  if (fit.indices[0] & 8) {
+    for (int c = 0; c < 4; c++)
+      std::swap(fit.bits[0][c], fit.bits[1][c]);
+    std::swap(fit.pbits[0], fit.pbits[1]);
+    for (int p = 0; p < 16; p++)
+      fit.indices[p] = uint8_t(15 - fit.indices[p]);
+  }
+
+  std::memset(out, 0, 16);
+  BitWriter writer{out};
+  writer.write(1u << 6, 7);  // mode 6
+  for (int c = 0; c < 4; c++) {
+    writer.write(fit.bits[0][c], 7);
+    writer.write(fit.bits[1][c], 7);
+  }
+  writer.write(fit.pbits[0], 1);
+  writer.write(fit.pbits[1], 1);
+  writer.write(fit.indices[0], 3);
+  for (int p = 1; p < 16; p++)
+    writer.write(fit.indices[p], 4);
+}
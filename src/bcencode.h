@@ -0,0 +1,18 @@
+#ifndef BC_ENCODE_H
+#define BC_ENCODE_H
+
+#include <cstdint>
+
+// Encoders for single 4x4 blocks of the BCn texture formats. Pixels are
+// given row by row, top left first. Endpoints are fit along the principal
+// axis of the block's colors; this aims at fast offline or cached encoding
+// with decent quality, not at the best possible error.
+
+// BC1 without alpha: 16 RGBA pixels, alpha ignored, to 8 bytes
+void encodeBc1Block(const uint8_t rgba[64], uint8_t out[8]);
+// BC4: 16 single channel values to 8 bytes. BC5 is two BC4 blocks, red then green.
+void encodeBc4Block(const uint8_t values[16], uint8_t out[8]);
+// BC7 in mode 6, one subset with RGBA endpoints: 16 RGBA pixels to 16 bytes
+void encodeBc7Block(const uint8_t rgba[64], uint8_t out[16]);
+
+#endif
@@ -0,0 +1,86 @@
+#include "bounds.h"
+#include "common/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BOUNDS_SSE 1
+#endif
+
+namespace {
+#ifdef BOUNDS_SSE
+  // x, y, z and 0 without reading past the vertex
+  inline __m128 loadPosition(const float* p) {
+    __m128 xy = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(p));
+    return _mm_movelh_ps(xy, _mm_load_ss(p + 2));
+  }
+#endif
+}
+
+void computeBounds(const float* positions, const unsigned int* indices, size_t count,
+		   float boundsMin[3], float boundsMax[3], float center[3], float& radius) {
+#ifdef BOUNDS_SSE
+  __m128 lower = loadPosition(&positions[3 * indices[0]]);
+  __m128 upper = lower;
+  for (size_t i = 1; i < count; i++) {
+    __m128 p = loadPosition(&positions[3 * indices[i]]);
+    lower = _mm_min_ps(lower, p);
+    upper = _mm_max_ps(upper, p);
+  }
+  __m128 mid = _mm_mul_ps(_mm_add_ps(lower, upper), _mm_set1_ps(0.5f));
+
+  // The w lanes are 0 on both sides, so the sum of the four lanes is the
+  // squared distance; only lane 0 of farthest is used
+  __m128 farthest = _mm_setzero_ps();
+  for (size_t i = 0; i < count; i++) {
+    __m128 d = _mm_sub_ps(loadPosition(&positions[3 * indices[i]]), mid);
+    __m128 squared = _mm_mul_ps(d, d);
+    squared = _mm_add_ps(squared, _mm_movehl_ps(squared, squared));
+    squared = _mm_add_ss(squared, _mm_shuffle_ps(squared, squared, 1));
+    farthest = _mm_max_ss(farthest, squared);
+  }
+
+  alignas(16) float values[3][4];
+  _mm_store_ps(values[0], lower);
+  _mm_store_ps(values[1], upper);
+  _mm_store_ps(values[2], mid);
+  for (int axis = 0; axis < 3; axis++) {
+    boundsMin[axis] = values[0][axis];
+    boundsMax[axis] = values[1][axis];
+    center[axis] = values[2][axis];
+  }
+  radius = std::sqrt(_mm_cvtss_f32(farthest));
+#else
+  for (int axis = 0; axis < 3; axis++)
+    boundsMin[axis] = boundsMax[axis] = positions[3 * indices[0] + axis];
+  for (size_t i = 1; i < count; i++)
+    for (int axis = 0; axis < 3; axis++) {
+      float value = positions[3 * indices[i] + axis];
+      boundsMin[axis] = std::min(boundsMin[axis], value);
+      boundsMax[axis] = std::max(boundsMax[axis], value);
+    }
+  for (int axis = 0; axis < 3; axis++)
+    center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+
+  float farthest = 0.0f;
+  for (size_t i = 0; i < count; i++) {
+    const float* p = &positions[3 * indices[i]];
+    float dx = p[0] - center[0], dy = p[1] - center[1], dz = p[2] - center[2];
+    farthest = std::max(farthest, dx * dx + dy * dy + dz * dz);
+  }
+  radius = std::sqrt(farthest);
+#endif
+}
+
+void computeSubmeshBounds(MeshData& mesh, unsigned numThreads) {
+  parallelFor(mesh.submeshes.size(), numThreads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t s = begin; s < end; s++) {
+      Submesh& submesh = mesh.submeshes[s];
+      const MeshLod& level = mesh.lods[submesh.firstLod];
+      computeBounds(mesh.vertices.data(), &mesh.indices[level.firstIndex], level.indexCount,
+		    submesh.boundsMin, submesh.boundsMax, submesh.center, submesh.radius);
+    }
+  });
+}
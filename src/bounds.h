@@ -0,0 +1,17 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include "meshdata.h"
+
+#include <cstddef>
+
+// Axis aligned box of the vertices that indices refer to, and a sphere
+// around the box's center that just encloses them. count must not be 0.
+void computeBounds(const float* positions, const unsigned int* indices, size_t count,
+		   float boundsMin[3], float boundsMax[3], float center[3], float& radius);
+
+// Fills the bounds of every submesh from its level 0 range. Works on the
+// unpacked float arrays. numThreads = 0 uses one thread per core.
+void computeSubmeshBounds(MeshData& mesh, unsigned numThreads = 0);
+
+#endif
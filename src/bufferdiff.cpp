@@ -0,0 +1,57 @@
+#include "bufferdiff.h"
+#include "common/parallel.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+  // Multiply and rotate over 8 byte words; the length is mixed in so a
+  // shorter last chunk never matches a full one
+  uint64_t hashChunk(const unsigned char* data, size_t size) {
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t h = size * prime;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+      uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      h = (h ^ (word * prime)) * 0xC2B2AE3D27D4EB4Full;
+      h = (h << 31) | (h >> 33);
+    }
+    for (; i < size; i++)
+      h = (h ^ data[i]) * prime;
+    return h ^ (h >> 29);
+  }
+}
+
+std::vector<uint64_t> hashChunks(const void* data, size_t size, unsigned numThreads) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  std::vector<uint64_t> hashes((size + diffChunkSize - 1) / diffChunkSize);
+  parallelFor(hashes.size(), numThreads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t c = begin; c < end; c++) {
+      const size_t offset = c * diffChunkSize;
+      hashes[c] = hashChunk(bytes + offset, std::min(diffChunkSize, size - offset));
+    }
+  });
+  return hashes;
+}
+
+uint64_t hashBytes(const void* data, size_t size, unsigned numThreads) {
+  const std::vector<uint64_t> hashes = hashChunks(data, size, numThreads);
+  return hashChunk(reinterpret_cast<const unsigned char*>(hashes.data()), hashes.size() * sizeof(uint64_t));
+}
+
+std::vector<std::pair<size_t, size_t>> changedRanges(const std::vector<uint64_t>& oldHashes,
+						     const std::vector<uint64_t>& newHashes, size_t newSize) {
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (size_t c = 0; c < newHashes.size(); c++) {
+    if (c < oldHashes.size() && oldHashes[c] == newHashes[c])
+      continue;
+    const size_t begin = c * diffChunkSize;
+    const size_t end = std::min(begin + diffChunkSize, newSize);
+    if (!ranges.empty() && ranges.back().second == begin)
+      ranges.back().second = end;
+    else
+      ranges.emplace_back(begin, end);
+  }
+  return ranges;
+}
@@ -0,0 +1,26 @@
+#ifndef BUFFER_DIFF_H
+#define BUFFER_DIFF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Buffers of a reloaded mesh are compared with the resident ones in chunks
+// of this many bytes
+const size_t diffChunkSize = 64 << 10;
+
+// 64-bit hash of every diffChunkSize bytes of data, the last chunk possibly
+// shorter. The chunks are hashed in parallel.
+std::vector<uint64_t> hashChunks(const void* data, size_t size, unsigned numThreads = 0);
+
+// 64-bit hash of all of data, combined from the hashes of its chunks
+uint64_t hashBytes(const void* data, size_t size, unsigned numThreads = 0);
+
+// Byte ranges [first, second) of a buffer of newSize bytes whose chunk
+// hashes differ from oldHashes, including the chunks the old buffer did not
+// have. Neighbouring chunks are merged into one range.
+std::vector<std::pair<size_t, size_t>> changedRanges(const std::vector<uint64_t>& oldHashes,
+						     const std::vector<uint64_t>& newHashes, size_t newSize);
+
+#endif
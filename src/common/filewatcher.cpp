@@ -0,0 +1,77 @@
+#include "filewatcher.h"
+
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(const std::string& path) : m_path(path) {
+  const std::filesystem::path file(path);
+  m_name = file.filename().string();
+  std::error_code error;
+  m_lastWrite = std::filesystem::last_write_time(file, error);
+  m_lastPoll = std::chrono::steady_clock::now();
+#ifdef __linux__
+  std::string directory = file.parent_path().string();
+  if (directory.empty())
+    directory = ".";
+  m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_inotify >= 0 &&
+      inotify_add_watch(m_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE) < 0) {
+    close(m_inotify);
+    m_inotify = -1;
+  }
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+  if (m_inotify >= 0)
+    close(m_inotify);
+#endif
+}
+
+// True when there were events for the file since the last call
+bool FileWatcher::poll() {
+#ifdef __linux__
+  if (m_inotify >= 0) {
+    bool seen = false;
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0) {
+      for (ssize_t offset = 0; offset < length;) {
+	const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+	if (event->len > 0 && m_name == event->name)
+	  seen = true;
+	offset += sizeof(inotify_event) + event->len;
+      }
+    }
+    return seen;
+  }
+#endif
+  // Polling the file system every frame would be wasteful
+  const auto now = std::chrono::steady_clock::now();
+  if (now - m_lastPoll < std::chrono::milliseconds(500))
+    return false;
+  m_lastPoll = now;
+  std::error_code error;
+  const auto lastWrite = std::filesystem::last_write_time(m_path, error);
+  if (error || lastWrite == m_lastWrite)
+    return false;
+  m_lastWrite = lastWrite;
+  return true;
+}
+
+bool FileWatcher::changed(double settleSeconds) {
+  const auto now = std::chrono::steady_clock::now();
+  if (poll()) {
+    m_pending = true;
+    m_lastEvent = now;
+  }
+  if (!m_pending || std::chrono::duration<double>(now - m_lastEvent).count() < settleSeconds)
+    return false;
+  m_pending = false;
+  return true;
+}
@@ -0,0 +1,37 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+// Reports when one file changes on disk. On Linux its directory is watched
+// with inotify, so editors that save by renaming a new file over the old one
+// are seen as well; elsewhere, or when inotify is unavailable, the
+// modification time is polled.
+class FileWatcher {
+public:
+  explicit FileWatcher(const std::string& path);
+  ~FileWatcher();
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // True once after the file was written and then left alone for
+  // settleSeconds, so a save in progress is not read half written. Never
+  // blocks; meant to be called once per frame.
+  bool changed(double settleSeconds = 0.25);
+  const std::string& path() const { return m_path; }
+
+private:
+  bool poll();
+
+  std::string m_path;
+  std::string m_name;  // file name within the watched directory
+  int m_inotify = -1;
+  std::filesystem::file_time_type m_lastWrite;
+  std::chrono::steady_clock::time_point m_lastPoll;
+  bool m_pending = false;
+  std::chrono::steady_clock::time_point m_lastEvent;
+};
+
+#endif
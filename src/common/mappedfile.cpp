@@ -0,0 +1,163 @@
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    close();
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_writable, other.m_writable);
+#ifdef _WIN32
+    std::swap(m_file, other.m_file);
+    std::swap(m_mapping, other.m_mapping);
+#endif
+  }
+  return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path) {
+  close();
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping) {
+    CloseHandle(file);
+    return false;
+  }
+  void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  m_file = file;
+  m_mapping = mapping;
+  m_data = static_cast<const char*>(data);
+  m_size = static_cast<size_t>(size.QuadPart);
+  return true;
+}
+
+bool MappedFile::createTemporary(size_t size) {
+  close();
+  size = std::max<size_t>(size, 1);
+  char directory[MAX_PATH + 1], path[MAX_PATH + 1];
+  if (!GetTempPathA(sizeof(directory), directory) || !GetTempFileNameA(directory, "obj", 0, path))
+    return false;
+  HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			    FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  const unsigned long long size64 = size;
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32),
+				      static_cast<DWORD>(size64), NULL);
+  if (!mapping) {
+    CloseHandle(file);
+    return false;
+  }
+  void* data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+  if (!data) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  m_file = file;
+  m_mapping = mapping;
+  m_data = static_cast<const char*>(data);
+  m_size = size;
+  m_writable = true;
+  return true;
+}
+
+// FILE_FLAG_SEQUENTIAL_SCAN already asks for read-ahead
+void MappedFile::adviseSequential() const {}
+
+void MappedFile::close() {
+  if (m_data)
+    UnmapViewOfFile(m_data);
+  if (m_mapping)
+    CloseHandle(m_mapping);
+  if (m_file)
+    CloseHandle(m_file);
+  m_data = nullptr;
+  m_mapping = m_file = nullptr;
+  m_size = 0;
+  m_writable = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  m_data = static_cast<const char*>(data);
+  m_size = static_cast<size_t>(info.st_size);
+  return true;
+}
+
+bool MappedFile::createTemporary(size_t size) {
+  close();
+  size = std::max<size_t>(size, 1);
+  // tmpfile() is already unlinked, the mapping keeps its pages alive
+  std::FILE* file = std::tmpfile();
+  if (!file)
+    return false;
+  const int fd = fileno(file);
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  std::fclose(file);
+  if (data == MAP_FAILED)
+    return false;
+  m_data = static_cast<const char*>(data);
+  m_size = size;
+  m_writable = true;
+  return true;
+}
+
+void MappedFile::adviseSequential() const {
+  if (m_data)
+    madvise(const_cast<char*>(m_data), m_size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::close() {
+  if (m_data)
+    munmap(const_cast<char*>(m_data), m_size);
+  m_data = nullptr;
+  m_size = 0;
+  m_writable = false;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, or a writable one of a temporary
+// file. The mapping is released when the object is destroyed or another file
+// is opened.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  bool open(const std::string& path);
+  // Maps a new zero filled temporary file of size bytes for writing. The
+  // file is deleted when it is closed. Large scratch arrays kept here are
+  // backed by the page cache rather than the heap.
+  bool createTemporary(size_t size);
+  void close();
+  // Hint that the mapping is read front to back, so the kernel reads ahead
+  void adviseSequential() const;
+
+  const char* data() const { return m_data; }
+  // nullptr unless created by createTemporary
+  char* writableData() const { return m_writable ? const_cast<char*>(m_data) : nullptr; }
+  size_t size() const { return m_size; }
+  bool isOpen() const { return m_data != nullptr; }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+  bool m_writable = false;
+#ifdef _WIN32
+  void* m_file = nullptr;
+  void* m_mapping = nullptr;
+#endif
+};
+
+#endif
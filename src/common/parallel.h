@@ -0,0 +1,54 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Number of threads to use when the caller did not ask for a specific count
+inline unsigned defaultThreadCount() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+// Splits [0, count) into one contiguous range per thread and calls
+// fn(begin, end, threadIndex) for each of them. The calling thread takes the
+// first range. Exceptions thrown by a worker are rethrown on the caller.
+template <typename Fn>
+void parallelFor(size_t count, unsigned numThreads, Fn&& fn) {
+  if (numThreads == 0)
+    numThreads = defaultThreadCount();
+  numThreads = static_cast<unsigned>(std::min<size_t>(numThreads, count));
+  if (numThreads <= 1) {
+    if (count > 0)
+      fn(size_t(0), count, 0u);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  std::vector<std::exception_ptr> errors(numThreads);
+  auto run = [&](unsigned t) {
+    size_t begin = count * t / numThreads;
+    size_t end = count * (t + 1) / numThreads;
+    try {
+      fn(begin, end, t);
+    } catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+
+  workers.reserve(numThreads - 1);
+  for (unsigned t = 1; t < numThreads; t++)
+    workers.emplace_back(run, t);
+  run(0);
+  for (auto& worker : workers)
+    worker.join();
+
+  for (auto& error : errors)
+    if (error)
+      std::rethrow_exception(error);
+}
+
+#endif
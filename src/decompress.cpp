@@ -0,0 +1,170 @@
+#include "decompress.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef OBJ_GZIP
+#include <zlib.h>
+#endif
+#ifdef OBJ_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+  bool endsWith(const std::string& s, const char* suffix) {
+    const size_t n = std::char_traits<char>::length(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+  }
+}
+
+bool isCompressed(const std::string& path) {
+  return endsWith(path, ".gz") || endsWith(path, ".zst");
+}
+
+DecompressingReader::DecompressingReader(const std::string& path, size_t blockSize, size_t maxQueued)
+  : m_path(path), m_blockSize(std::max<size_t>(blockSize, 4096)), m_maxQueued(std::max<size_t>(maxQueued, 1)) {
+  const bool gzip = endsWith(path, ".gz");
+#ifndef OBJ_GZIP
+  if (gzip)
+    throw std::runtime_error("Cannot read " + path + ": built without zlib");
+#endif
+#ifndef OBJ_ZSTD
+  if (!gzip)
+    throw std::runtime_error("Cannot read " + path + ": built without libzstd");
+#endif
+  if (!m_file.open(path))
+    throw std::runtime_error("Cannot open file " + path);
+  m_file.adviseSequential();
+
+  m_thread = std::thread([this, gzip] {
+    try {
+      if (gzip)
+	inflateGzip();
+      else
+	inflateZstd();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_done = true;
+    m_changed.notify_all();
+  });
+}
+
+DecompressingReader::~DecompressingReader() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_changed.notify_all();
+  }
+  m_thread.join();
+}
+
+bool DecompressingReader::read(std::string& block) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_changed.wait(lock, [this] { return !m_queue.empty() || m_done; });
+  if (!m_queue.empty()) {
+    block = std::move(m_queue.front());
+    m_queue.pop_front();
+    m_changed.notify_all();
+    return true;
+  }
+  if (m_error)
+    std::rethrow_exception(m_error);
+  return false;
+}
+
+bool DecompressingReader::push(std::string&& block) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_changed.wait(lock, [this] { return m_queue.size() < m_maxQueued || m_stop; });
+  if (m_stop)
+    return false;
+  m_queue.push_back(std::move(block));
+  m_changed.notify_all();
+  return true;
+}
+
+void DecompressingReader::inflateGzip() {
+#ifdef OBJ_GZIP
+  z_stream stream = {};
+  // 32 lets zlib detect the gzip or zlib header
+  if (inflateInit2(&stream, 15 + 32) != Z_OK)
+    throw std::runtime_error("Cannot read " + m_path + ": inflateInit2 failed");
+  const unsigned char* input = reinterpret_cast<const unsigned char*>(m_file.data());
+  size_t remaining = m_file.size();
+  bool finished = false;
+  try {
+    while (!finished) {
+      std::string block(m_blockSize, '\0');
+      stream.next_out = reinterpret_cast<Bytef*>(&block[0]);
+      stream.avail_out = static_cast<uInt>(block.size());
+      while (stream.avail_out > 0) {
+	// avail_in is 32 bits wide
+	if (stream.avail_in == 0 && remaining > 0) {
+	  const size_t n = std::min<size_t>(remaining, 1u << 30);
+	  stream.next_in = const_cast<Bytef*>(input);
+	  stream.avail_in = static_cast<uInt>(n);
+	  input += n;
+	  remaining -= n;
+	}
+	const int result = inflate(&stream, Z_NO_FLUSH);
+	if (result == Z_STREAM_END) {
+	  // Concatenated gzip members continue the stream
+	  if (stream.avail_in == 0 && remaining == 0) {
+	    finished = true;
+	    break;
+	  }
+	  inflateReset(&stream);
+	} else if (result == Z_BUF_ERROR && stream.avail_in == 0 && remaining == 0) {
+	  throw std::runtime_error("Cannot read " + m_path + ": truncated");
+	} else if (result != Z_OK && result != Z_BUF_ERROR) {
+	  throw std::runtime_error("Cannot read " + m_path + ": " + (stream.msg ? stream.msg : "corrupt data"));
+	}
+      }
+      block.resize(block.size() - stream.avail_out);
+      if (!block.empty() && !push(std::move(block)))
+	break;
+    }
+  } catch (...) {
+    inflateEnd(&stream);
+    throw;
+  }
+  inflateEnd(&stream);
+#endif
+}
+
+void DecompressingReader::inflateZstd() {
+#ifdef OBJ_ZSTD
+  ZSTD_DStream* stream = ZSTD_createDStream();
+  if (!stream)
+    throw std::runtime_error("Cannot read " + m_path + ": ZSTD_createDStream failed");
+  ZSTD_inBuffer input = {m_file.data(), m_file.size(), 0};
+  bool finished = false;
+  try {
+    while (!finished) {
+      std::string block(m_blockSize, '\0');
+      ZSTD_outBuffer output = {&block[0], block.size(), 0};
+      while (output.pos < output.size) {
+	const size_t result = ZSTD_decompressStream(stream, &output, &input);
+	if (ZSTD_isError(result))
+	  throw std::runtime_error("Cannot read " + m_path + ": " + ZSTD_getErrorName(result));
+	// Room left in the output with all input consumed: nothing is pending
+	if (input.pos == input.size && output.pos < output.size) {
+	  if (result != 0)
+	    throw std::runtime_error("Cannot read " + m_path + ": truncated");
+	  finished = true;
+	  break;
+	}
+      }
+      block.resize(output.pos);
+      if (!block.empty() && !push(std::move(block)))
+	break;
+    }
+  } catch (...) {
+    ZSTD_freeDStream(stream);
+    throw;
+  }
+  ZSTD_freeDStream(stream);
+#endif
+}
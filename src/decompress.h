@@ -0,0 +1,56 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include "common/mappedfile.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// True for paths ending in .gz or .zst
+bool isCompressed(const std::string& path);
+
+// Inflates a mapped .gz (zlib) or .zst (libzstd) file on a background
+// thread. The decompressed bytes are handed over in blocks through a
+// bounded queue, so the consumer works on one block while the thread
+// inflates the next ones and nothing is written to disk. Each format is
+// only available when the build found its library (OBJ_GZIP, OBJ_ZSTD).
+class DecompressingReader {
+public:
+  // Throws std::runtime_error when the file cannot be opened or its format
+  // was not compiled in
+  explicit DecompressingReader(const std::string& path, size_t blockSize = 1 << 20, size_t maxQueued = 16);
+  ~DecompressingReader();
+  DecompressingReader(const DecompressingReader&) = delete;
+  DecompressingReader& operator=(const DecompressingReader&) = delete;
+
+  // Replaces block with the next decompressed bytes. Returns false at the
+  // end of the stream; rethrows the error when the data was corrupt.
+  bool read(std::string& block);
+
+private:
+  void inflateGzip();
+  void inflateZstd();
+  // Queues a block, waiting while the queue is full. False when the reader
+  // is being destroyed and the thread should stop.
+  bool push(std::string&& block);
+
+  std::string m_path;
+  MappedFile m_file;
+  size_t m_blockSize;
+  size_t m_maxQueued;
+
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+  std::deque<std::string> m_queue;
+  bool m_done = false;
+  bool m_stop = false;
+  std::exception_ptr m_error;
+  std::thread m_thread;
+};
+
+#endif
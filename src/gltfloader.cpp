@@ -0,0 +1,939 @@
+#include "gltfloader.h"
+#include "bounds.h"
+#include "normals.h"
+#include "numparse.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+namespace {
+  // JSON tree of the glTF header
+  struct Json {
+    enum Type { Null, Bool, Number, String, Array, Object };
+    Type type = Null;
+    double number = 0.0;
+    std::string string;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> members;
+
+    // Missing members and items read as null
+    const Json& operator[](const char* key) const {
+      for (const auto& member : members)
+	if (member.first == key)
+	  return member.second;
+      return null();
+    }
+    const Json& operator[](size_t i) const { return i < items.size() ? items[i] : null(); }
+    const Json& operator[](int i) const { return i >= 0 ? (*this)[static_cast<size_t>(i)] : null(); }
+    size_t size() const { return items.size(); }
+    bool isNull() const { return type == Null; }
+
+    double num(double fallback) const { return type == Number ? number : fallback; }
+    int integer(int fallback) const { return type == Number ? static_cast<int>(number) : fallback; }
+    bool boolean() const { return type == Bool && number != 0.0; }
+
+    static const Json& null() {
+      static const Json value;
+      return value;
+    }
+  };
+
+  class JsonParser {
+  public:
+    JsonParser(const char* begin, const char* end) : m_p(begin), m_end(end) {}
+
+    Json parse() {
+      Json value = parseValue(0);
+      skipSpace();
+      if (m_p != m_end)
+	fail("trailing characters");
+      return value;
+    }
+
+  private:
+    const char* m_p;
+    const char* m_end;
+
+    [[noreturn]] void fail(const char* what) { throw std::runtime_error(std::string("JSON: ") + what); }
+
+    void skipSpace() {
+      while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+	m_p++;
+    }
+
+    bool consume(const char* word) {
+      size_t length = std::strlen(word);
+      if (static_cast<size_t>(m_end - m_p) < length || std::memcmp(m_p, word, length) != 0)
+	return false;
+      m_p += length;
+      return true;
+    }
+
+    Json parseValue(int depth) {
+      if (depth > 64)
+	fail("nested too deeply");
+      skipSpace();
+      if (m_p == m_end)
+	fail("unexpected end");
+      Json value;
+      if (*m_p == '{') {
+	value.type = Json::Object;
+	m_p++;
+	skipSpace();
+	if (m_p < m_end && *m_p == '}') {
+	  m_p++;
+	  return value;
+	}
+	while (true) {
+	  skipSpace();
+	  std::string key = parseString();
+	  skipSpace();
+	  if (m_p == m_end || *m_p++ != ':')
+	    fail("expected ':'");
+	  value.members.emplace_back(std::move(key), parseValue(depth + 1));
+	  skipSpace();
+	  if (m_p < m_end && *m_p == ',') {
+	    m_p++;
+	    continue;
+	  }
+	  if (m_p == m_end || *m_p++ != '}')
+	    fail("expected '}'");
+	  return value;
+	}
+      }
+      if (*m_p == '[') {
+	value.type = Json::Array;
+	m_p++;
+	skipSpace();
+	if (m_p < m_end && *m_p == ']') {
+	  m_p++;
+	  return value;
+	}
+	while (true) {
+	  value.items.push_back(parseValue(depth + 1));
+	  skipSpace();
+	  if (m_p < m_end && *m_p == ',') {
+	    m_p++;
+	    continue;
+	  }
+	  if (m_p == m_end || *m_p++ != ']')
+	    fail("expected ']'");
+	  return value;
+	}
+      }
+      if (*m_p == '"') {
+	value.type = Json::String;
+	value.string = parseString();
+	return value;
+      }
+      if (consume("true")) {
+	value.type = Json::Bool;
+	value.number = 1.0;
+	return value;
+      }
+      if (consume("false")) {
+	value.type = Json::Bool;
+	return value;
+      }
+      if (consume("null"))
+	return value;
+      const char* next = parseDouble(m_p, m_end, value.number);
+      if (next == m_p)
+	fail("unexpected character");
+      value.type = Json::Number;
+      m_p = next;
+      return value;
+    }
+
+    std::string parseString() {
+      if (m_p == m_end || *m_p != '"')
+	fail("expected a string");
+      m_p++;
+      std::string out;
+      while (true) {
+	if (m_p == m_end)
+	  fail("unterminated string");
+	char c = *m_p++;
+	if (c == '"')
+	  return out;
+	if (c != '\\') {
+	  out += c;
+	  continue;
+	}
+	if (m_p == m_end)
+	  fail("unterminated string");
+	switch (char e = *m_p++) {
+	case 'b': out += '\b'; break;
+	case 'f': out += '\f'; break;
+	case 'n': out += '\n'; break;
+	case 'r': out += '\r'; break;
+	case 't': out += '\t'; break;
+	case 'u': appendUtf8(out, parseCodePoint()); break;
+	default: out += e; break;
+	}
+      }
+    }
+
+    uint32_t parseHex4() {
+      if (m_end - m_p < 4)
+	fail("bad \\u escape");
+      uint32_t value = 0;
+      for (int i = 0; i < 4; i++) {
+	char c = *m_p++;
+	value <<= 4;
+	if (c >= '0' && c <= '9') value |= c - '0';
+	else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') value |= (c | 0x20) - 'a' + 10;
+	else fail("bad \\u escape");
+      }
+      return value;
+    }
+
+    // \uXXXX, with the second half of a surrogate pair when there is one
+    uint32_t parseCodePoint() {
+      uint32_t code = parseHex4();
+      if (code >= 0xD800 && code < 0xDC00 && m_end - m_p >= 6 && m_p[0] == '\\' && m_p[1] == 'u') {
+	m_p += 2;
+	uint32_t low = parseHex4();
+	if (low >= 0xDC00 && low < 0xE000)
+	  return 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+      }
+      return code;
+    }
+
+    static void appendUtf8(std::string& out, uint32_t code) {
+      if (code < 0x80) {
+	out += static_cast<char>(code);
+      } else if (code < 0x800) {
+	out += static_cast<char>(0xC0 | (code >> 6));
+	out += static_cast<char>(0x80 | (code & 0x3F));
+      } else if (code < 0x10000) {
+	out += static_cast<char>(0xE0 | (code >> 12));
+	out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+	out += static_cast<char>(0x80 | (code & 0x3F));
+      } else {
+	out += static_cast<char>(0xF0 | (code >> 18));
+	out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+	out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+	out += static_cast<char>(0x80 | (code & 0x3F));
+      }
+    }
+  };
+
+  enum ComponentType {
+    Byte = 5120,
+    UnsignedByte = 5121,
+    Short = 5122,
+    UnsignedShort = 5123,
+    UnsignedInt = 5125,
+    FloatType = 5126,
+  };
+
+  size_t componentSize(int componentType) {
+    switch (componentType) {
+    case Byte:
+    case UnsignedByte:
+      return 1;
+    case Short:
+    case UnsignedShort:
+      return 2;
+    case UnsignedInt:
+    case FloatType:
+      return 4;
+    default:
+      return 0;
+    }
+  }
+
+  int componentCount(const std::string& type) {
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+  }
+
+  // Elements of an accessor, resolved to the mapping
+  struct Accessor {
+    const unsigned char* data = nullptr;  // first element, null when all zero
+    size_t count = 0;
+    size_t stride = 0;
+    size_t elementSize = 0;
+    int componentType = 0;
+    int components = 0;
+    bool normalized = false;
+    int bufferView = -1;
+    bool hasBounds = false;
+    float min[3] = {0.0f, 0.0f, 0.0f};
+    float max[3] = {0.0f, 0.0f, 0.0f};
+
+    float read(size_t i, int c) const {
+      if (!data)
+	return 0.0f;
+      const unsigned char* e = data + i * stride + c * componentSize(componentType);
+      switch (componentType) {
+      case Byte: {
+	int8_t v;
+	std::memcpy(&v, e, 1);
+	return normalized ? std::max(v / 127.0f, -1.0f) : v;
+      }
+      case UnsignedByte:
+	return normalized ? *e / 255.0f : *e;
+      case Short: {
+	int16_t v;
+	std::memcpy(&v, e, 2);
+	return normalized ? std::max(v / 32767.0f, -1.0f) : v;
+      }
+      case UnsignedShort: {
+	uint16_t v;
+	std::memcpy(&v, e, 2);
+	return normalized ? v / 65535.0f : v;
+      }
+      case UnsignedInt: {
+	uint32_t v;
+	std::memcpy(&v, e, 4);
+	return static_cast<float>(v);
+      }
+      default: {
+	float v;
+	std::memcpy(&v, e, 4);
+	return v;
+      }
+      }
+    }
+
+    uint32_t readIndex(size_t i) const {
+      if (!data)
+	return 0;
+      const unsigned char* e = data + i * stride;
+      if (componentType == UnsignedByte)
+	return *e;
+      if (componentType == UnsignedShort) {
+	uint16_t v;
+	std::memcpy(&v, e, 2);
+	return v;
+      }
+      uint32_t v;
+      std::memcpy(&v, e, 4);
+      return v;
+    }
+  };
+
+  struct Glb {
+    std::string path;
+    Json json;
+    const unsigned char* bin = nullptr;
+    size_t binSize = 0;
+
+    [[noreturn]] void fail(const std::string& what) const {
+      throw std::runtime_error("Invalid glTF file " + path + ": " + what);
+    }
+
+    Accessor accessor(int index) const {
+      const Json& a = json["accessors"][static_cast<size_t>(index)];
+      if (index < 0 || a.isNull())
+	fail("missing accessor " + std::to_string(index));
+      if (!a["sparse"].isNull())
+	fail("sparse accessors are not supported");
+      Accessor out;
+      out.count = static_cast<size_t>(a["count"].num(0));
+      out.componentType = a["componentType"].integer(0);
+      out.components = componentCount(a["type"].string);
+      out.normalized = a["normalized"].boolean();
+      out.elementSize = componentSize(out.componentType) * out.components;
+      if (out.elementSize == 0)
+	fail("unsupported accessor type");
+      out.stride = out.elementSize;
+      const Json& minimum = a["min"];
+      const Json& maximum = a["max"];
+      if (out.components == 3 && minimum.size() == 3 && maximum.size() == 3) {
+	out.hasBounds = true;
+	for (int c = 0; c < 3; c++) {
+	  out.min[c] = static_cast<float>(minimum[c].num(0));
+	  out.max[c] = static_cast<float>(maximum[c].num(0));
+	}
+      }
+
+      out.bufferView = a["bufferView"].integer(-1);
+      if (out.bufferView < 0)
+	return out;
+      const Json& view = json["bufferViews"][static_cast<size_t>(out.bufferView)];
+      if (view.isNull())
+	fail("missing buffer view");
+      if (view["buffer"].integer(0) != 0 || !bin)
+	fail("only the embedded buffer of a .glb is supported");
+      const size_t viewOffset = static_cast<size_t>(view["byteOffset"].num(0));
+      const size_t viewLength = static_cast<size_t>(view["byteLength"].num(0));
+      const size_t offset = static_cast<size_t>(a["byteOffset"].num(0));
+      if (view["byteStride"].num(0) > 0)
+	out.stride = static_cast<size_t>(view["byteStride"].num(0));
+      if (viewOffset > binSize || viewLength > binSize - viewOffset || out.stride < out.elementSize)
+	fail("buffer view out of range");
+      if (out.count > 0 && offset + (out.count - 1) * out.stride + out.elementSize > viewLength)
+	fail("accessor out of range");
+      out.data = bin + viewOffset + offset;
+      return out;
+    }
+  };
+
+  // One triangle primitive of a mesh instance
+  struct Primitive {
+    uint32_t shape;
+    uint32_t instance;
+    const Json* json;
+    glm::mat4 transform;
+  };
+
+  glm::mat4 nodeTransform(const Json& node) {
+    glm::mat4 m(1.0f);
+    const Json& matrix = node["matrix"];
+    if (matrix.size() == 16) {
+      for (int c = 0; c < 4; c++)
+	for (int r = 0; r < 4; r++)
+	  m[c][r] = static_cast<float>(matrix[4 * c + r].num(0));
+      return m;
+    }
+    // T * R * S
+    const Json& t = node["translation"];
+    const Json& r = node["rotation"];
+    const Json& s = node["scale"];
+    float x = static_cast<float>(r[0].num(0)), y = static_cast<float>(r[1].num(0));
+    float z = static_cast<float>(r[2].num(0)), w = static_cast<float>(r[3].num(1));
+    glm::vec3 scale(static_cast<float>(s[0].num(1)), static_cast<float>(s[1].num(1)),
+		    static_cast<float>(s[2].num(1)));
+    m[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w), 0) * scale.x;
+    m[1] = glm::vec4(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w), 0) * scale.y;
+    m[2] = glm::vec4(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y), 0) * scale.z;
+    m[3] = glm::vec4(static_cast<float>(t[0].num(0)), static_cast<float>(t[1].num(0)),
+		     static_cast<float>(t[2].num(0)), 1);
+    return m;
+  }
+
+  bool isIdentity(const glm::mat4& m) {
+    for (int c = 0; c < 4; c++)
+      for (int r = 0; r < 4; r++)
+	if (m[c][r] != (c == r ? 1.0f : 0.0f))
+	  return false;
+    return true;
+  }
+
+  // Triangle primitives of every mesh instance of the default scene, in the
+  // order of a depth first walk. Files without scenes draw each mesh once.
+  std::vector<Primitive> collectPrimitives(const Glb& glb, std::vector<std::string>& shapeNames) {
+    std::vector<Primitive> primitives;
+    const Json& json = glb.json;
+    uint32_t instance = 0;
+    auto addMesh = [&](int meshIndex, const std::string& name, const glm::mat4& transform) {
+      const Json& mesh = json["meshes"][static_cast<size_t>(meshIndex)];
+      if (meshIndex < 0 || mesh.isNull())
+	glb.fail("missing mesh " + std::to_string(meshIndex));
+      const uint32_t shape = static_cast<uint32_t>(shapeNames.size());
+      shapeNames.push_back(name.empty() ? mesh["name"].string : name);
+      for (const Json& primitive : mesh["primitives"].items) {
+	if (primitive["mode"].integer(4) != 4) {
+	  std::cerr << "Warning: skipping a primitive that is not a triangle list in " << glb.path << "\n";
+	  continue;
+	}
+	primitives.push_back({shape, instance, &primitive, transform});
+      }
+      instance++;
+    };
+
+    const Json& scenes = json["scenes"];
+    if (scenes.size() == 0) {
+      for (size_t m = 0; m < json["meshes"].size(); m++)
+	addMesh(static_cast<int>(m), std::string(), glm::mat4(1.0f));
+      return primitives;
+    }
+    const Json& scene = scenes[static_cast<size_t>(json["scene"].integer(0))];
+    const size_t numNodes = json["nodes"].size();
+    struct Pending { int node; glm::mat4 parent; size_t depth; };
+    std::vector<Pending> stack;
+    for (size_t i = scene["nodes"].size(); i-- > 0;)
+      stack.push_back({scene["nodes"][i].integer(-1), glm::mat4(1.0f), 0});
+    while (!stack.empty()) {
+      Pending pending = stack.back();
+      stack.pop_back();
+      const Json& node = json["nodes"][static_cast<size_t>(pending.node)];
+      // A cycle would walk deeper than there are nodes
+      if (pending.node < 0 || node.isNull() || pending.depth > numNodes)
+	glb.fail("bad node hierarchy");
+      const glm::mat4 transform = pending.parent * nodeTransform(node);
+      if (!node["mesh"].isNull())
+	addMesh(node["mesh"].integer(-1), node["name"].string, transform);
+      const Json& children = node["children"];
+      for (size_t i = children.size(); i-- > 0;)
+	stack.push_back({children[i].integer(-1), transform, pending.depth + 1});
+    }
+    return primitives;
+  }
+
+  // Blinn-Phong approximation of a metallic-roughness material
+  tinyobj::material_t convertMaterial(const Json& json, const Json& material) {
+    tinyobj::material_t out;
+    out.name = material["name"].string;
+    const Json& pbr = material["pbrMetallicRoughness"];
+    const Json& factor = pbr["baseColorFactor"];
+    const float metallic = static_cast<float>(pbr["metallicFactor"].num(1));
+    const float roughness = static_cast<float>(pbr["roughnessFactor"].num(1));
+    for (int c = 0; c < 3; c++) {
+      const float base = static_cast<float>(factor[c].num(1));
+      out.diffuse[c] = base * (1.0f - metallic);
+      out.specular[c] = 0.04f + (base - 0.04f) * metallic;
+      out.emission[c] = static_cast<float>(material["emissiveFactor"][c].num(0));
+    }
+    out.dissolve = static_cast<float>(factor[3].num(1));
+    const float alpha = std::max(roughness * roughness, 0.01f);
+    out.shininess = std::min(std::max(2.0f / (alpha * alpha) - 2.0f, 1.0f), 1000.0f);
+
+    // Embedded images have no name to load them by
+    auto textureName = [&](const Json& info) -> std::string {
+      if (info.isNull())
+	return std::string();
+      const Json& texture = json["textures"][static_cast<size_t>(info["index"].integer(-1))];
+      const Json& image = json["images"][static_cast<size_t>(texture["source"].integer(-1))];
+      const std::string& uri = image["uri"].string;
+      return uri.compare(0, 5, "data:") == 0 ? std::string() : uri;
+    };
+    out.diffuse_texname = textureName(pbr["baseColorTexture"]);
+    out.normal_texname = textureName(material["normalTexture"]);
+    out.emissive_texname = textureName(material["emissiveTexture"]);
+    return out;
+  }
+
+  // Format the renderer reads an attribute in as it is stored
+  VertexFormat storedFormat(const Accessor& a) {
+    if (a.componentType == FloatType && !a.normalized)
+      return VertexFormat::Float;
+    if (a.componentType == UnsignedShort && a.normalized)
+      return VertexFormat::Unorm16;
+    if (a.componentType == Short && a.normalized)
+      return VertexFormat::Snorm16;
+    if (a.componentType == Byte && a.normalized)
+      return VertexFormat::Snorm8;
+    return VertexFormat::None;
+  }
+
+  struct DirectAttribute {
+    const char* name;
+    int components;
+    VertexAttribute VertexLayout::*slot;
+  };
+
+  const DirectAttribute directAttributes[] = {
+    {"POSITION", 3, &VertexLayout::position},
+    {"NORMAL", 3, &VertexLayout::normal},
+    {"TEXCOORD_0", 2, &VertexLayout::uv},
+    {"TANGENT", 4, &VertexLayout::tangent},
+  };
+
+  bool formatAllowed(const DirectAttribute& attribute, VertexFormat format) {
+    // Unorm16 positions would be decoded relative to the bounds
+    if (attribute.slot == &VertexLayout::position)
+      return format == VertexFormat::Float;
+    if (attribute.slot == &VertexLayout::uv)
+      return format == VertexFormat::Float || format == VertexFormat::Unorm16;
+    return format != VertexFormat::None && format != VertexFormat::Unorm16;
+  }
+
+  void setSphere(Submesh& submesh) {
+    float extent = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+      submesh.center[axis] = (submesh.boundsMin[axis] + submesh.boundsMax[axis]) * 0.5f;
+      float half = (submesh.boundsMax[axis] - submesh.boundsMin[axis]) * 0.5f;
+      extent += half * half;
+    }
+    submesh.radius = std::sqrt(extent);
+  }
+
+  // The vertex stream as it is in the file: all primitives read one buffer
+  // view with the same attributes at the same offsets within the stride.
+  // Indices are widened and rebased unless they already are one run of
+  // 32-bit values starting at vertex 0. Returns false when the layout does
+  // not fit.
+  bool mapPrimitives(const Glb& glb, const std::vector<Primitive>& primitives,
+		     const std::vector<tinyobj::material_t>& materials, LoadedMesh& mesh) {
+    if (primitives.empty())
+      return false;
+    // Instances of one mesh may share its vertices, but only untransformed
+    for (const Primitive& primitive : primitives)
+      if (!isIdentity(primitive.transform))
+	return false;
+
+    struct Placement { const unsigned char* start; size_t count; Accessor position; };
+    std::vector<Placement> placements;
+    VertexLayout layout;
+    int view = -1;
+    const unsigned char* lowest = nullptr;
+    for (const Primitive& primitive : primitives) {
+      const Json& attributes = (*primitive.json)["attributes"];
+      VertexLayout own;
+      const unsigned char* start = nullptr;
+      Accessor accessors[4];
+      bool present[4] = {};
+      for (size_t k = 0; k < 4; k++) {
+	const Json& index = attributes[directAttributes[k].name];
+	if (index.isNull())
+	  continue;
+	accessors[k] = glb.accessor(index.integer(-1));
+	const Accessor& a = accessors[k];
+	if (!a.data || a.components != directAttributes[k].components ||
+	    !formatAllowed(directAttributes[k], storedFormat(a)))
+	  return false;
+	if (view >= 0 && a.bufferView != view)
+	  return false;
+	view = a.bufferView;
+	present[k] = true;
+	start = start ? std::min(start, a.data) : a.data;
+      }
+      if (!present[0])
+	return false;
+      for (size_t k = 0; k < 4; k++) {
+	if (!present[k])
+	  continue;
+	const Accessor& a = accessors[k];
+	if (a.stride != accessors[0].stride || a.count != accessors[0].count ||
+	    static_cast<size_t>(a.data - start) + a.elementSize > a.stride)
+	  return false;
+	VertexAttribute& attribute = own.*directAttributes[k].slot;
+	attribute.format = storedFormat(a);
+	attribute.components = static_cast<uint8_t>(a.components);
+	attribute.offset = static_cast<uint16_t>(a.data - start);
+      }
+      own.stride = static_cast<uint32_t>(accessors[0].stride);
+      if (placements.empty()) {
+	layout = own;
+      } else if (std::memcmp(&own, &layout, sizeof(VertexLayout)) != 0 ||
+		 (start - placements[0].start) % static_cast<ptrdiff_t>(layout.stride) != 0) {
+	return false;
+      }
+      lowest = lowest ? std::min(lowest, start) : start;
+      placements.push_back({start, accessors[0].count, accessors[0]});
+    }
+
+    // Vertex 0 is the lowest start; every primitive begins a whole number of
+    // strides after it
+    size_t numVertices = 0;
+    std::vector<uint32_t> bases;
+    for (const Placement& placement : placements) {
+      bases.push_back(static_cast<uint32_t>((placement.start - lowest) / layout.stride));
+      numVertices = std::max(numVertices, bases.back() + placement.count);
+    }
+    // The upload reads whole strides, which must stay inside the buffer
+    if (static_cast<size_t>(lowest - glb.bin) + numVertices * layout.stride > glb.binSize)
+      return false;
+
+    // Indices as they are when they line up, otherwise a widened copy
+    MeshData& data = mesh.data;
+    const unsigned char* runStart = nullptr;
+    const unsigned char* runEnd = nullptr;
+    bool direct = true;
+    size_t numIndices = 0;
+    std::vector<Accessor> indexAccessors;
+    for (size_t p = 0; p < primitives.size(); p++) {
+      const Json& indices = (*primitives[p].json)["indices"];
+      Accessor a;
+      if (indices.isNull()) {
+	a.count = placements[p].count;
+      } else {
+	a = glb.accessor(indices.integer(-1));
+	if (a.components != 1 || (a.componentType != UnsignedByte && a.componentType != UnsignedShort &&
+				  a.componentType != UnsignedInt))
+	  glb.fail("bad index accessor");
+      }
+      a.count -= a.count % 3;
+      direct = direct && !indices.isNull() && a.data && a.componentType == UnsignedInt &&
+	a.stride == 4 && reinterpret_cast<uintptr_t>(a.data) % 4 == 0 && bases[p] == 0 &&
+	(runEnd == nullptr || a.data == runEnd);
+      if (!runStart)
+	runStart = a.data;
+      runEnd = a.data + a.count * 4;
+      numIndices += a.count;
+      indexAccessors.push_back(a);
+    }
+    if (!direct) {
+      data.indices.resize(numIndices);
+      size_t next = 0;
+      for (size_t p = 0; p < primitives.size(); p++) {
+	const Accessor& a = indexAccessors[p];
+	for (size_t i = 0; i < a.count; i++)
+	  data.indices[next++] = bases[p] + (a.data ? a.readIndex(i) : static_cast<uint32_t>(i));
+      }
+    }
+    const unsigned int* indices = direct ? reinterpret_cast<const unsigned int*>(runStart) : data.indices.data();
+    // Indices past the vertices would read outside the mapping
+    for (size_t i = 0; i < numIndices; i++)
+      if (indices[i] >= numVertices)
+	glb.fail("index out of range");
+
+    // Bounds from the min/max the format requires on positions
+    data.submeshes.clear();
+    data.lods.clear();
+    size_t firstIndex = 0;
+    for (size_t p = 0; p < primitives.size(); p++) {
+      Submesh submesh = {};
+      submesh.shape = primitives[p].shape;
+      int material = (*primitives[p].json)["material"].integer(-1);
+      submesh.material = material >= 0 && static_cast<size_t>(material) < materials.size() ? material : -1;
+      submesh.firstLod = static_cast<uint32_t>(data.lods.size());
+      submesh.lodCount = 1;
+      data.lods.push_back(MeshLod{static_cast<uint32_t>(firstIndex),
+				  static_cast<uint32_t>(indexAccessors[p].count), 0.0f});
+      firstIndex += indexAccessors[p].count;
+
+      const Accessor& position = placements[p].position;
+      if (position.hasBounds) {
+	std::copy(position.min, position.min + 3, submesh.boundsMin);
+	std::copy(position.max, position.max + 3, submesh.boundsMax);
+      } else {
+	for (int axis = 0; axis < 3; axis++) {
+	  submesh.boundsMin[axis] = position.count ? position.read(0, axis) : 0.0f;
+	  submesh.boundsMax[axis] = submesh.boundsMin[axis];
+	}
+	for (size_t i = 1; i < position.count; i++)
+	  for (int axis = 0; axis < 3; axis++) {
+	    submesh.boundsMin[axis] = std::min(submesh.boundsMin[axis], position.read(i, axis));
+	    submesh.boundsMax[axis] = std::max(submesh.boundsMax[axis], position.read(i, axis));
+	  }
+      }
+      setSphere(submesh);
+      data.submeshes.push_back(submesh);
+      glm::vec3 lower(submesh.boundsMin[0], submesh.boundsMin[1], submesh.boundsMin[2]);
+      glm::vec3 upper(submesh.boundsMax[0], submesh.boundsMax[1], submesh.boundsMax[2]);
+      data.boundsMin = p == 0 ? lower : glm::min(data.boundsMin, lower);
+      data.boundsMax = p == 0 ? upper : glm::max(data.boundsMax, upper);
+    }
+
+    MeshView& v = mesh.view;
+    v = MeshView();
+    v.vertexData = lowest;
+    v.layout = layout;
+    v.indices = indices;
+    v.lods = data.lods.data();
+    v.submeshes = data.submeshes.data();
+    v.numVertices = numVertices;
+    v.numIndices = numIndices;
+    v.numLods = data.lods.size();
+    v.numSubmeshes = data.submeshes.size();
+    v.boundsMin = data.boundsMin;
+    v.boundsMax = data.boundsMax;
+    return true;
+  }
+
+  // Copies the primitives into the float arrays of mesh with their node
+  // transforms applied. Primitives of one instance that share attribute
+  // accessors share vertices; missing normals are smoothed over the
+  // triangles, tangents are kept only when every primitive has them.
+  void convertPrimitives(const Glb& glb, const std::vector<Primitive>& primitives,
+			 const std::vector<tinyobj::material_t>& materials, MeshData& mesh,
+			 unsigned numThreads) {
+    mesh.vertices.clear();
+    mesh.normals.clear();
+    mesh.uvs.clear();
+    mesh.tangents.clear();
+    mesh.indices.clear();
+    mesh.submeshes.clear();
+    mesh.lods.clear();
+    bool anyNormals = false, anyUVs = false, allTangents = true;
+    std::vector<char> needsNormal;
+    std::map<std::vector<int>, uint32_t> shared;
+
+    for (const Primitive& primitive : primitives) {
+      const Json& attributes = (*primitive.json)["attributes"];
+      if (attributes["POSITION"].isNull())
+	continue;
+      const std::vector<int> key = {static_cast<int>(primitive.instance),
+				    attributes["POSITION"].integer(-1), attributes["NORMAL"].integer(-1),
+				    attributes["TEXCOORD_0"].integer(-1), attributes["TANGENT"].integer(-1)};
+      const bool hasTangents = key[4] >= 0;
+      allTangents = allTangents && hasTangents;
+
+      auto found = shared.find(key);
+      uint32_t base = static_cast<uint32_t>(mesh.vertices.size() / 3);
+      const Accessor position = glb.accessor(key[1]);
+      if (found != shared.end()) {
+	base = found->second;
+      } else {
+	shared.emplace(key, base);
+	const glm::mat4& m = primitive.transform;
+	// Cofactors transform normals like the inverse transpose, up to scale
+	glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+	glm::vec3 n0 = glm::cross(c1, c2), n1 = glm::cross(c2, c0), n2 = glm::cross(c0, c1);
+	Accessor normal, uv, tangent;
+	if (key[2] >= 0) normal = glb.accessor(key[2]);
+	if (key[3] >= 0) uv = glb.accessor(key[3]);
+	if (hasTangents) tangent = glb.accessor(key[4]);
+	for (size_t i = 0; i < position.count; i++) {
+	  glm::vec4 p = m * glm::vec4(position.read(i, 0), position.read(i, 1), position.read(i, 2), 1.0f);
+	  mesh.vertices.insert(mesh.vertices.end(), {p.x, p.y, p.z});
+	  glm::vec3 n(0.0f, 0.0f, 1.0f);
+	  if (key[2] >= 0 && i < normal.count) {
+	    glm::vec3 source(normal.read(i, 0), normal.read(i, 1), normal.read(i, 2));
+	    n = n0 * source.x + n1 * source.y + n2 * source.z;
+	    float length = glm::length(n);
+	    n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	  }
+	  mesh.normals.insert(mesh.normals.end(), {n.x, n.y, n.z});
+	  needsNormal.push_back(key[2] < 0);
+	  if (key[3] >= 0 && i < uv.count)
+	    mesh.uvs.insert(mesh.uvs.end(), {uv.read(i, 0), uv.read(i, 1)});
+	  else
+	    mesh.uvs.insert(mesh.uvs.end(), {0.0f, 0.0f});
+	  glm::vec3 t(1.0f, 0.0f, 0.0f);
+	  float sign = 1.0f;
+	  if (hasTangents && i < tangent.count) {
+	    glm::vec3 source(tangent.read(i, 0), tangent.read(i, 1), tangent.read(i, 2));
+	    t = c0 * source.x + c1 * source.y + c2 * source.z;
+	    float length = glm::length(t);
+	    t = length > 0.0f ? t / length : glm::vec3(1.0f, 0.0f, 0.0f);
+	    sign = tangent.read(i, 3) < 0.0f ? -1.0f : 1.0f;
+	  }
+	  mesh.tangents.insert(mesh.tangents.end(), {t.x, t.y, t.z, sign});
+	}
+	anyNormals = anyNormals || key[2] >= 0;
+	anyUVs = anyUVs || key[3] >= 0;
+      }
+
+      // A mirroring transform turns the winding around
+      const glm::mat4& m = primitive.transform;
+      const bool flip = glm::dot(glm::cross(glm::vec3(m[0]), glm::vec3(m[1])), glm::vec3(m[2])) < 0.0f;
+      const Json& indexJson = (*primitive.json)["indices"];
+      Accessor indices;
+      if (!indexJson.isNull()) {
+	indices = glb.accessor(indexJson.integer(-1));
+	if (indices.components != 1)
+	  glb.fail("bad index accessor");
+      } else {
+	indices.count = position.count;
+      }
+      const size_t count = indices.count - indices.count % 3;
+
+      Submesh submesh = {};
+      submesh.shape = primitive.shape;
+      int material = (*primitive.json)["material"].integer(-1);
+      submesh.material = material >= 0 && static_cast<size_t>(material) < materials.size() ? material : -1;
+      submesh.firstLod = static_cast<uint32_t>(mesh.lods.size());
+      submesh.lodCount = 1;
+      mesh.submeshes.push_back(submesh);
+      mesh.lods.push_back(MeshLod{static_cast<uint32_t>(mesh.indices.size()), static_cast<uint32_t>(count), 0.0f});
+      for (size_t i = 0; i < count; i += 3) {
+	uint32_t corner[3];
+	for (size_t k = 0; k < 3; k++) {
+	  uint32_t index = indexJson.isNull() ? static_cast<uint32_t>(i + k) : indices.readIndex(i + k);
+	  if (index >= position.count)
+	    glb.fail("index out of range");
+	  corner[k] = base + index;
+	}
+	if (flip)
+	  std::swap(corner[1], corner[2]);
+	mesh.indices.insert(mesh.indices.end(), corner, corner + 3);
+      }
+    }
+
+    if (std::find(needsNormal.begin(), needsNormal.end(), 1) != needsNormal.end()) {
+      fillVertexNormals(mesh.vertices, mesh.indices, needsNormal, mesh.normals);
+      anyNormals = true;
+    }
+
+    mesh.hasNormals = anyNormals;
+    mesh.hasUVs = anyUVs;
+    mesh.hasTangents = allTangents && anyNormals && anyUVs && !mesh.vertices.empty();
+    if (!mesh.hasTangents)
+      std::vector<float>().swap(mesh.tangents);
+
+    if (!mesh.vertices.empty()) {
+      mesh.boundsMin = mesh.boundsMax = glm::vec3(mesh.vertices[0], mesh.vertices[1], mesh.vertices[2]);
+      for (size_t i = 3; i < mesh.vertices.size(); i += 3) {
+	glm::vec3 p(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+	mesh.boundsMin = glm::min(mesh.boundsMin, p);
+	mesh.boundsMax = glm::max(mesh.boundsMax, p);
+      }
+    }
+    computeSubmeshBounds(mesh, numThreads);
+  }
+
+  Glb readGlb(const std::string& path, const MappedFile& file) {
+    Glb glb;
+    glb.path = path;
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(file.data());
+    const size_t size = file.size();
+    uint32_t header[3];
+    if (size < 20)
+      glb.fail("too short");
+    std::memcpy(header, data, sizeof(header));
+    if (header[0] != 0x46546C67u)
+      glb.fail("not a binary glTF file");
+    if (header[1] != 2)
+      glb.fail("unsupported version " + std::to_string(header[1]));
+    const size_t length = std::min<size_t>(header[2], size);
+
+    // A JSON chunk followed by an optional binary chunk
+    size_t offset = 12;
+    bool haveJson = false;
+    while (offset + 8 <= length) {
+      uint32_t chunk[2];
+      std::memcpy(chunk, data + offset, sizeof(chunk));
+      offset += 8;
+      if (chunk[0] > length - offset)
+	glb.fail("chunk out of range");
+      const char* begin = reinterpret_cast<const char*>(data + offset);
+      if (chunk[1] == 0x4E4F534Au && !haveJson) {
+	try {
+	  glb.json = JsonParser(begin, begin + chunk[0]).parse();
+	} catch (const std::runtime_error& e) {
+	  glb.fail(e.what());
+	}
+	haveJson = true;
+      } else if (chunk[1] == 0x004E4942u && !glb.bin) {
+	glb.bin = data + offset;
+	glb.binSize = chunk[0];
+      }
+      offset += (chunk[0] + 3) & ~size_t(3);
+    }
+    if (!haveJson)
+      glb.fail("no JSON chunk");
+    if (glb.json["buffers"].size() > 1 || !glb.json["buffers"][0]["uri"].isNull())
+      glb.fail("external buffers are not supported");
+    return glb;
+  }
+}
+
+bool isGlb(const std::string& path) {
+  return std::filesystem::path(path).extension() == ".glb";
+}
+
+bool loadGlbMesh(const std::string& path, const LoadOptions& options, LoadedMesh& mesh) {
+  auto start = std::chrono::steady_clock::now();
+  if (!mesh.source.open(path))
+    throw std::runtime_error("Failed to open " + path);
+  const Glb glb = readGlb(path, mesh.source);
+
+  mesh.materials.clear();
+  for (const Json& material : glb.json["materials"].items)
+    mesh.materials.push_back(convertMaterial(glb.json, material));
+  mesh.shapeNames.clear();
+  const std::vector<Primitive> primitives = collectPrimitives(glb, mesh.shapeNames);
+
+  if (options.mapSourceBuffers && mapPrimitives(glb, primitives, mesh.materials, mesh)) {
+    auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cout << "Mapped " << path << " in " << time.count() << " ms: " << mesh.view.numVertices
+	      << " vertices, " << mesh.view.numIndices << " indices, " << mesh.view.layout.stride
+	      << " bytes per vertex, indices "
+	      << (mesh.data.indices.empty() ? "mapped" : "converted") << "\n";
+    return true;
+  }
+
+  convertPrimitives(glb, primitives, mesh.materials, mesh.data, options.loaderThreads);
+  auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+  std::cout << "Converted " << path << " in " << time.count() << " ms: "
+	    << mesh.data.vertices.size() / 3 << " vertices, " << mesh.data.indices.size()
+	    << " indices, " << mesh.data.submeshes.size() << " submeshes in "
+	    << mesh.shapeNames.size() << " shapes\n";
+  return false;
+}
@@ -0,0 +1,26 @@
+#ifndef GLTF_LOADER_H
+#define GLTF_LOADER_H
+
+#include "meshbuilder.h"
+
+#include <string>
+
+// Loader for binary glTF 2.0 files (.glb) with the JSON header and a single
+// embedded buffer. Triangle primitives become submeshes: one shape per mesh
+// instance in the scene, named after its node, and one submesh per
+// primitive. Materials are mapped from metallic-roughness onto the OBJ
+// material fields; texture names are the image URIs, relative to the file.
+
+bool isGlb(const std::string& path);
+
+// Maps the file at path into mesh.source. When options.mapSourceBuffers is set, no
+// mesh instance has a transform and the primitives share one
+// interleaved vertex layout the renderer reads as it is stored, mesh.view
+// points straight into the mapping (the indices too when they are one run
+// of 32-bit values) and true is returned. Otherwise the primitives are
+// converted into mesh.data with their node transforms applied, ready for the
+// same optimization, meshlet and LOD steps as an .obj, and false is
+// returned. Throws std::runtime_error when the file is invalid.
+bool loadGlbMesh(const std::string& path, const LoadOptions& options, LoadedMesh& mesh);
+
+#endif
@@ -0,0 +1,246 @@
+#include "ktx2.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <vector>
+
+namespace {
+  const uint8_t ktx2Identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+  const char cacheKeyName[] = "SmallRendererCacheKey";
+
+  struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+  };
+  static_assert(sizeof(Ktx2Header) == 80, "KTX2 header layout");
+
+  struct Ktx2Level {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+  };
+
+  // VkFormat values of the formats written
+  uint32_t vkFormat(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::R8: return 9;     // VK_FORMAT_R8_UNORM
+    case TextureFormat::RG8: return 16;   // VK_FORMAT_R8G8_UNORM
+    case TextureFormat::RGB8: return 23;  // VK_FORMAT_R8G8B8_UNORM
+    case TextureFormat::RGBA8: return 37; // VK_FORMAT_R8G8B8A8_UNORM
+    case TextureFormat::BC1: return 131;  // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+    case TextureFormat::BC4: return 139;  // VK_FORMAT_BC4_UNORM_BLOCK
+    case TextureFormat::BC5: return 141;  // VK_FORMAT_BC5_UNORM_BLOCK
+    case TextureFormat::BC7: return 145;  // VK_FORMAT_BC7_UNORM_BLOCK
+    default: return 0;
+    }
+  }
+
+  TextureFormat formatOfVk(uint32_t vk) {
+    for (TextureFormat format : {TextureFormat::R8, TextureFormat::RG8, TextureFormat::RGB8, TextureFormat::RGBA8,
+				  TextureFormat::BC1, TextureFormat::BC4, TextureFormat::BC5, TextureFormat::BC7})
+      if (vkFormat(format) == vk)
+	return format;
+    return TextureFormat::None;
+  }
+
+  void put32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+      out.push_back(uint8_t(value >> (8 * i)));
+  }
+
+  // Basic data format descriptor, linear BT.709: one sample per byte of an
+  // uncompressed texel, or per 64 bits of a 4x4 block
+  std::vector<uint8_t> dataFormatDescriptor(TextureFormat format) {
+    struct Sample {
+      uint16_t bitOffset;
+      uint8_t bitLength;  // minus one
+      uint8_t channel;
+      uint32_t upper;
+    };
+    uint8_t model = 1;  // RGBSDA
+    uint8_t blockDimensions[4] = {0, 0, 0, 0};
+    Sample samples[4] = {{0, 63, 0, 0xFFFFFFFFu}, {64, 63, 1, 0xFFFFFFFFu}};
+    uint32_t numSamples = 1;
+    switch (format) {
+    case TextureFormat::BC1: model = 128; break;                    // BC1A, color
+    case TextureFormat::BC4: model = 131; break;                    // BC4, data
+    case TextureFormat::BC5: model = 132; numSamples = 2; break;    // BC5, red and green
+    case TextureFormat::BC7: model = 134; samples[0].bitLength = 127; break;  // BC7, color
+    default:
+      numSamples = static_cast<uint32_t>(textureRowSize(format, 1));
+      for (uint32_t i = 0; i < numSamples; i++)
+	samples[i] = {uint16_t(8 * i), 7, uint8_t(i), 255};
+      if (format == TextureFormat::RGBA8)
+	samples[3].channel = 15;  // alpha
+    }
+    if (isBlockCompressed(format))
+      blockDimensions[0] = blockDimensions[1] = 3;
+    const uint32_t blockSize = 24 + 16 * numSamples;
+    std::vector<uint8_t> dfd;
+    put32(dfd, 4 + blockSize);  // total size
+    put32(dfd, 0);              // Khronos vendor, basic descriptor type
+    put32(dfd, 2 | (blockSize << 16));  // version 2
+    dfd.push_back(model);
+    dfd.push_back(1);  // BT.709 primaries
+    dfd.push_back(1);  // linear transfer
+    dfd.push_back(0);  // straight alpha
+    dfd.insert(dfd.end(), blockDimensions, blockDimensions + 4);
+    const uint8_t bytesPlanes[8] = {uint8_t(textureLevelSize(format, 1, 1)), 0, 0, 0, 0, 0, 0, 0};
+    dfd.insert(dfd.end(), bytesPlanes, bytesPlanes + 8);
+    for (uint32_t i = 0; i < numSamples; i++) {
+      const Sample& sample = samples[i];
+      put32(dfd, sample.bitOffset | (uint32_t(sample.bitLength) << 16) | (uint32_t(sample.channel) << 24));
+      put32(dfd, 0);  // sample position
+      put32(dfd, 0);
+      put32(dfd, sample.upper);
+    }
+    return dfd;
+  }
+
+  void addKeyValue(std::vector<uint8_t>& kvd, const char* key, const void* value, size_t size) {
+    const size_t keyLength = std::strlen(key) + 1;
+    put32(kvd, static_cast<uint32_t>(keyLength + size));
+    kvd.insert(kvd.end(), key, key + keyLength);
+    kvd.insert(kvd.end(), static_cast<const uint8_t*>(value), static_cast<const uint8_t*>(value) + size);
+    while (kvd.size() % 4 != 0)
+      kvd.push_back(0);
+  }
+
+  size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+}
+
+bool writeKtx2(const std::string& path, const TextureData& texture, uint64_t cacheKey) {
+  if (!vkFormat(texture.format) || texture.levels.empty())
+    return false;
+  Ktx2Header header = {};
+  std::memcpy(header.identifier, ktx2Identifier, sizeof(ktx2Identifier));
+  header.vkFormat = vkFormat(texture.format);
+  header.typeSize = 1;
+  header.pixelWidth = static_cast<uint32_t>(texture.width);
+  header.pixelHeight = static_cast<uint32_t>(texture.height);
+  header.faceCount = 1;
+  header.levelCount = static_cast<uint32_t>(texture.levels.size());
+
+  const std::vector<uint8_t> dfd = dataFormatDescriptor(texture.format);
+  std::vector<uint8_t> kvd;
+  addKeyValue(kvd, "KTXorientation", "ru", 3);
+  addKeyValue(kvd, "KTXwriter", "SmallRenderer", 14);
+  addKeyValue(kvd, cacheKeyName, &cacheKey, sizeof(cacheKey));
+  header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + texture.levels.size() * sizeof(Ktx2Level));
+  header.dfdByteLength = static_cast<uint32_t>(dfd.size());
+  header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+  header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+  // Level data goes smallest level first, each aligned to the texel or
+  // block size and to 4 bytes
+  const size_t alignment = std::lcm<size_t>(textureLevelSize(texture.format, 1, 1), 4);
+  std::vector<Ktx2Level> levels(texture.levels.size());
+  size_t offset = header.kvdByteOffset + header.kvdByteLength;
+  for (size_t i = levels.size(); i-- > 0;) {
+    offset = alignUp(offset, alignment);
+    levels[i] = {offset, texture.levels[i].size, texture.levels[i].size};
+    offset += texture.levels[i].size;
+  }
+
+  // Same as the mesh cache: a reader never maps a half written file
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(levels.data()),
+	      static_cast<std::streamsize>(levels.size() * sizeof(Ktx2Level)));
+    out.write(reinterpret_cast<const char*>(dfd.data()), static_cast<std::streamsize>(dfd.size()));
+    out.write(reinterpret_cast<const char*>(kvd.data()), static_cast<std::streamsize>(kvd.size()));
+    for (size_t i = levels.size(); i-- > 0;) {
+      const std::vector<char> padding(levels[i].byteOffset - static_cast<size_t>(out.tellp()), 0);
+      out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+      out.write(reinterpret_cast<const char*>(texture.data + texture.levels[i].offset),
+		static_cast<std::streamsize>(texture.levels[i].size));
+    }
+    if (!out) {
+      out.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tmpPath, path, error);
+  if (error) {
+    std::remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readKtx2(const std::string& path, uint64_t cacheKey, TextureData& texture) {
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(Ktx2Header))
+    return false;
+  Ktx2Header header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  const TextureFormat format = formatOfVk(header.vkFormat);
+  if (std::memcmp(header.identifier, ktx2Identifier, sizeof(ktx2Identifier)) != 0 ||
+      format == TextureFormat::None || header.pixelWidth == 0 || header.pixelHeight == 0 ||
+      header.pixelDepth != 0 || header.layerCount != 0 || header.faceCount != 1 ||
+      header.supercompressionScheme != 0 || header.levelCount == 0 || header.levelCount > 32 ||
+      sizeof(Ktx2Header) + header.levelCount * sizeof(Ktx2Level) > file.size() ||
+      uint64_t(header.kvdByteOffset) + header.kvdByteLength > file.size())
+    return false;
+
+  // Stale unless the cache key matches
+  bool current = false;
+  const char* kvd = file.data() + header.kvdByteOffset;
+  for (size_t at = 0; at + 4 <= header.kvdByteLength && !current;) {
+    uint32_t length;
+    std::memcpy(&length, kvd + at, sizeof(length));
+    if (length > header.kvdByteLength - at - 4)
+      return false;
+    const char* entry = kvd + at + 4;
+    const size_t keyLength = sizeof(cacheKeyName);
+    current = length == keyLength + sizeof(uint64_t) && std::memcmp(entry, cacheKeyName, keyLength) == 0 &&
+      std::memcmp(entry + keyLength, &cacheKey, sizeof(cacheKey)) == 0;
+    at = alignUp(at + 4 + length, 4);
+  }
+  if (!current)
+    return false;
+
+  texture.format = format;
+  texture.width = static_cast<int>(header.pixelWidth);
+  texture.height = static_cast<int>(header.pixelHeight);
+  texture.levels.resize(header.levelCount);
+  for (uint32_t i = 0; i < header.levelCount; i++) {
+    Ktx2Level level;
+    std::memcpy(&level, file.data() + sizeof(Ktx2Header) + i * sizeof(Ktx2Level), sizeof(level));
+    const int width = std::max(texture.width >> i, 1), height = std::max(texture.height >> i, 1);
+    if (level.byteLength != textureLevelSize(format, width, height) || level.byteOffset > file.size() ||
+	level.byteLength > file.size() - level.byteOffset)
+      return false;
+    texture.levels[i] = {width, height, static_cast<size_t>(level.byteOffset), static_cast<size_t>(level.byteLength)};
+  }
+  texture.storage.clear();
+  texture.mapping = std::move(file);
+  texture.data = reinterpret_cast<const unsigned char*>(texture.mapping.data());
+  return true;
+}
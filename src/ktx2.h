@@ -0,0 +1,22 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include "textureloader.h"
+
+#include <cstdint>
+#include <string>
+
+// KTX2 files holding textures with all their mipmaps, used as the texture
+// cache. Levels are stored smallest first without supercompression and with
+// the KTXorientation "ru", bottom row first. A key derived from the source
+// image and the load options is kept in the key/value data, so a cache whose
+// source or options changed is recognized and rebuilt.
+
+// Writes a texture of any TextureFormat. Returns false on a write error.
+bool writeKtx2(const std::string& path, const TextureData& texture, uint64_t cacheKey);
+
+// Maps a file written by writeKtx2 into texture when it was written with
+// cacheKey. Returns false for a missing, foreign or stale file.
+bool readKtx2(const std::string& path, uint64_t cacheKey, TextureData& texture);
+
+#endif
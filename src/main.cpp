@@ -1,17 +1,97 @@
+#include "numparse.h"
+#include "objparser.h"
 #include "smallrender.h"
 #include<stdexcept>
+#include<vector>
 
 int main(int argc, char *argv[]){
-  if (argc < 2)
-    throw std::runtime_error("Usage: program <model_path>");
+  // Split the arguments into options (--name value) and positional arguments
+  LoadOptions options;
+  TextureOptions textureOptions;
+  float lodPixelError = 1.0f;
+  std::vector<std::string> hiddenShapes;
+  bool verifyParser = false;
+  bool watch = false;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--weld-tolerance") {
+      if (++i >= argc)
+	throw std::runtime_error("--weld-tolerance expects a value");
+      options.weldTolerance = std::stof(argv[i]);
+    } else if (arg == "--crease-angle") {
+      if (++i >= argc)
+	throw std::runtime_error("--crease-angle expects a value in degrees");
+      options.creaseAngle = std::stof(argv[i]);
+    } else if (arg == "--loader-threads") {
+      if (++i >= argc)
+	throw std::runtime_error("--loader-threads expects a value");
+      options.loaderThreads = static_cast<unsigned>(std::stoul(argv[i]));
+    } else if (arg == "--stream-budget") {
+      if (++i >= argc)
+	throw std::runtime_error("--stream-budget expects a value in MB");
+      options.streamBudget = static_cast<size_t>(std::stoul(argv[i])) << 20;
+    } else if (arg == "--upload-budget") {
+      if (++i >= argc)
+	throw std::runtime_error("--upload-budget expects a value in ms");
+      options.uploadBudgetMs = std::stod(argv[i]);
+    } else if (arg == "--sync-load") {
+      options.asyncLoading = false;
+    } else if (arg == "--no-mesh-cache") {
+      options.useMeshCache = false;
+    } else if (arg == "--no-optimize") {
+      options.optimizeMesh = false;
+    } else if (arg == "--no-lods") {
+      options.generateLods = false;
+    } else if (arg == "--no-mapping") {
+      options.mapSourceBuffers = false;
+    } else if (arg == "--no-texture-compression") {
+      textureOptions.compress = false;
+    } else if (arg == "--mip-filter") {
+      if (++i >= argc)
+	throw std::runtime_error("--mip-filter expects box or kaiser");
+      textureOptions.mipFilter = mipFilterByName(argv[i]);
+    } else if (arg == "--lod-error") {
+      if (++i >= argc)
+	throw std::runtime_error("--lod-error expects a value in pixels");
+      lodPixelError = std::stof(argv[i]);
+    } else if (arg == "--watch") {
+      watch = true;
+    } else if (arg == "--verify-parser") {
+      verifyParser = true;
+    } else if (arg == "--hide-shape") {
+      if (++i >= argc)
+	throw std::runtime_error("--hide-shape expects a shape name");
+      hiddenShapes.push_back(argv[i]);
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  if (args.size() < 1)
+    throw std::runtime_error("Usage: program <model_path> [mtl_path] [--weld-tolerance <t>] [--crease-angle <deg>] [--loader-threads <n>] [--no-mesh-cache] [--no-optimize] [--no-lods] [--no-mapping] [--no-texture-compression] [--mip-filter <box|kaiser>] [--lod-error <px>] [--hide-shape <name>] [--stream-budget <MB>] [--sync-load] [--upload-budget <ms>] [--watch] [--verify-parser]");
+
+  // Checks the number parser against strtod and the parsed model against
+  // tinyobj instead of rendering
+  if (verifyParser) {
+    size_t mismatches = verifyNumberParsing(args[0]);
+    mismatches += verifyObjParser(args[0], options.loaderThreads);
+    return mismatches == 0 ? 0 : 1;
+  }
 
   std::string mtl;
-  if( argc < 3)
+  if( args.size() < 2)
     mtl = "./";
   else
-    mtl = argv[2];
+    mtl = args[1];
   SmallRenderer sr(500, 500);
-  std::string path = argv[1];
+  sr.setLoadOptions(options);
+  sr.setTextureOptions(textureOptions);
+  sr.setLodPixelError(lodPixelError);
+  sr.setWatchFiles(watch);
+  for (const std::string& name : hiddenShapes)
+    sr.setShapeVisible(name, false);
+  std::string path = args[0];
   sr.init(path, mtl);
   sr.run();
 }
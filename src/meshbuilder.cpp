@@ -0,0 +1,496 @@
+#include "meshbuilder.h"
+#include "bounds.h"
+#include "common/parallel.h"
+#include "decompress.h"
+#include "gltfloader.h"
+#include "meshcache.h"
+#include "meshopt.h"
+#include "normals.h"
+#include "plyloader.h"
+#include "simplify.h"
+#include "stlloader.h"
+#include "tangents.h"
+#include "objparser.h"
+#include "weld.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "common/tiny_obj_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+namespace {
+  // Key identifying a unique vertex. Without a weld tolerance this is the
+  // (position, normal, uv) index triple of a face corner; with a tolerance the
+  // position is replaced by its grid cell and normal/uv by their bit patterns,
+  // so corners that only differ by index still collapse.
+  struct VertexKey {
+    int64_t p[3];
+    uint32_t n[3];
+    uint32_t t[2];
+
+    bool operator==(const VertexKey& o) const {
+      return p[0] == o.p[0] && p[1] == o.p[1] && p[2] == o.p[2] &&
+	n[0] == o.n[0] && n[1] == o.n[1] && n[2] == o.n[2] &&
+	t[0] == o.t[0] && t[1] == o.t[1];
+    }
+  };
+
+  struct VertexKeyHash {
+    size_t operator()(const VertexKey& k) const {
+      uint64_t h = 14695981039346656037ull;
+      auto mix = [&h](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+      for (int i = 0; i < 3; i++) mix(static_cast<uint64_t>(k.p[i]));
+      for (int i = 0; i < 3; i++) mix(k.n[i]);
+      for (int i = 0; i < 2; i++) mix(k.t[i]);
+      return static_cast<size_t>(h ^ (h >> 32));
+    }
+  };
+
+  // Reads .mtl files like tinyobj::MaterialFileReader and notes the absolute
+  // path of each one asked for, found or not, for the mesh cache key
+  class RecordingMaterialReader : public tinyobj::MaterialReader {
+  public:
+    RecordingMaterialReader(const std::string& baseDir, std::vector<std::string>& paths)
+      : m_reader(baseDir), m_baseDir(baseDir), m_paths(paths) {}
+
+    bool operator()(const std::string& matId, std::vector<tinyobj::material_t>* materials,
+		    std::map<std::string, int>* matMap, std::string* warn, std::string* err) override {
+      const std::filesystem::path path = std::filesystem::path(m_baseDir) / matId;
+      m_paths.push_back(std::filesystem::absolute(path).lexically_normal().string());
+      return m_reader(matId, materials, matMap, warn, err);
+    }
+
+  private:
+    tinyobj::MaterialFileReader m_reader;
+    std::string m_baseDir;
+    std::vector<std::string>& m_paths;
+  };
+
+  // Tangents are only worth their four bytes per vertex with a normal map
+  bool usesNormalMaps(const std::vector<tinyobj::material_t>& materials) {
+    for (const auto& material : materials)
+      if (!material.normal_texname.empty() || !material.bump_texname.empty())
+	return true;
+    return false;
+  }
+
+  // Stable counting sort of the triangles in order by keys[triangle]
+  std::vector<uint32_t> sortByKey(const std::vector<uint32_t>& order,
+				  const std::vector<uint32_t>& keys, size_t numKeys) {
+    std::vector<size_t> starts(numKeys + 1, 0);
+    for (uint32_t key : keys)
+      starts[key + 1]++;
+    for (size_t k = 0; k < numKeys; k++)
+      starts[k + 1] += starts[k];
+    std::vector<uint32_t> sorted(order.size());
+    for (uint32_t t : order)
+      sorted[starts[keys[t]]++] = t;
+    return sorted;
+  }
+
+  // Sorts the triangles by shape and then by material and makes one submesh
+  // per (shape, material) pair that is used. Ids outside the material list
+  // count as no material.
+  void groupTriangles(MeshData& mesh, const std::vector<uint32_t>& triangleShapes, size_t numShapes,
+		      const std::vector<int>& triangleMaterials, size_t numMaterials) {
+    const size_t numTriangles = triangleMaterials.size();
+    std::vector<uint32_t> buckets(numTriangles);
+    for (size_t t = 0; t < numTriangles; t++) {
+      int material = triangleMaterials[t];
+      buckets[t] = material >= 0 && static_cast<size_t>(material) < numMaterials ? material + 1 : 0;
+    }
+    // Two passes of a radix sort, least significant key first
+    std::vector<uint32_t> order(numTriangles);
+    for (size_t t = 0; t < numTriangles; t++)
+      order[t] = static_cast<uint32_t>(t);
+    order = sortByKey(sortByKey(order, buckets, numMaterials + 1), triangleShapes, numShapes);
+
+    mesh.submeshes.clear();
+    mesh.lods.clear();
+    for (size_t i = 0; i < numTriangles; i++) {
+      const uint32_t t = order[i];
+      if (i == 0 || triangleShapes[t] != mesh.submeshes.back().shape ||
+	  static_cast<int32_t>(buckets[t]) - 1 != mesh.submeshes.back().material) {
+	Submesh submesh = {};
+	submesh.shape = triangleShapes[t];
+	submesh.material = static_cast<int32_t>(buckets[t]) - 1;
+	submesh.firstLod = static_cast<uint32_t>(mesh.lods.size());
+	submesh.lodCount = 1;
+	mesh.submeshes.push_back(submesh);
+	mesh.lods.push_back(MeshLod{static_cast<uint32_t>(3 * i), 0, 0.0f});
+      }
+      mesh.lods.back().indexCount += 3;
+    }
+    if (mesh.submeshes.size() <= 1)
+      return;
+
+    std::vector<unsigned int> sorted(mesh.indices.size());
+    for (size_t i = 0; i < numTriangles; i++)
+      for (size_t k = 0; k < 3; k++)
+	sorted[3 * i + k] = mesh.indices[3 * order[i] + k];
+    mesh.indices.swap(sorted);
+  }
+
+  uint32_t floatBits(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+  }
+
+  // Position of a corner; normal and uv get defaults when it has none
+  const float* cornerAttributes(const tinyobj::attrib_t& attrib, const tinyobj::index_t& idx,
+				float normal[3], float uv[2]) {
+    normal[0] = 0.0f;
+    normal[1] = 0.0f;
+    normal[2] = 1.0f;
+    uv[0] = uv[1] = 0.0f;
+    if (idx.normal_index >= 0)
+      std::copy(&attrib.normals[3 * idx.normal_index], &attrib.normals[3 * idx.normal_index] + 3, normal);
+    if (idx.texcoord_index >= 0)
+      std::copy(&attrib.texcoords[2 * idx.texcoord_index], &attrib.texcoords[2 * idx.texcoord_index] + 2, uv);
+    return &attrib.vertices[3 * idx.vertex_index];
+  }
+
+  VertexKey vertexKey(const tinyobj::attrib_t& attrib, const tinyobj::index_t& idx, bool weld,
+		      float invTolerance) {
+    VertexKey key;
+    if (!weld) {
+      key = {{idx.vertex_index, 0, 0}, {static_cast<uint32_t>(idx.normal_index), 0, 0},
+	     {static_cast<uint32_t>(idx.texcoord_index), 0}};
+      return key;
+    }
+    float normal[3], uv[2];
+    const float* position = cornerAttributes(attrib, idx, normal, uv);
+    for (int i = 0; i < 3; i++) {
+      key.p[i] = static_cast<int64_t>(std::floor(position[i] * invTolerance + 0.5f));
+      key.n[i] = floatBits(normal[i]);
+    }
+    key.t[0] = floatBits(uv[0]);
+    key.t[1] = floatBits(uv[1]);
+    return key;
+  }
+
+  // Calls fn(shape, first, last) for the part of every shape that overlaps
+  // [begin, end) of the concatenation, offsets being the prefix sum of the
+  // shape sizes; first and last are relative to the shape
+  template <typename Fn>
+  void forEachShapeRange(const std::vector<size_t>& offsets, size_t begin, size_t end, Fn&& fn) {
+    size_t s = std::upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+    for (; begin < end; s++) {
+      size_t last = std::min(end, offsets[s + 1]);
+      if (last > begin)
+	fn(s, begin - offsets[s], last - offsets[s]);
+      begin = std::max(begin, last);
+    }
+  }
+
+  // Both parsers keep indices past the end of the attribute arrays, like
+  // tinyobj does. Triangles with such a position are dropped; such normals
+  // and uvs count as absent. Returns the number of dropped triangles.
+  size_t dropMissingAttributes(const tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+			       unsigned threads) {
+    const int numVertices = static_cast<int>(attrib.vertices.size() / 3);
+    const int numNormals = static_cast<int>(attrib.normals.size() / 3);
+    const int numTexcoords = static_cast<int>(attrib.texcoords.size() / 2);
+    auto valid = [&](const tinyobj::index_t& idx) {
+      return idx.vertex_index < numVertices && idx.normal_index < numNormals && idx.texcoord_index < numTexcoords;
+    };
+
+    // Files without such indices only pay for a parallel scan
+    std::vector<size_t> offsets(shapes.size() + 1, 0);
+    for (size_t s = 0; s < shapes.size(); s++)
+      offsets[s + 1] = offsets[s] + shapes[s].mesh.indices.size();
+    std::vector<char> threadInvalid(threads, 0);
+    parallelFor(offsets.back(), threads, [&](size_t begin, size_t end, unsigned t) {
+      forEachShapeRange(offsets, begin, end, [&](size_t s, size_t first, size_t last) {
+	const tinyobj::index_t* corners = shapes[s].mesh.indices.data();
+	for (size_t c = first; c < last; c++)
+	  threadInvalid[t] |= !valid(corners[c]);
+      });
+    });
+    if (std::find(threadInvalid.begin(), threadInvalid.end(), 1) == threadInvalid.end())
+      return 0;
+
+    size_t dropped = 0;
+    for (auto& shape : shapes) {
+      tinyobj::mesh_t& mesh = shape.mesh;
+      size_t kept = 0;
+      for (size_t t = 0; t < mesh.material_ids.size(); t++) {
+	tinyobj::index_t* corners = &mesh.indices[3 * t];
+	if (corners[0].vertex_index >= numVertices || corners[1].vertex_index >= numVertices ||
+	    corners[2].vertex_index >= numVertices) {
+	  dropped++;
+	  continue;
+	}
+	for (int k = 0; k < 3; k++) {
+	  if (corners[k].normal_index >= numNormals)
+	    corners[k].normal_index = -1;
+	  if (corners[k].texcoord_index >= numTexcoords)
+	    corners[k].texcoord_index = -1;
+	}
+	std::copy(corners, corners + 3, &mesh.indices[3 * kept]);
+	mesh.material_ids[kept] = mesh.material_ids[t];
+	mesh.smoothing_group_ids[kept] = mesh.smoothing_group_ids[t];
+	kept++;
+      }
+      mesh.indices.resize(3 * kept);
+      mesh.num_face_vertices.resize(kept);
+      mesh.material_ids.resize(kept);
+      mesh.smoothing_group_ids.resize(kept);
+    }
+    return dropped;
+  }
+}
+
+void loadObjMesh(const std::string& path, const LoadOptions& options, MeshData& mesh,
+		 std::vector<tinyobj::material_t>& materials, std::vector<std::string>& shapeNames,
+		 std::vector<std::string>* materialLibraries) {
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+  std::string warn, err;
+
+  // .mtl files are searched next to the .obj
+  std::string mtlBaseDir;
+  size_t separator = path.find_last_of("/\\");
+  if (separator != std::string::npos)
+    mtlBaseDir = path.substr(0, separator + 1);
+
+  std::vector<std::string> libraries;
+  RecordingMaterialReader reader(mtlBaseDir, libraries);
+
+  auto start = std::chrono::steady_clock::now();
+  bool loaded;
+  // tinyobj reads the file itself, so compressed ones always take our parser
+  const bool useTinyobj = options.loaderThreads == 0 && !isCompressed(path);
+  if (useTinyobj) {
+    // The stream overload is the one that takes a material reader. tinyobj
+    // appends to materials, which a rejected mesh cache may have filled.
+    materials.clear();
+    std::ifstream stream(path);
+    loaded = stream && tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &stream, &reader);
+    if (!stream.is_open())
+      err = "Cannot open file [" + path + "]\n";
+  } else {
+    loaded = parseObjParallel(&attrib, &shapes, &materials, &warn, &err,
+			      path, mtlBaseDir, std::max(options.loaderThreads, 1u), &reader);
+  }
+  auto parseTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+  if (!loaded) {
+    if (!err.empty()) 
+      std::cerr << "TinyObjReader: " << err;
+    throw std::runtime_error("Failed to Load Object");
+  }
+  if (!warn.empty())
+    std::cout << "TinyObjReader: " << warn;
+  std::cout << "Parsed " << path << " in " << parseTime.count() << " ms ("
+	    << (useTinyobj ? std::string("tinyobj") :
+		std::to_string(std::max(options.loaderThreads, 1u)) + " threads") << ")\n";
+  if (materialLibraries)
+    materialLibraries->swap(libraries);
+  const unsigned threads = options.loaderThreads ? options.loaderThreads : defaultThreadCount();
+  if (size_t dropped = dropMissingAttributes(attrib, shapes, threads))
+    std::cout << "Dropped " << dropped << " triangles whose positions are missing\n";
+  buildIndexedMesh(attrib, shapes, materials.size(), options, mesh, shapeNames);
+}
+
+void buildIndexedMesh(tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes, size_t numMaterials,
+		      const LoadOptions& options, MeshData& mesh, std::vector<std::string>& shapeNames) {
+  // Corners without a vn get smooth normals instead of a constant
+  auto start = std::chrono::steady_clock::now();
+  size_t generated = generateNormals(attrib, shapes, options.creaseAngle, options.loaderThreads);
+  if (generated > 0) {
+    auto normalTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cout << "Generated normals for " << generated << " corners in " << normalTime.count()
+	      << " ms (crease angle " << options.creaseAngle << ")\n";
+  }
+
+  // Counting pass: the faces and corners of every shape start at a prefix
+  // sum over the shapes, so each thread knows where its output goes
+  start = std::chrono::steady_clock::now();
+  const unsigned threads = options.loaderThreads ? options.loaderThreads : defaultThreadCount();
+  const size_t numShapes = shapes.size();
+  std::vector<size_t> faceOffsets(numShapes + 1, 0), cornerOffsets(numShapes + 1, 0);
+  shapeNames.resize(numShapes);
+  for (size_t s = 0; s < numShapes; s++) {
+    shapeNames[s] = shapes[s].name;
+    faceOffsets[s + 1] = faceOffsets[s] + shapes[s].mesh.num_face_vertices.size();
+    cornerOffsets[s + 1] = cornerOffsets[s] + shapes[s].mesh.indices.size();
+  }
+  const size_t numFaces = faceOffsets[numShapes];
+  const size_t numCorners = cornerOffsets[numShapes];
+
+  // Flatten the shapes into preallocated arrays
+  std::vector<tinyobj::index_t> corners(numCorners);
+  std::vector<int> material_ids(numFaces);  // one per triangle
+  std::vector<uint32_t> shape_ids(numFaces);  // one per triangle
+  parallelFor(numFaces, threads, [&](size_t begin, size_t end, unsigned) {
+    forEachShapeRange(faceOffsets, begin, end, [&](size_t s, size_t first, size_t last) {
+      const auto& ids = shapes[s].mesh.material_ids;
+      std::copy(ids.begin() + first, ids.begin() + last, material_ids.begin() + faceOffsets[s] + first);
+      std::fill(shape_ids.begin() + faceOffsets[s] + first, shape_ids.begin() + faceOffsets[s] + last,
+		static_cast<uint32_t>(s));
+    });
+  });
+  std::vector<char> threadNormals(threads, 0), threadUVs(threads, 0);
+  parallelFor(numCorners, threads, [&](size_t begin, size_t end, unsigned t) {
+    forEachShapeRange(cornerOffsets, begin, end, [&](size_t s, size_t first, size_t last) {
+      const auto& source = shapes[s].mesh.indices;
+      std::copy(source.begin() + first, source.begin() + last, corners.begin() + cornerOffsets[s] + first);
+    });
+    for (size_t c = begin; c < end; c++) {
+      threadNormals[t] |= corners[c].normal_index >= 0;
+      threadUVs[t] |= corners[c].texcoord_index >= 0;
+    }
+  });
+  const bool anyNormals = std::find(threadNormals.begin(), threadNormals.end(), 1) != threadNormals.end();
+  const bool anyUVs = std::find(threadUVs.begin(), threadUVs.end(), 1) != threadUVs.end();
+
+  // Welding: every corner finds the first corner with its key. Vertices are
+  // numbered in the order of those first corners, which is the order a
+  // sequential pass over the corners would produce.
+  const bool weld = options.weldTolerance > 0.0f;
+  const float invTolerance = weld ? 1.0f / options.weldTolerance : 0.0f;
+  std::vector<uint32_t> firstCorner = findFirstOccurrences<VertexKey, VertexKeyHash>(
+    numCorners, threads, [&](size_t c) { return vertexKey(attrib, corners[c], weld, invTolerance); });
+
+  // First corners get consecutive vertex numbers, the others copy theirs
+  std::vector<unsigned int>& indices = mesh.indices;
+  indices.resize(numCorners);
+  std::vector<size_t> threadUnique;
+  const size_t numUnique = countFirstOccurrences(firstCorner, threads, threadUnique);
+  std::vector<float>& vertices = mesh.vertices;
+  std::vector<float>& normals = mesh.normals;
+  std::vector<float>& uvs = mesh.uvs;
+  vertices.resize(3 * numUnique);
+  normals.resize(3 * numUnique);
+  uvs.resize(2 * numUnique);
+  parallelFor(numCorners, threads, [&](size_t begin, size_t end, unsigned t) {
+    size_t next = threadUnique[t];
+    for (size_t c = begin; c < end; c++) {
+      if (firstCorner[c] != c)
+	continue;
+      indices[c] = static_cast<unsigned int>(next);
+      float normal[3], uv[2];
+      const float* position = cornerAttributes(attrib, corners[c], normal, uv);
+      std::copy(position, position + 3, &vertices[3 * next]);
+      std::copy(normal, normal + 3, &normals[3 * next]);
+      std::copy(uv, uv + 2, &uvs[2 * next]);
+      next++;
+    }
+  });
+  // First corners come before the others of their key and kept their
+  // number, so this reads only finished entries
+  parallelFor(numCorners, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t c = begin; c < end; c++)
+      if (firstCorner[c] != c)
+	indices[c] = indices[firstCorner[c]];
+  });
+
+  groupTriangles(mesh, shape_ids, shapeNames.size(), material_ids, numMaterials);
+
+  // Attributes no corner referenced are left out of the packed layout
+  mesh.hasNormals = anyNormals;
+  mesh.hasUVs = anyUVs;
+
+  // Axis aligned bounds of the welded vertices
+  if (!vertices.empty()) {
+    mesh.boundsMin = mesh.boundsMax = glm::vec3(vertices[0], vertices[1], vertices[2]);
+    for (size_t i = 3; i < vertices.size(); i += 3) {
+      glm::vec3 p(vertices[i], vertices[i + 1], vertices[i + 2]);
+      mesh.boundsMin = glm::min(mesh.boundsMin, p);
+      mesh.boundsMax = glm::max(mesh.boundsMax, p);
+    }
+  }
+
+  computeSubmeshBounds(mesh, options.loaderThreads);
+  auto weldTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+  const size_t vertexBytes = packedLayout(mesh.hasNormals, mesh.hasUVs).stride;
+  std::cout << "Welded in " << weldTime.count() << " ms: " << numCorners << " vertices, "
+	    << numUnique << " unique, "
+	    << (mesh.hasNormals ? normals.size()/3 : 0) << " normals, "
+	    << (numCorners - numUnique) * vertexBytes << " bytes saved by welding, "
+	    << vertexBytes << " bytes per vertex, " << mesh.submeshes.size() << " submeshes in "
+	    << shapeNames.size() << " shapes\n";
+}
+
+namespace {
+  // Splits level 0 of every submesh into meshlets
+  void buildSubmeshMeshlets(MeshData& mesh) {
+    mesh.meshlets.clear();
+    // Meshlets keep the index order, so the local numbering only serves the bounds
+    std::vector<unsigned int> localOf(mesh.vertices.size() / 3, ~0u);
+    LocalRange range;
+    for (Submesh& submesh : mesh.submeshes) {
+      const MeshLod& level = mesh.lods[submesh.firstLod];
+      localizeRange(mesh.indices.data() + level.firstIndex, level.indexCount, mesh.vertices, localOf, range);
+      std::vector<Meshlet> meshlets = buildMeshlets(range.indices, range.positions);
+      for (Meshlet& meshlet : meshlets)
+	meshlet.firstIndex += level.firstIndex;
+      submesh.firstMeshlet = static_cast<uint32_t>(mesh.meshlets.size());
+      submesh.meshletCount = static_cast<uint32_t>(meshlets.size());
+      mesh.meshlets.insert(mesh.meshlets.end(), meshlets.begin(), meshlets.end());
+    }
+    std::cout << "Built " << mesh.meshlets.size() << " meshlets, "
+	      << float(mesh.indices.size() / 3) / std::max<size_t>(mesh.meshlets.size(), 1)
+	      << " triangles each on average\n";
+  }
+}
+
+void loadMesh(const std::string& path, const LoadOptions& options, LoadedMesh& mesh) {
+  mesh.path = path;
+  mesh.textureDir = std::filesystem::path(path).parent_path().string();
+
+  // A valid sidecar is mapped and used as is
+  if (options.useMeshCache &&
+      readMeshCache(path, options, mesh.cache, mesh.view, mesh.materials, mesh.shapeNames)) {
+    std::cout << "Loaded " << meshCachePath(path) << ": " << mesh.view.numVertices
+	      << " vertices, " << mesh.view.numIndices << " indices\n";
+    return;
+  }
+
+  if (isGlb(path)) {
+    if (loadGlbMesh(path, options, mesh))
+      return;
+  } else if (isPly(path)) {
+    if (loadPlyMesh(path, options, mesh))
+      return;
+  } else if (isStl(path)) {
+    mesh.materials.clear();
+    loadStlMesh(path, options, mesh.data, mesh.shapeNames);
+  } else {
+    loadObjMesh(path, options, mesh.data, mesh.materials, mesh.shapeNames, &mesh.materialLibraries);
+  }
+  // Before optimizing, so the vertices split for tangents are reordered too
+  if (mesh.data.hasNormals && mesh.data.hasUVs && !mesh.data.hasTangents &&
+      usesNormalMaps(mesh.materials)) {
+    auto start = std::chrono::steady_clock::now();
+    generateTangents(mesh.data, options.loaderThreads);
+    auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cout << "Generated tangents in " << time.count() << " ms\n";
+  }
+  if (options.optimizeMesh)
+    optimizeMesh(mesh.data);
+  buildSubmeshMeshlets(mesh.data);
+  if (options.generateLods)
+    buildLods(mesh.data);
+  mesh.data.pack();
+  mesh.view = mesh.data.view();
+  if (options.useMeshCache &&
+      !writeMeshCache(path, options, mesh.view, mesh.materials, mesh.shapeNames, mesh.materialLibraries))
+    std::cerr << "Failed to write mesh cache " << meshCachePath(path) << std::endl;
+}
+
+bool isMappedFormat(const std::string& path) {
+  return isGlb(path) || isPly(path);
+}
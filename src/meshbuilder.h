@@ -0,0 +1,58 @@
+#ifndef MESH_BUILDER_H
+#define MESH_BUILDER_H
+
+#include "common/mappedfile.h"
+#include "common/tiny_obj_loader.h"
+#include "meshdata.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Parses an .obj file and welds its face corners into an indexed mesh with
+// one submesh per shape and material. shapeNames gets the name of every
+// shape, empty for unnamed ones, and materialLibraries the absolute path of
+// every .mtl file the mtllib statements asked for. Throws
+// std::runtime_error when the file cannot be parsed.
+void loadObjMesh(const std::string& path, const LoadOptions& options, MeshData& mesh,
+		 std::vector<tinyobj::material_t>& materials, std::vector<std::string>& shapeNames,
+		 std::vector<std::string>* materialLibraries = nullptr);
+
+// The steps of loadObjMesh after parsing, for loaders that produce tinyobj
+// shapes of triangles: corners without a normal get smooth ones within the
+// crease angle, then the corners are welded as the options say.
+void buildIndexedMesh(tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes, size_t numMaterials,
+		      const LoadOptions& options, MeshData& mesh, std::vector<std::string>& shapeNames);
+
+// Result of loading a mesh on the CPU: the mapped mesh cache, a freshly
+// built mesh, a section of a scene pack or a mapped .glb or .ply. view points
+// into whichever of them holds the data, so the struct must not be copied
+// once loaded.
+struct LoadedMesh {
+  std::string path;
+  MeshData data;
+  MappedFile cache;
+  std::shared_ptr<MappedFile> pack;  // shared by the meshes of one pack
+  MappedFile source;                 // a .glb or .ply whose buffers view points into
+  MeshView view;
+  std::vector<tinyobj::material_t> materials;
+  std::vector<std::string> shapeNames;  // indexed by Submesh::shape
+  std::vector<std::string> materialLibraries;  // .mtl files of an .obj, see loadObjMesh
+  // Directory the texture names of materials are relative to
+  std::string textureDir;
+  // Filled on request for delta uploads, see hashChunks
+  std::vector<uint64_t> vertexChunkHashes;
+  std::vector<uint64_t> indexChunkHashes;
+};
+
+// Loads path from its mesh cache when that is valid, otherwise parses and
+// welds it and writes the cache. .glb and .ply files are chosen by extension
+// and mapped as they are when possible (see loadGlbMesh and loadPlyMesh).
+// Throws std::runtime_error on failure.
+void loadMesh(const std::string& path, const LoadOptions& options, LoadedMesh& mesh);
+
+// True for the formats whose buffers loadMesh can map instead of welding
+bool isMappedFormat(const std::string& path);
+
+#endif
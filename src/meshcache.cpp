@@ -0,0 +1,384 @@
+#include "meshcache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+
+namespace {
+  const char cacheMagic[8] = {'S', 'R', 'M', 'E', 'S', 'H', '\0', '\0'};
+  // Bump whenever the layout or the loader output changes
+  const uint32_t cacheVersion = 15;
+
+  struct CacheAttribute {
+    uint8_t format;
+    uint8_t components;
+    uint16_t offset;
+  };
+
+  struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    // key
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    float weldTolerance;
+    float creaseAngle;
+    uint32_t flags;
+    uint64_t numLibraries;  // .mtl files, keyed in the metadata
+    // contents
+    uint64_t numVertices;
+    uint64_t numIndices;
+    uint64_t numMeshlets;
+    uint64_t numLods;
+    uint64_t numSubmeshes;
+    uint64_t numMaterials;
+    uint64_t numShapes;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t stride;
+    uint32_t points;  // 1 for point clouds, which have no indices
+    CacheAttribute position;
+    CacheAttribute normal;
+    CacheAttribute uv;
+    CacheAttribute tangent;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t meshletOffset;
+    uint64_t lodOffset;
+    uint64_t submeshOffset;
+    uint64_t metadataOffset;  // materials, then shape names
+    uint64_t metadataBytes;
+  };
+
+  CacheAttribute toCache(const VertexAttribute& attribute) {
+    return {static_cast<uint8_t>(attribute.format), attribute.components, attribute.offset};
+  }
+
+  VertexAttribute fromCache(const CacheAttribute& attribute) {
+    VertexAttribute result;
+    result.format = static_cast<VertexFormat>(attribute.format);
+    result.components = attribute.components;
+    result.offset = attribute.offset;
+    return result;
+  }
+
+  bool sourceKey(const std::string& path, uint64_t& size, int64_t& time) {
+    std::error_code error;
+    size = std::filesystem::file_size(path, error);
+    if (error)
+      return false;
+    auto writeTime = std::filesystem::last_write_time(path, error);
+    if (error)
+      return false;
+    time = static_cast<int64_t>(writeTime.time_since_epoch().count());
+    return true;
+  }
+
+  // Options besides the weld tolerance that change the cached mesh. With
+  // mapping a .glb or .ply that can be mapped is never cached, without it
+  // the converted mesh is, and that one must not stand in for the mapping.
+  // --loader-threads 0 parses with tinyobj, which rounds numbers its own
+  // way; a cache written by one parser is not served to the other, so
+  // their output and load times stay comparable.
+  const uint32_t optimizedFlag = 1;
+  const uint32_t lodsFlag = 2;
+  const uint32_t mappingFlag = 4;
+  const uint32_t tinyobjFlag = 8;
+
+  uint32_t optionFlags(const LoadOptions& options) {
+    return (options.optimizeMesh ? optimizedFlag : 0) | (options.generateLods ? lodsFlag : 0) |
+      (options.mapSourceBuffers ? mappingFlag : 0) | (options.loaderThreads == 0 ? tinyobjFlag : 0);
+  }
+
+  // Size and modification time of a material library, all ones for a
+  // library that did not exist, so creating it invalidates the cache too
+  struct LibraryKey {
+    std::string path;
+    uint64_t size = ~uint64_t(0);
+    int64_t time = 0;
+  };
+
+  LibraryKey libraryKey(const std::string& path) {
+    LibraryKey key;
+    key.path = path;
+    if (!sourceKey(path, key.size, key.time)) {
+      key.size = ~uint64_t(0);
+      key.time = 0;
+    }
+    return key;
+  }
+
+  // Materials are stored as the values the renderer uses followed by
+  // length prefixed strings, so loading from the cache needs no .mtl file.
+  // The shape names follow as length prefixed strings, then the path, size
+  // and time of every material library.
+  struct CacheMaterial {
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float shininess;
+    float dissolve;
+  };
+
+  void writeString(std::string& out, const std::string& value) {
+    uint32_t length = static_cast<uint32_t>(value.size());
+    out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    out.append(value);
+  }
+
+  bool readString(const char*& cursor, const char* end, std::string& value) {
+    uint32_t length;
+    if (static_cast<size_t>(end - cursor) < sizeof(length))
+      return false;
+    std::memcpy(&length, cursor, sizeof(length));
+    cursor += sizeof(length);
+    if (static_cast<size_t>(end - cursor) < length)
+      return false;
+    value.assign(cursor, length);
+    cursor += length;
+    return true;
+  }
+
+  std::string serializeMetadata(const std::vector<tinyobj::material_t>& materials,
+				const std::vector<std::string>& shapeNames, const std::vector<LibraryKey>& libraries) {
+    std::string out;
+    for (const auto& material : materials) {
+      CacheMaterial values;
+      std::memcpy(values.ambient, material.ambient, sizeof(values.ambient));
+      std::memcpy(values.diffuse, material.diffuse, sizeof(values.diffuse));
+      std::memcpy(values.specular, material.specular, sizeof(values.specular));
+      values.shininess = material.shininess;
+      values.dissolve = material.dissolve;
+      out.append(reinterpret_cast<const char*>(&values), sizeof(values));
+      writeString(out, material.name);
+      writeString(out, material.ambient_texname);
+      writeString(out, material.diffuse_texname);
+      writeString(out, material.specular_texname);
+      writeString(out, material.normal_texname);
+      writeString(out, material.bump_texname);
+      writeString(out, material.alpha_texname);
+    }
+    for (const std::string& name : shapeNames)
+      writeString(out, name);
+    for (const LibraryKey& library : libraries) {
+      writeString(out, library.path);
+      out.append(reinterpret_cast<const char*>(&library.size), sizeof(library.size));
+      out.append(reinterpret_cast<const char*>(&library.time), sizeof(library.time));
+    }
+    return out;
+  }
+
+  bool deserializeMetadata(const char* data, size_t bytes, size_t numMaterials, size_t numShapes,
+			   size_t numLibraries, std::vector<tinyobj::material_t>& materials,
+			   std::vector<std::string>& shapeNames, std::vector<LibraryKey>& libraries) {
+    const char* cursor = data;
+    const char* end = data + bytes;
+    materials.assign(numMaterials, tinyobj::material_t());
+    for (auto& material : materials) {
+      CacheMaterial values;
+      if (static_cast<size_t>(end - cursor) < sizeof(values))
+	return false;
+      std::memcpy(&values, cursor, sizeof(values));
+      cursor += sizeof(values);
+      std::memcpy(material.ambient, values.ambient, sizeof(values.ambient));
+      std::memcpy(material.diffuse, values.diffuse, sizeof(values.diffuse));
+      std::memcpy(material.specular, values.specular, sizeof(values.specular));
+      material.shininess = values.shininess;
+      material.dissolve = values.dissolve;
+      if (!readString(cursor, end, material.name) ||
+	  !readString(cursor, end, material.ambient_texname) ||
+	  !readString(cursor, end, material.diffuse_texname) ||
+	  !readString(cursor, end, material.specular_texname) ||
+	  !readString(cursor, end, material.normal_texname) ||
+	  !readString(cursor, end, material.bump_texname) ||
+	  !readString(cursor, end, material.alpha_texname))
+	return false;
+    }
+    shapeNames.assign(numShapes, std::string());
+    for (std::string& name : shapeNames)
+      if (!readString(cursor, end, name))
+	return false;
+    libraries.assign(numLibraries, LibraryKey());
+    for (LibraryKey& library : libraries) {
+      if (!readString(cursor, end, library.path) ||
+	  static_cast<size_t>(end - cursor) < sizeof(library.size) + sizeof(library.time))
+	return false;
+      std::memcpy(&library.size, cursor, sizeof(library.size));
+      std::memcpy(&library.time, cursor + sizeof(library.size), sizeof(library.time));
+      cursor += sizeof(library.size) + sizeof(library.time);
+    }
+    return true;
+  }
+
+  // Sections start on 16 byte boundaries so the mapped arrays stay aligned
+  uint64_t alignUp(uint64_t offset) { return (offset + 15) & ~uint64_t(15); }
+
+  // Checks the header and the section bounds and points view into data
+  bool parseBlob(const char* data, size_t size, CacheHeader& header, MeshView& view,
+		 std::vector<tinyobj::material_t>& materials, std::vector<std::string>& shapeNames,
+		 std::vector<LibraryKey>& libraries) {
+    if (size < sizeof(CacheHeader))
+      return false;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+	header.version != cacheVersion || header.headerSize != sizeof(CacheHeader))
+      return false;
+
+    // reject truncated files
+    if (header.indexOffset + header.numIndices * sizeof(unsigned int) > size ||
+	header.vertexOffset + header.numVertices * header.stride > size ||
+	header.meshletOffset + header.numMeshlets * sizeof(Meshlet) > size ||
+	header.lodOffset + header.numLods * sizeof(MeshLod) > size ||
+	header.submeshOffset + header.numSubmeshes * sizeof(Submesh) > size ||
+	header.metadataOffset + header.metadataBytes > size ||
+	!deserializeMetadata(data + header.metadataOffset, header.metadataBytes, header.numMaterials,
+			     header.numShapes, header.numLibraries, materials, shapeNames, libraries))
+      return false;
+
+    view.vertexData = data + header.vertexOffset;
+    view.layout.stride = header.stride;
+    view.points = header.points != 0;
+    view.layout.position = fromCache(header.position);
+    view.layout.normal = fromCache(header.normal);
+    view.layout.uv = fromCache(header.uv);
+    view.layout.tangent = fromCache(header.tangent);
+    view.indices = reinterpret_cast<const unsigned int*>(data + header.indexOffset);
+    view.meshlets = reinterpret_cast<const Meshlet*>(data + header.meshletOffset);
+    view.lods = reinterpret_cast<const MeshLod*>(data + header.lodOffset);
+    view.submeshes = reinterpret_cast<const Submesh*>(data + header.submeshOffset);
+    view.numVertices = header.numVertices;
+    view.numIndices = header.numIndices;
+    view.numMeshlets = header.numMeshlets;
+    view.numLods = header.numLods;
+    view.numSubmeshes = header.numSubmeshes;
+    view.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    view.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    return true;
+  }
+}
+
+std::string meshCachePath(const std::string& sourcePath) {
+  return sourcePath + ".srcache";
+}
+
+bool readMeshBlob(const char* data, size_t size, MeshView& view,
+		  std::vector<tinyobj::material_t>& materials, std::vector<std::string>& shapeNames) {
+  CacheHeader header;
+  std::vector<LibraryKey> libraries;
+  return parseBlob(data, size, header, view, materials, shapeNames, libraries);
+}
+
+bool writeMeshBlob(std::ostream& out, const std::string& sourcePath, const LoadOptions& options,
+		   const MeshView& mesh, const std::vector<tinyobj::material_t>& materials,
+		   const std::vector<std::string>& shapeNames, const std::vector<std::string>& materialLibraries) {
+  CacheHeader header = {};
+  std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+  header.version = cacheVersion;
+  header.headerSize = sizeof(CacheHeader);
+  if (!sourceKey(sourcePath, header.sourceSize, header.sourceTime))
+    return false;
+  header.weldTolerance = options.weldTolerance;
+  header.creaseAngle = options.creaseAngle;
+  header.flags = optionFlags(options);
+  std::vector<LibraryKey> libraries;
+  for (const std::string& library : materialLibraries)
+    libraries.push_back(libraryKey(library));
+  header.numLibraries = libraries.size();
+  header.numVertices = mesh.numVertices;
+  header.numIndices = mesh.numIndices;
+  header.numMeshlets = mesh.numMeshlets;
+  header.numLods = mesh.numLods;
+  header.numSubmeshes = mesh.numSubmeshes;
+  header.numMaterials = materials.size();
+  header.numShapes = shapeNames.size();
+  for (int i = 0; i < 3; i++) {
+    header.boundsMin[i] = mesh.boundsMin[i];
+    header.boundsMax[i] = mesh.boundsMax[i];
+  }
+  header.stride = mesh.layout.stride;
+  header.points = mesh.points ? 1 : 0;
+  header.position = toCache(mesh.layout.position);
+  header.normal = toCache(mesh.layout.normal);
+  header.uv = toCache(mesh.layout.uv);
+  header.tangent = toCache(mesh.layout.tangent);
+  const size_t vertexBytes = mesh.numVertices * mesh.layout.stride;
+  header.vertexOffset = alignUp(sizeof(CacheHeader));
+  header.indexOffset = alignUp(header.vertexOffset + vertexBytes);
+  header.meshletOffset = alignUp(header.indexOffset + mesh.numIndices * sizeof(unsigned int));
+  header.lodOffset = alignUp(header.meshletOffset + mesh.numMeshlets * sizeof(Meshlet));
+  header.submeshOffset = alignUp(header.lodOffset + mesh.numLods * sizeof(MeshLod));
+  const std::string metadata = serializeMetadata(materials, shapeNames, libraries);
+  header.metadataOffset = alignUp(header.submeshOffset + mesh.numSubmeshes * sizeof(Submesh));
+  header.metadataBytes = metadata.size();
+
+  // Offsets are relative to the start of the blob
+  const uint64_t base = static_cast<uint64_t>(out.tellp());
+  auto section = [&out, base](uint64_t offset, const void* data, size_t bytes) {
+    static const char padding[16] = {};
+    out.write(padding, static_cast<std::streamsize>(base + offset - static_cast<uint64_t>(out.tellp())));
+    out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+  };
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  section(header.vertexOffset, mesh.vertexData, vertexBytes);
+  section(header.indexOffset, mesh.indices, mesh.numIndices * sizeof(unsigned int));
+  section(header.meshletOffset, mesh.meshlets, mesh.numMeshlets * sizeof(Meshlet));
+  section(header.lodOffset, mesh.lods, mesh.numLods * sizeof(MeshLod));
+  section(header.submeshOffset, mesh.submeshes, mesh.numSubmeshes * sizeof(Submesh));
+  section(header.metadataOffset, metadata.data(), metadata.size());
+  return static_cast<bool>(out);
+}
+
+bool readMeshCache(const std::string& sourcePath, const LoadOptions& options,
+		   MappedFile& file, MeshView& view,
+		   std::vector<tinyobj::material_t>& materials, std::vector<std::string>& shapeNames) {
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!sourceKey(sourcePath, sourceSize, sourceTime))
+    return false;
+  if (!file.open(meshCachePath(sourcePath)))
+    return false;
+
+  CacheHeader header;
+  std::vector<LibraryKey> libraries;
+  bool valid = parseBlob(file.data(), file.size(), header, view, materials, shapeNames, libraries) &&
+    header.sourceSize == sourceSize && header.sourceTime == sourceTime &&
+    header.weldTolerance == options.weldTolerance &&
+    header.creaseAngle == options.creaseAngle && header.flags == optionFlags(options);
+  // Materials and tangents come from the .mtl files
+  for (size_t i = 0; valid && i < libraries.size(); i++) {
+    const LibraryKey current = libraryKey(libraries[i].path);
+    valid = current.size == libraries[i].size && current.time == libraries[i].time;
+  }
+  if (!valid)
+    file.close();
+  return valid;
+}
+
+bool writeMeshCache(const std::string& sourcePath, const LoadOptions& options,
+		    const MeshView& mesh, const std::vector<tinyobj::material_t>& materials,
+		    const std::vector<std::string>& shapeNames, const std::vector<std::string>& materialLibraries) {
+  // Write to a temporary file and rename it, so a concurrent reader never
+  // maps a half written cache
+  const std::string path = meshCachePath(sourcePath);
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out || !writeMeshBlob(out, sourcePath, options, mesh, materials, shapeNames, materialLibraries)) {
+      out.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tmpPath, path, error);
+  if (error) {
+    std::remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,42 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "common/mappedfile.h"
+#include "common/tiny_obj_loader.h"
+#include "meshdata.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Binary sidecar holding the packed vertex stream, indices, submeshes,
+// materials and shape names of a mesh, stored next to the source file as
+// <path>.srcache. It is keyed by the size and modification time of the
+// source and of the .mtl files it read, and by the load options that change
+// the result, so a stale or foreign cache is simply ignored and rewritten.
+
+std::string meshCachePath(const std::string& sourcePath);
+
+// Maps a valid cache for sourcePath into file, points view at it and copies
+// out the materials and shape names. Returns false when there is no usable
+// cache.
+bool readMeshCache(const std::string& sourcePath, const LoadOptions& options,
+		   MappedFile& file, MeshView& view,
+		   std::vector<tinyobj::material_t>& materials, std::vector<std::string>& shapeNames);
+
+// materialLibraries are the paths of the .mtl files, see loadObjMesh
+bool writeMeshCache(const std::string& sourcePath, const LoadOptions& options,
+		    const MeshView& mesh, const std::vector<tinyobj::material_t>& materials,
+		    const std::vector<std::string>& shapeNames, const std::vector<std::string>& materialLibraries);
+
+// The same layout as a section of a larger file, used by scene packs.
+// writeMeshBlob writes at the current position of out; offsets inside the
+// blob are relative to its start, which must be 16 byte aligned in the
+// mapping readMeshBlob is given. readMeshBlob does not check the source key.
+bool writeMeshBlob(std::ostream& out, const std::string& sourcePath, const LoadOptions& options,
+		   const MeshView& mesh, const std::vector<tinyobj::material_t>& materials,
+		   const std::vector<std::string>& shapeNames, const std::vector<std::string>& materialLibraries);
+bool readMeshBlob(const char* data, size_t size, MeshView& view,
+		  std::vector<tinyobj::material_t>& materials, std::vector<std::string>& shapeNames);
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef MESH_DATA_H
+#define MESH_DATA_H
+
+#include <glm/glm.hpp>
+
+#include "common/parallel.h"
+#include "meshlets.h"
+#include "vertexformat.h"
+
+#include <cstdint>
+#include <vector>
+
+// Options controlling how an object file is turned into GPU buffers
+struct LoadOptions {
+  // Grid cell size positions are snapped to before welding (0 = exact index match only)
+  float weldTolerance = 0.0f;
+  // Generated normals are not smoothed across edges sharper than this (degrees)
+  float creaseAngle = 60.0f;
+  // Threads for the chunked OBJ parser (0 = tinyobj's single-threaded reader)
+  unsigned loaderThreads = defaultThreadCount();
+  // Reuse/write the binary sidecar next to the source file
+  bool useMeshCache = true;
+  // Reorder triangles and vertices for the post-transform cache and overdraw
+  bool optimizeMesh = true;
+  // Append simplified levels of detail to the index buffer
+  bool generateLods = true;
+  // Upload .glb and .ply vertex data straight from the mapped file when its
+  // layout allows it, without optimization, meshlets or levels of detail
+  bool mapSourceBuffers = true;
+  // Host memory in bytes for a streaming load that uploads the faces batch
+  // by batch instead of building the whole mesh first (0 = off)
+  size_t streamBudget = 0;
+  // Parse on background threads and upload while the render loop runs
+  bool asyncLoading = true;
+  // Time the render loop may spend per frame copying loaded meshes to the GPU
+  double uploadBudgetMs = 4.0;
+};
+
+// Index range of one level of detail. Level 0 is the full mesh. In a point
+// cloud the range counts vertices instead of indices.
+struct MeshLod {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float error;  // estimated distance from the full mesh, in model units
+};
+
+// Triangles of one material within one OBJ shape. Level 0 of its lods is a
+// contiguous range of the index buffer, the meshlets split that range.
+// Submeshes are sorted by shape, then by material.
+struct Submesh {
+  uint32_t shape;    // index into the mesh's shape names
+  int32_t material;  // index into the mesh's materials, -1 = none
+  uint32_t firstMeshlet;
+  uint32_t meshletCount;
+  uint32_t firstLod;
+  uint32_t lodCount;  // level 0 included
+  float boundsMin[3];
+  float boundsMax[3];
+  float center[3];    // bounding sphere
+  float radius;
+};
+
+// Non-owning view of a packed mesh, either in a MeshData or in a mapped cache
+struct MeshView {
+  const void* vertexData = nullptr;     // numVertices * layout.stride bytes
+  VertexLayout layout;
+  const unsigned int* indices = nullptr;
+  const Meshlet* meshlets = nullptr;   // cover level 0 only, by submesh
+  const MeshLod* lods = nullptr;
+  const Submesh* submeshes = nullptr;
+  size_t numVertices = 0;
+  size_t numIndices = 0;
+  size_t numMeshlets = 0;
+  size_t numLods = 0;
+  size_t numSubmeshes = 0;
+  glm::vec3 boundsMin = glm::vec3(0.0f);
+  glm::vec3 boundsMax = glm::vec3(0.0f);
+  bool points = false;  // no indices, the vertices are drawn as points
+};
+
+// Indexed mesh ready for upload. The builder fills the float arrays, pack()
+// turns them into the interleaved stream that is cached and uploaded.
+struct MeshData {
+  std::vector<float> vertices;
+  std::vector<float> normals;
+  std::vector<float> uvs;
+  std::vector<float> tangents;  // xyz and bitangent sign, empty unless hasTangents
+  std::vector<unsigned int> indices;
+  std::vector<Meshlet> meshlets;
+  std::vector<MeshLod> lods;
+  std::vector<Submesh> submeshes;
+  glm::vec3 boundsMin = glm::vec3(0.0f);
+  glm::vec3 boundsMax = glm::vec3(0.0f);
+  // false when no face corner of the source referenced the attribute
+  bool hasNormals = true;
+  bool hasUVs = true;
+  bool hasTangents = false;
+  bool points = false;
+
+  VertexLayout layout;
+  std::vector<unsigned char> packed;
+  size_t numVertices = 0;
+
+  // Packs the float arrays and releases them
+  void pack() {
+    layout = packedLayout(hasNormals, hasUVs, true, hasTangents);
+    numVertices = vertices.size() / 3;
+    packVertices(layout, boundsMin, boundsMax, vertices, normals, uvs, tangents, packed);
+    std::vector<float>().swap(vertices);
+    std::vector<float>().swap(normals);
+    std::vector<float>().swap(uvs);
+    std::vector<float>().swap(tangents);
+  }
+
+  MeshView view() const {
+    MeshView v;
+    v.vertexData = packed.data();
+    v.layout = layout;
+    v.indices = indices.data();
+    v.meshlets = meshlets.data();
+    v.lods = lods.data();
+    v.submeshes = submeshes.data();
+    v.numVertices = numVertices;
+    v.numIndices = indices.size();
+    v.numMeshlets = meshlets.size();
+    v.numLods = lods.size();
+    v.numSubmeshes = submeshes.size();
+    v.boundsMin = boundsMin;
+    v.boundsMax = boundsMax;
+    v.points = points;
+    return v;
+  }
+};
+
+#endif
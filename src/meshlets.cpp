@@ -0,0 +1,148 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  glm::vec3 position(const std::vector<float>& positions, unsigned int v) {
+    return glm::vec3(positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]);
+  }
+
+  void computeBounds(Meshlet& meshlet, const std::vector<unsigned int>& indices,
+		     const std::vector<float>& positions) {
+    const unsigned int* first = &indices[meshlet.firstIndex];
+    const unsigned int* last = first + meshlet.indexCount;
+
+    // Sphere around the center of the bounding box
+    glm::vec3 lower = position(positions, first[0]), upper = lower;
+    for (const unsigned int* i = first; i != last; i++) {
+      lower = glm::min(lower, position(positions, *i));
+      upper = glm::max(upper, position(positions, *i));
+    }
+    glm::vec3 center = (lower + upper) * 0.5f;
+    float radius = 0.0f;
+    for (const unsigned int* i = first; i != last; i++)
+      radius = std::max(radius, glm::length(position(positions, *i) - center));
+
+    // Cone around the average of the face normals
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.indexCount / 3);
+    glm::vec3 axis(0.0f);
+    for (const unsigned int* i = first; i != last; i += 3) {
+      glm::vec3 a = position(positions, i[0]);
+      glm::vec3 n = glm::cross(position(positions, i[1]) - a, position(positions, i[2]) - a);
+      float length = glm::length(n);
+      if (length > 0.0f) {
+	normals.push_back(n / length);
+	axis += n / length;
+      }
+    }
+    float cutoff = 1.0f;
+    float axisLength = glm::length(axis);
+    if (axisLength > 0.0f) {
+      axis = axis / axisLength;
+      float minDot = 1.0f;
+      for (const glm::vec3& n : normals)
+	minDot = std::min(minDot, glm::dot(axis, n));
+      // Wider than about 85 degrees the cone culls next to nothing
+      if (minDot > 0.1f)
+	cutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    for (int k = 0; k < 3; k++) {
+      meshlet.center[k] = center[k];
+      meshlet.coneAxis[k] = axis[k];
+    }
+    meshlet.radius = radius;
+    meshlet.coneCutoff = cutoff;
+  }
+}
+
+std::vector<Meshlet> buildMeshlets(const std::vector<unsigned int>& indices,
+				   const std::vector<float>& positions,
+				   size_t maxVertices, size_t maxTriangles) {
+  std::vector<Meshlet> meshlets;
+  const size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0)
+    return meshlets;
+
+  // stamp[v] == meshlets.size() marks vertices already in the open meshlet
+  const size_t numVertices = positions.size() / 3;
+  std::vector<size_t> stamp(numVertices, ~size_t(0));
+  Meshlet current = {};
+  size_t numMeshletVertices = 0;
+
+  for (size_t t = 0; t < numTriangles; t++) {
+    const unsigned int* tri = &indices[3 * t];
+    size_t added = 0;
+    for (int k = 0; k < 3; k++)
+      if (stamp[tri[k]] != meshlets.size() &&
+	  (k < 1 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1]))
+	added++;
+
+    if (numMeshletVertices + added > maxVertices || current.indexCount / 3 >= maxTriangles) {
+      computeBounds(current, indices, positions);
+      meshlets.push_back(current);
+      current = {};
+      current.firstIndex = static_cast<uint32_t>(3 * t);
+      numMeshletVertices = 0;
+      added = 3 - (tri[1] == tri[0]) - (tri[2] == tri[0] || tri[2] == tri[1]);
+    }
+
+    for (int k = 0; k < 3; k++)
+      stamp[tri[k]] = meshlets.size();
+    numMeshletVertices += added;
+    current.indexCount += 3;
+  }
+  computeBounds(current, indices, positions);
+  meshlets.push_back(current);
+  return meshlets;
+}
+
+Frustum frustumFromMatrix(const glm::mat4& m) {
+  // Gribb/Hartmann: the planes are sums and differences of the matrix rows
+  auto row = [&m](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+  Frustum frustum;
+  frustum.planes[0] = row(3) + row(0);
+  frustum.planes[1] = row(3) - row(0);
+  frustum.planes[2] = row(3) + row(1);
+  frustum.planes[3] = row(3) - row(1);
+  frustum.planes[4] = row(3) + row(2);
+  frustum.planes[5] = row(3) - row(2);
+  for (glm::vec4& plane : frustum.planes) {
+    float length = glm::length(glm::vec3(plane.x, plane.y, plane.z));
+    plane = plane * (1.0f / length);
+  }
+  return frustum;
+}
+
+bool sphereInFrustum(const Frustum& frustum, const float center[3], float radius) {
+  for (const glm::vec4& plane : frustum.planes)
+    if (plane.x * center[0] + plane.y * center[1] + plane.z * center[2] + plane.w < -radius)
+      return false;
+  return true;
+}
+
+bool boxInFrustum(const Frustum& frustum, const float boundsMin[3], const float boundsMax[3]) {
+  for (const glm::vec4& plane : frustum.planes) {
+    // The corner farthest along the plane normal
+    float x = plane.x > 0.0f ? boundsMax[0] : boundsMin[0];
+    float y = plane.y > 0.0f ? boundsMax[1] : boundsMin[1];
+    float z = plane.z > 0.0f ? boundsMax[2] : boundsMin[2];
+    if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+bool meshletVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& camera) {
+  if (!sphereInFrustum(frustum, meshlet.center, meshlet.radius))
+    return false;
+
+  // Every triangle faces away when the camera lies inside the negated cone
+  // (widened by the bounding sphere)
+  const glm::vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+  const glm::vec3 axis(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]);
+  const glm::vec3 toCenter = center - camera;
+  return glm::dot(toCenter, axis) < meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
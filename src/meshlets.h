@@ -0,0 +1,47 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// A cluster of at most maxMeshletVertices vertices and maxMeshletTriangles
+// triangles, stored as a contiguous range of the index buffer. Plain floats so
+// it can be written to the mesh cache as is.
+struct Meshlet {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float center[3];    // bounding sphere
+  float radius;
+  float coneAxis[3];  // average facing direction of the triangles
+  float coneCutoff;   // sine of the cone's half angle, 1 = never backfacing
+};
+
+const size_t maxMeshletVertices = 64;
+const size_t maxMeshletTriangles = 124;
+
+// Splits the index buffer, in its current order, into meshlets. Run it after
+// the index order is optimized, the clusters are only as compact as the order.
+std::vector<Meshlet> buildMeshlets(const std::vector<unsigned int>& indices,
+				   const std::vector<float>& positions,
+				   size_t maxVertices = maxMeshletVertices,
+				   size_t maxTriangles = maxMeshletTriangles);
+
+// Frustum planes (xyz normal pointing inwards, w distance) of a view
+// projection matrix
+struct Frustum {
+  glm::vec4 planes[6];
+};
+
+Frustum frustumFromMatrix(const glm::mat4& viewProjection);
+
+// False when the sphere or box lies completely outside one of the planes
+bool sphereInFrustum(const Frustum& frustum, const float center[3], float radius);
+bool boxInFrustum(const Frustum& frustum, const float boundsMin[3], const float boundsMax[3]);
+
+// False when the meshlet is outside the frustum or all of its triangles face
+// away from the camera
+bool meshletVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& camera);
+
+#endif
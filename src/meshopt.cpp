@@ -0,0 +1,343 @@
+#include "meshopt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace {
+  // Forsyth's scoring parameters
+  const int maxCacheSize = 32;
+  const float cacheDecayPower = 1.5f;
+  const float lastTriangleScore = 0.75f;
+  const float valenceBoostScale = 2.0f;
+  const float valenceBoostPower = 0.5f;
+
+  float vertexScore(int cachePosition, unsigned remainingTriangles) {
+    if (remainingTriangles == 0)
+      return 0.0f;
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+      // the last triangle's vertices get a fixed score so that the next
+      // triangle does not simply reuse the same edge
+      if (cachePosition < 3)
+	score = lastTriangleScore;
+      else
+	score = std::pow(1.0f - float(cachePosition - 3) / (maxCacheSize - 3), cacheDecayPower);
+    }
+    // favour vertices with few triangles left, so they are finished off
+    return score + valenceBoostScale * std::pow(float(remainingTriangles), -valenceBoostPower);
+  }
+
+  // FIFO cache simulation with timestamps: a vertex is cached while fewer than
+  // cacheSize misses happened since it was loaded
+  struct FifoCache {
+    std::vector<unsigned> loaded;
+    unsigned time;
+    unsigned size;
+
+    FifoCache(size_t numVertices, unsigned cacheSize)
+      : loaded(numVertices, 0), time(cacheSize + 1), size(cacheSize) {}
+
+    void reset() { time += size + 1; }
+
+    unsigned misses(const unsigned int* triangle) {
+      unsigned count = 0;
+      for (int i = 0; i < 3; i++) {
+	unsigned int v = triangle[i];
+	if (time - loaded[v] > size) {
+	  loaded[v] = time++;
+	  count++;
+	}
+      }
+      return count;
+    }
+  };
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices,
+				    size_t numVertices, unsigned cacheSize) {
+  VertexCacheStats stats;
+  const size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0)
+    return stats;
+
+  FifoCache cache(numVertices, cacheSize);
+  std::vector<bool> referenced(numVertices, false);
+  size_t numReferenced = 0;
+  size_t misses = 0;
+  for (size_t t = 0; t < numTriangles; t++)
+    misses += cache.misses(&indices[3 * t]);
+  for (unsigned int v : indices)
+    if (!referenced[v]) {
+      referenced[v] = true;
+      numReferenced++;
+    }
+
+  stats.acmr = float(misses) / float(numTriangles);
+  stats.atvr = float(misses) / float(numReferenced);
+  return stats;
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t numVertices) {
+  const size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0)
+    return;
+
+  // Triangles using each vertex; the first remaining[v] entries of a
+  // vertex's list are the triangles not emitted yet
+  std::vector<unsigned> remaining(numVertices, 0);
+  for (unsigned int v : indices)
+    remaining[v]++;
+  std::vector<size_t> offsets(numVertices + 1, 0);
+  for (size_t v = 0; v < numVertices; v++)
+    offsets[v + 1] = offsets[v] + remaining[v];
+  std::vector<unsigned> adjacency(indices.size());
+  {
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+      adjacency[fill[indices[i]]++] = static_cast<unsigned>(i / 3);
+  }
+
+  std::vector<int> cachePosition(numVertices, -1);
+  std::vector<float> scores(numVertices);
+  for (size_t v = 0; v < numVertices; v++)
+    scores[v] = vertexScore(-1, remaining[v]);
+
+  std::vector<float> triangleScores(numTriangles);
+  std::vector<bool> emitted(numTriangles, false);
+  size_t best = 0;
+  for (size_t t = 0; t < numTriangles; t++) {
+    const unsigned int* tri = &indices[3 * t];
+    triangleScores[t] = scores[tri[0]] + scores[tri[1]] + scores[tri[2]];
+    if (triangleScores[t] > triangleScores[best])
+      best = t;
+  }
+
+  const size_t none = ~size_t(0);
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+  unsigned cache[maxCacheSize + 3];
+  int cacheSize = 0;
+  size_t cursor = 0;
+
+  for (size_t emittedCount = 0; emittedCount < numTriangles; emittedCount++) {
+    // Nothing in the cache has triangles left: continue in input order
+    if (best == none) {
+      while (emitted[cursor])
+	cursor++;
+      best = cursor;
+    }
+
+    const unsigned int tri[3] = {indices[3 * best], indices[3 * best + 1], indices[3 * best + 2]};
+    output.insert(output.end(), tri, tri + 3);
+    emitted[best] = true;
+
+    for (unsigned int v : tri) {
+      unsigned* list = &adjacency[offsets[v]];
+      unsigned* last = list + remaining[v] - 1;
+      *std::find(list, last + 1, static_cast<unsigned>(best)) = *last;
+      remaining[v]--;
+    }
+
+    // The triangle's vertices move to the front of the LRU cache
+    unsigned newCache[maxCacheSize + 3];
+    int newSize = 0;
+    for (unsigned int v : tri)
+      if (std::find(newCache, newCache + newSize, v) == newCache + newSize)
+	newCache[newSize++] = v;
+    for (int i = 0; i < cacheSize; i++)
+      if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+	newCache[newSize++] = cache[i];
+
+    // Rescore the vertices whose position changed, including the evicted
+    // ones, and push the difference into their triangles
+    for (int i = 0; i < newSize; i++) {
+      unsigned int v = newCache[i];
+      cachePosition[v] = i < maxCacheSize ? i : -1;
+      float score = vertexScore(cachePosition[v], remaining[v]);
+      float delta = score - scores[v];
+      scores[v] = score;
+      for (size_t j = offsets[v]; j < offsets[v] + remaining[v]; j++)
+	triangleScores[adjacency[j]] += delta;
+    }
+    cacheSize = std::min(newSize, maxCacheSize);
+    for (int i = 0; i < cacheSize; i++)
+      cache[i] = newCache[i];
+
+    // Next triangle: the best one touching the cache
+    best = none;
+    float bestScore = -1.0f;
+    for (int i = 0; i < cacheSize; i++) {
+      unsigned int v = cache[i];
+      for (size_t j = offsets[v]; j < offsets[v] + remaining[v]; j++)
+	if (triangleScores[adjacency[j]] > bestScore) {
+	  bestScore = triangleScores[adjacency[j]];
+	  best = adjacency[j];
+	}
+    }
+  }
+
+  indices.swap(output);
+}
+
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<float>& positions,
+		      float threshold) {
+  const size_t numTriangles = indices.size() / 3;
+  if (numTriangles == 0)
+    return;
+  const size_t numVertices = positions.size() / 3;
+  FifoCache cache(numVertices, 16);
+
+  // Hard boundaries: triangles where the cache starts over (three misses)
+  std::vector<size_t> hard;
+  for (size_t t = 0; t < numTriangles; t++)
+    if (cache.misses(&indices[3 * t]) == 3)
+      hard.push_back(t);
+  hard.push_back(numTriangles);
+
+  // Soft boundaries: within a hard cluster, split as soon as the running
+  // ACMR is within threshold of the cluster's ACMR
+  std::vector<size_t> clusters;
+  for (size_t c = 0; c + 1 < hard.size(); c++) {
+    const size_t begin = hard[c], end = hard[c + 1];
+    cache.reset();
+    size_t clusterMisses = 0;
+    for (size_t t = begin; t < end; t++)
+      clusterMisses += cache.misses(&indices[3 * t]);
+    const float target = threshold * float(clusterMisses) / float(end - begin);
+
+    cache.reset();
+    clusters.push_back(begin);
+    size_t start = begin, misses = 0;
+    for (size_t t = begin; t < end; t++) {
+      misses += cache.misses(&indices[3 * t]);
+      if (t + 1 < end && float(misses) / float(t + 1 - start) <= target) {
+	clusters.push_back(t + 1);
+	start = t + 1;
+	misses = 0;
+	cache.reset();
+      }
+    }
+  }
+  clusters.push_back(numTriangles);
+
+  auto position = [&](unsigned int v) {
+    return glm::vec3(positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]);
+  };
+  glm::vec3 meshCenter(0.0f);
+  for (unsigned int v : indices)
+    meshCenter += position(v);
+  meshCenter /= float(indices.size());
+
+  // Clusters facing away from the mesh center are likely in front and are
+  // drawn first, so the ones behind them fail the depth test
+  const size_t numClusters = clusters.size() - 1;
+  std::vector<float> keys(numClusters);
+  for (size_t c = 0; c < numClusters; c++) {
+    glm::vec3 center(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+      glm::vec3 a = position(indices[3 * t]);
+      glm::vec3 b = position(indices[3 * t + 1]);
+      glm::vec3 d = position(indices[3 * t + 2]);
+      glm::vec3 n = glm::cross(b - a, d - a);
+      float triangleArea = glm::length(n);
+      center += (a + b + d) * (triangleArea / 3.0f);
+      normal += n;
+      area += triangleArea;
+    }
+    if (area > 0.0f)
+      center /= area;
+    float length = glm::length(normal);
+    keys[c] = length > 0.0f ? glm::dot(center - meshCenter, normal / length) : 0.0f;
+  }
+
+  std::vector<size_t> order(numClusters);
+  for (size_t c = 0; c < numClusters; c++)
+    order[c] = c;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+  for (size_t c : order)
+    output.insert(output.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+  indices.swap(output);
+}
+
+void optimizeVertexFetch(MeshData& mesh) {
+  const size_t numVertices = mesh.vertices.size() / 3;
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(numVertices, unused);
+  unsigned int next = 0;
+  for (unsigned int& v : mesh.indices) {
+    if (remap[v] == unused)
+      remap[v] = next++;
+    v = remap[v];
+  }
+
+  std::vector<float> vertices(3 * next), normals(3 * next), uvs(2 * next);
+  std::vector<float> tangents(mesh.tangents.empty() ? 0 : 4 * next);
+  for (size_t v = 0; v < numVertices; v++) {
+    unsigned int n = remap[v];
+    if (n == unused)
+      continue;
+    std::copy(&mesh.vertices[3 * v], &mesh.vertices[3 * v] + 3, &vertices[3 * n]);
+    std::copy(&mesh.normals[3 * v], &mesh.normals[3 * v] + 3, &normals[3 * n]);
+    std::copy(&mesh.uvs[2 * v], &mesh.uvs[2 * v] + 2, &uvs[2 * n]);
+    if (!tangents.empty())
+      std::copy(&mesh.tangents[4 * v], &mesh.tangents[4 * v] + 4, &tangents[4 * n]);
+  }
+  mesh.vertices.swap(vertices);
+  mesh.normals.swap(normals);
+  mesh.uvs.swap(uvs);
+  mesh.tangents.swap(tangents);
+}
+
+void localizeRange(const unsigned int* indices, size_t count, const std::vector<float>& positions,
+		   std::vector<unsigned int>& localOf, LocalRange& range) {
+  const unsigned int unused = ~0u;
+  range.indices.resize(count);
+  range.vertices.clear();
+  for (size_t i = 0; i < count; i++) {
+    unsigned int& local = localOf[indices[i]];
+    if (local == unused) {
+      local = static_cast<unsigned int>(range.vertices.size());
+      range.vertices.push_back(indices[i]);
+    }
+    range.indices[i] = local;
+  }
+  range.positions.resize(3 * range.vertices.size());
+  for (size_t v = 0; v < range.vertices.size(); v++) {
+    std::copy(&positions[3 * range.vertices[v]], &positions[3 * range.vertices[v]] + 3, &range.positions[3 * v]);
+    localOf[range.vertices[v]] = unused;
+  }
+}
+
+void globalizeIndices(const LocalRange& range, const std::vector<unsigned int>& local, unsigned int* out) {
+  for (size_t i = 0; i < local.size(); i++)
+    out[i] = range.vertices[local[i]];
+}
+
+void optimizeMesh(MeshData& mesh) {
+  auto start = std::chrono::steady_clock::now();
+  VertexCacheStats before = analyzeVertexCache(mesh.indices, mesh.vertices.size() / 3);
+
+  // Submeshes are drawn separately, so triangles must stay inside their range
+  std::vector<unsigned int> localOf(mesh.vertices.size() / 3, ~0u);
+  LocalRange range;
+  for (const Submesh& submesh : mesh.submeshes) {
+    const MeshLod& level = mesh.lods[submesh.firstLod];
+    localizeRange(mesh.indices.data() + level.firstIndex, level.indexCount, mesh.vertices, localOf, range);
+    optimizeVertexCache(range.indices, range.vertices.size());
+    optimizeOverdraw(range.indices, range.positions);
+    globalizeIndices(range, range.indices, mesh.indices.data() + level.firstIndex);
+  }
+  optimizeVertexFetch(mesh);
+
+  VertexCacheStats after = analyzeVertexCache(mesh.indices, mesh.vertices.size() / 3);
+  auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+  std::cout << "Optimized index order in " << time.count() << " ms: ACMR "
+	    << before.acmr << " -> " << after.acmr << ", ATVR "
+	    << before.atvr << " -> " << after.atvr << "\n";
+}
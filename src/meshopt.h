@@ -0,0 +1,50 @@
+#ifndef MESH_OPT_H
+#define MESH_OPT_H
+
+#include "meshdata.h"
+
+#include <vector>
+
+// Efficiency of an index buffer on a simulated FIFO post-transform cache
+struct VertexCacheStats {
+  float acmr = 0.0f;  // transformed vertices per triangle (0.5 .. 3)
+  float atvr = 0.0f;  // transformed vertices per referenced vertex (1 = ideal)
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int>& indices,
+				    size_t numVertices, unsigned cacheSize = 16);
+
+// Reorders triangles for post-transform cache locality (Forsyth's linear
+// speed vertex cache optimization)
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t numVertices);
+
+// Splits a cache optimized index buffer into clusters and sorts them so that
+// outward facing clusters are drawn first (Sander et al., Tipsify). threshold
+// bounds how much the ACMR may degrade for the sake of overdraw.
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<float>& positions,
+		      float threshold = 1.05f);
+
+// Renumbers the vertices of mesh in the order the index buffer first uses
+// them and drops unreferenced ones. Works on the unpacked float arrays.
+void optimizeVertexFetch(MeshData& mesh);
+
+// An index range renumbered to the vertices it uses, in the order of first
+// use, so a pass over one submesh costs its own vertices and not the mesh's
+struct LocalRange {
+  std::vector<unsigned int> indices;   // local vertex numbers
+  std::vector<unsigned int> vertices;  // mesh vertex of each local vertex
+  std::vector<float> positions;        // xyz of each local vertex
+};
+
+// Fills range from count indices of a mesh with the given positions.
+// localOf is scratch with an entry of ~0u per mesh vertex, kept across
+// calls; only the entries of the range are touched and they are reset.
+void localizeRange(const unsigned int* indices, size_t count, const std::vector<float>& positions,
+		   std::vector<unsigned int>& localOf, LocalRange& range);
+// Writes local indices of range back as mesh vertex numbers
+void globalizeIndices(const LocalRange& range, const std::vector<unsigned int>& local, unsigned int* out);
+
+// Runs the three passes above and logs ACMR/ATVR before and after
+void optimizeMesh(MeshData& mesh);
+
+#endif
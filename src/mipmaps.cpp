@@ -0,0 +1,188 @@
+#include "mipmaps.h"
+#include "common/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MIPMAPS_SSE 1
+#endif
+
+namespace {
+  // Taps of the filter from one level to the next: output pixel x reads the
+  // source pixels 2x + first ... 2x + first + count - 1, clamped to the edge
+  struct Kernel {
+    int first;
+    int count;
+    float weights[8];
+  };
+
+  double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 25; k++) {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  Kernel makeKernel(MipFilter filter) {
+    Kernel kernel = {0, 2, {0.5f, 0.5f}};
+    if (filter == MipFilter::Box)
+      return kernel;
+    // Sinc with its cutoff at half the source frequency under a Kaiser
+    // window of radius 4 source pixels. The center of an output pixel lies
+    // between two source pixels, so the taps sit at 0.5, 1.5, ... 3.5.
+    const double alpha = 4.0, radius = 4.0, pi = 3.14159265358979323846;
+    kernel.first = -3;
+    kernel.count = 8;
+    double weights[8], sum = 0.0;
+    for (int k = 0; k < 8; k++) {
+      const double d = k - 3.5;
+      const double sinc = std::sin(pi * d / 2.0) / (pi * d / 2.0);
+      const double r = d / radius;
+      weights[k] = sinc * besselI0(alpha * std::sqrt(1.0 - r * r)) / besselI0(alpha);
+      sum += weights[k];
+    }
+    for (int k = 0; k < 8; k++)
+      kernel.weights[k] = static_cast<float>(weights[k] / sum);
+    return kernel;
+  }
+
+  double srgbToLinear(double value) {
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+  }
+
+  // Conversion of one channel between bytes and the floats it is filtered in
+  struct Transfer {
+    bool srgb;
+    float decode[256];
+    // Linear values halfway between neighbouring codes in sRGB, so encoding
+    // rounds to the nearest code
+    float thresholds[255];
+
+    explicit Transfer(bool srgb) : srgb(srgb) {
+      for (int code = 0; code < 256; code++)
+	decode[code] = static_cast<float>(srgb ? srgbToLinear(code / 255.0) : code / 255.0);
+      for (int code = 0; code < 255; code++)
+	thresholds[code] = static_cast<float>(srgbToLinear((code + 0.5) / 255.0));
+    }
+
+    unsigned char encode(float value) const {
+      if (!srgb)
+	return static_cast<unsigned char>(std::min(std::max(value * 255.0f + 0.5f, 0.0f), 255.0f));
+      return static_cast<unsigned char>(std::upper_bound(thresholds, thresholds + 255, value) - thresholds);
+    }
+  };
+
+  // acc += weight * row over count floats
+  void accumulateRow(float* acc, const float* row, float weight, size_t count) {
+    size_t i = 0;
+#ifdef MIPMAPS_SSE
+    const __m128 w = _mm_set1_ps(weight);
+    for (; i + 4 <= count; i += 4)
+      _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(w, _mm_loadu_ps(row + i))));
+#endif
+    for (; i < count; i++)
+      acc[i] += weight * row[i];
+  }
+
+  // Filters one level into the next: each output row is the weighted sum
+  // of source rows, then every output pixel the weighted sum of pixels of
+  // that row
+  void filterLevel(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int width,
+		   int height, int channels, const Kernel& kernel, const Transfer* const transfers[4],
+		   unsigned numThreads) {
+    const size_t rowFloats = size_t(srcWidth) * channels;
+    parallelFor(height, numThreads, [&](size_t begin, size_t end, unsigned) {
+      // Converted source rows by row modulo 8; the rows of one output row
+      // are consecutive, so they never share a slot
+      std::vector<float> ring(8 * rowFloats);
+      int ringRows[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+      auto sourceRow = [&](int y) -> const float* {
+	y = std::min(std::max(y, 0), srcHeight - 1);
+	float* row = &ring[(y & 7) * rowFloats];
+	if (ringRows[y & 7] != y) {
+	  ringRows[y & 7] = y;
+	  const unsigned char* in = src + size_t(y) * rowFloats;
+	  for (size_t i = 0; i < rowFloats; i += channels)
+	    for (int c = 0; c < channels; c++)
+	      row[i + c] = transfers[c]->decode[in[i + c]];
+	}
+	return row;
+      };
+
+      std::vector<float> column(rowFloats);
+      for (size_t y = begin; y < end; y++) {
+	std::fill(column.begin(), column.end(), 0.0f);
+	for (int k = 0; k < kernel.count; k++)
+	  accumulateRow(column.data(), sourceRow(2 * int(y) + kernel.first + k), kernel.weights[k], rowFloats);
+
+	unsigned char* out = dst + y * size_t(width) * channels;
+	for (int x = 0; x < width; x++) {
+	  alignas(16) float sum[4] = {};
+#ifdef MIPMAPS_SSE
+	  if (channels == 4) {
+	    __m128 total = _mm_setzero_ps();
+	    for (int k = 0; k < kernel.count; k++) {
+	      const int sx = std::min(std::max(2 * x + kernel.first + k, 0), srcWidth - 1);
+	      total = _mm_add_ps(total, _mm_mul_ps(_mm_set1_ps(kernel.weights[k]), _mm_loadu_ps(&column[sx * 4])));
+	    }
+	    _mm_store_ps(sum, total);
+	  } else
+#endif
+	  {
+	    for (int k = 0; k < kernel.count; k++) {
+	      const int sx = std::min(std::max(2 * x + kernel.first + k, 0), srcWidth - 1);
+	      for (int c = 0; c < channels; c++)
+		sum[c] += kernel.weights[k] * column[size_t(sx) * channels + c];
+	    }
+	  }
+	  for (int c = 0; c < channels; c++)
+	    out[x * channels + c] = transfers[c]->encode(sum[c]);
+	}
+      }
+    });
+  }
+}
+
+void generateMipmaps(const TextureData& image, MipFilter filter, bool srgb, TextureData& mipmapped,
+		     unsigned numThreads) {
+  const int channels = isBlockCompressed(image.format) ? 0 : static_cast<int>(textureRowSize(image.format, 1));
+  if (channels == 0 || image.levels.empty())
+    throw std::runtime_error(std::string("Cannot build mipmaps of a ") + textureFormatName(image.format) +
+			     " texture");
+  mipmapped.format = image.format;
+  mipmapped.width = image.width;
+  mipmapped.height = image.height;
+  mipmapped.levels.clear();
+  size_t size = 0;
+  for (int w = image.width, h = image.height;; w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+    mipmapped.levels.push_back({w, h, size, textureLevelSize(image.format, w, h)});
+    size += mipmapped.levels.back().size;
+    if (w == 1 && h == 1)
+      break;
+  }
+  mipmapped.storage.resize(size);
+  mipmapped.data = mipmapped.storage.data();
+  std::memcpy(mipmapped.storage.data(), image.data + image.levels[0].offset, mipmapped.levels[0].size);
+
+  // Alpha, the last channel of grey-alpha and RGBA, is never sRGB
+  static const Transfer linear(false), encoded(true);
+  const Transfer* transfers[4];
+  for (int c = 0; c < channels; c++)
+    transfers[c] = srgb && !(c == channels - 1 && channels % 2 == 0) ? &encoded : &linear;
+  const Kernel kernel = makeKernel(filter);
+  for (size_t i = 1; i < mipmapped.levels.size(); i++) {
+    const TextureLevel& above = mipmapped.levels[i - 1];
+    const TextureLevel& level = mipmapped.levels[i];
+    filterLevel(mipmapped.storage.data() + above.offset, above.width, above.height,
+		mipmapped.storage.data() + level.offset, level.width, level.height, channels, kernel, transfers,
+		numThreads);
+  }
+}
@@ -0,0 +1,15 @@
+#ifndef MIPMAPS_H
+#define MIPMAPS_H
+
+#include "textureloader.h"
+
+// Builds every mip level of the uncompressed level 0 of image, down to 1x1,
+// into mipmapped. Each level is filtered from the one above it: the source
+// rows are converted to floats, in linear light for the sRGB color channels
+// with srgb, filtered vertically and then horizontally, and converted back
+// with rounding to the nearest 8-bit value. The output rows of a level are
+// split across numThreads threads.
+void generateMipmaps(const TextureData& image, MipFilter filter, bool srgb, TextureData& mipmapped,
+		     unsigned numThreads = 0);
+
+#endif
@@ -0,0 +1,280 @@
+#include "normals.h"
+#include "common/parallel.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define NORMALS_SSE 1
+#endif
+
+namespace {
+  // Per triangle: cross product of two edges (length = twice the area), the
+  // unit normal, and the cosine of the angle at each corner
+  struct FaceData {
+    std::vector<float> cross;   // xyz per triangle
+    std::vector<float> unit;    // xyz per triangle
+    std::vector<float> angles;  // one per corner
+  };
+
+  void faceScalar(const float* positions, const int* tri, float* cross, float* unit, float* cosines) {
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++)
+      p[k] = glm::vec3(positions[3 * tri[k]], positions[3 * tri[k] + 1], positions[3 * tri[k] + 2]);
+    glm::vec3 e0 = p[1] - p[0], e1 = p[2] - p[0], e2 = p[2] - p[1];
+    glm::vec3 n = glm::cross(e0, e1);
+    float l0 = glm::length(e0), l1 = glm::length(e1), l2 = glm::length(e2), ln = glm::length(n);
+    e0 = e0 * (l0 > 0.0f ? 1.0f / l0 : 0.0f);
+    e1 = e1 * (l1 > 0.0f ? 1.0f / l1 : 0.0f);
+    e2 = e2 * (l2 > 0.0f ? 1.0f / l2 : 0.0f);
+    glm::vec3 u = n * (ln > 0.0f ? 1.0f / ln : 0.0f);
+    for (int k = 0; k < 3; k++) {
+      cross[k] = n[k];
+      unit[k] = u[k];
+    }
+    cosines[0] = glm::dot(e0, e1);
+    cosines[1] = -glm::dot(e0, e2);
+    cosines[2] = glm::dot(e1, e2);
+  }
+
+#ifdef NORMALS_SSE
+  // Reciprocal of the length, 0 for zero vectors
+  inline __m128 safeInverseLength(__m128 x, __m128 y, __m128 z) {
+    __m128 squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    __m128 nonzero = _mm_cmpgt_ps(squared, _mm_setzero_ps());
+    return _mm_and_ps(nonzero, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(squared)));
+  }
+
+  // Four triangles at once: the corners are gathered into SoA registers
+  void faceSSE(const float* positions, const int* tri, float* cross, float* unit, float* cosines) {
+    alignas(16) float c[3][3][4];  // corner, axis, lane
+    for (int lane = 0; lane < 4; lane++)
+      for (int k = 0; k < 3; k++)
+	for (int axis = 0; axis < 3; axis++)
+	  c[k][axis][lane] = positions[3 * tri[3 * lane + k] + axis];
+
+    __m128 p0[3], p1[3], p2[3];
+    for (int axis = 0; axis < 3; axis++) {
+      p0[axis] = _mm_load_ps(c[0][axis]);
+      p1[axis] = _mm_load_ps(c[1][axis]);
+      p2[axis] = _mm_load_ps(c[2][axis]);
+    }
+    __m128 e0[3], e1[3], e2[3];
+    for (int axis = 0; axis < 3; axis++) {
+      e0[axis] = _mm_sub_ps(p1[axis], p0[axis]);
+      e1[axis] = _mm_sub_ps(p2[axis], p0[axis]);
+      e2[axis] = _mm_sub_ps(p2[axis], p1[axis]);
+    }
+    __m128 n[3] = {
+      _mm_sub_ps(_mm_mul_ps(e0[1], e1[2]), _mm_mul_ps(e0[2], e1[1])),
+      _mm_sub_ps(_mm_mul_ps(e0[2], e1[0]), _mm_mul_ps(e0[0], e1[2])),
+      _mm_sub_ps(_mm_mul_ps(e0[0], e1[1]), _mm_mul_ps(e0[1], e1[0])),
+    };
+    __m128 in = safeInverseLength(n[0], n[1], n[2]);
+    __m128 i0 = safeInverseLength(e0[0], e0[1], e0[2]);
+    __m128 i1 = safeInverseLength(e1[0], e1[1], e1[2]);
+    __m128 i2 = safeInverseLength(e2[0], e2[1], e2[2]);
+    __m128 d01 = _mm_setzero_ps(), d02 = _mm_setzero_ps(), d12 = _mm_setzero_ps();
+    for (int axis = 0; axis < 3; axis++) {
+      d01 = _mm_add_ps(d01, _mm_mul_ps(e0[axis], e1[axis]));
+      d02 = _mm_add_ps(d02, _mm_mul_ps(e0[axis], e2[axis]));
+      d12 = _mm_add_ps(d12, _mm_mul_ps(e1[axis], e2[axis]));
+    }
+    d01 = _mm_mul_ps(d01, _mm_mul_ps(i0, i1));
+    d02 = _mm_mul_ps(d02, _mm_mul_ps(i0, i2));
+    d12 = _mm_mul_ps(d12, _mm_mul_ps(i1, i2));
+
+    alignas(16) float out[9][4];
+    for (int axis = 0; axis < 3; axis++) {
+      _mm_store_ps(out[axis], n[axis]);
+      _mm_store_ps(out[3 + axis], _mm_mul_ps(n[axis], in));
+    }
+    _mm_store_ps(out[6], d01);
+    _mm_store_ps(out[7], _mm_sub_ps(_mm_setzero_ps(), d02));
+    _mm_store_ps(out[8], d12);
+    for (int lane = 0; lane < 4; lane++)
+      for (int k = 0; k < 3; k++) {
+	cross[3 * lane + k] = out[k][lane];
+	unit[3 * lane + k] = out[3 + k][lane];
+	cosines[3 * lane + k] = out[6 + k][lane];
+      }
+  }
+#endif
+
+  void computeFaces(const float* positions, const int* triangles, size_t begin, size_t end,
+		    FaceData& faces) {
+    size_t t = begin;
+#ifdef NORMALS_SSE
+    for (; t + 4 <= end; t += 4)
+      faceSSE(positions, &triangles[3 * t], &faces.cross[3 * t], &faces.unit[3 * t], &faces.angles[3 * t]);
+#endif
+    for (; t < end; t++)
+      faceScalar(positions, &triangles[3 * t], &faces.cross[3 * t], &faces.unit[3 * t], &faces.angles[3 * t]);
+    for (size_t c = 3 * begin; c < 3 * end; c++)
+      faces.angles[c] = std::acos(std::min(std::max(faces.angles[c], -1.0f), 1.0f));
+  }
+}
+
+size_t generateNormals(tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+		       float creaseAngle, unsigned numThreads) {
+  std::vector<tinyobj::index_t*> corners;
+  size_t missing = 0;
+  for (auto& shape : shapes)
+    for (auto& idx : shape.mesh.indices) {
+      corners.push_back(&idx);
+      missing += idx.normal_index < 0;
+    }
+  if (missing == 0)
+    return 0;
+
+  if (numThreads == 0)
+    numThreads = defaultThreadCount();
+  const size_t numTriangles = corners.size() / 3;
+  const size_t numPositions = attrib.vertices.size() / 3;
+  std::vector<int> triangles(corners.size());
+  for (size_t c = 0; c < corners.size(); c++)
+    triangles[c] = corners[c]->vertex_index;
+
+  FaceData faces;
+  faces.cross.resize(3 * numTriangles);
+  faces.unit.resize(3 * numTriangles);
+  faces.angles.resize(3 * numTriangles);
+  parallelFor(numTriangles, numThreads, [&](size_t begin, size_t end, unsigned) {
+    computeFaces(attrib.vertices.data(), triangles.data(), begin, end, faces);
+  });
+
+  // Corners around every position
+  std::vector<size_t> offsets(numPositions + 1, 0);
+  for (int v : triangles)
+    offsets[v + 1]++;
+  for (size_t p = 0; p < numPositions; p++)
+    offsets[p + 1] += offsets[p];
+  std::vector<uint32_t> around(corners.size());
+  {
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t c = 0; c < corners.size(); c++)
+      around[fill[triangles[c]]++] = static_cast<uint32_t>(c);
+  }
+
+  // Every position gathers from its own faces, so the threads never write to
+  // shared sums and the result does not depend on the thread count. The
+  // faces around a position are grouped into clusters once: a face joins
+  // the first cluster whose mean direction is within the crease angle of
+  // its own, or starts a new one. Corners then take the normal of their
+  // face's cluster, which costs valence times clusters per position rather
+  // than valence squared on the fans of CAD models.
+  struct Cluster {
+    glm::vec3 direction;  // sum of the unit normals, to compare faces against
+    glm::vec3 normal;     // sum of the weighted normals
+    glm::vec3 fallback;   // unit normal of the first face, for sums that cancel out
+    uint32_t id;          // local id of its normal, ~0u while no corner needs it
+  };
+  const bool smooth = creaseAngle >= 180.0f;
+  const float creaseCosine = std::cos(glm::radians(std::min(creaseAngle, 180.0f)));
+  const uint32_t noCluster = ~0u;
+  std::vector<glm::vec3> cornerNormals(corners.size());
+  std::vector<uint32_t> localIds(corners.size());
+  std::vector<size_t> counts(numPositions + 1, 0);
+  parallelFor(numPositions, numThreads, [&](size_t begin, size_t end, unsigned) {
+    std::vector<Cluster> clusters;
+    std::vector<uint32_t> clusterOf;
+    for (size_t p = begin; p < end; p++) {
+      const size_t first = offsets[p], valence = offsets[p + 1] - first;
+      bool needed = false;
+      for (size_t j = 0; j < valence && !needed; j++)
+	needed = corners[around[first + j]]->normal_index < 0;
+      if (!needed)
+	continue;
+
+      // Degenerate faces have no direction of their own and take every face
+      clusters.clear();
+      clusterOf.assign(valence, noCluster);
+      Cluster all = {glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f), ~0u};
+      for (size_t j = 0; j < valence; j++) {
+	const uint32_t d = around[first + j];
+	const size_t g = d / 3;
+	const glm::vec3 unit(faces.unit[3 * g], faces.unit[3 * g + 1], faces.unit[3 * g + 2]);
+	const glm::vec3 weighted =
+	  glm::vec3(faces.cross[3 * g], faces.cross[3 * g + 1], faces.cross[3 * g + 2]) * faces.angles[d];
+	all.normal += weighted;
+	if (unit.x == 0.0f && unit.y == 0.0f && unit.z == 0.0f)
+	  continue;
+	size_t k = 0;
+	if (!smooth)
+	  while (k < clusters.size() &&
+		 glm::dot(unit, clusters[k].direction) < creaseCosine * glm::length(clusters[k].direction))
+	    k++;
+	if (k == clusters.size())
+	  clusters.push_back({glm::vec3(0.0f), glm::vec3(0.0f), unit, ~0u});
+	clusters[k].direction += unit;
+	clusters[k].normal += weighted;
+	clusterOf[j] = static_cast<uint32_t>(k);
+      }
+
+      // Clusters get their normal and local id when a corner needs them
+      uint32_t used = 0;
+      for (size_t j = 0; j < valence; j++) {
+	const uint32_t c = around[first + j];
+	if (corners[c]->normal_index >= 0)
+	  continue;
+	Cluster& cluster = clusterOf[j] == noCluster ? all : clusters[clusterOf[j]];
+	if (cluster.id == ~0u) {
+	  cluster.id = used++;
+	  const float length = glm::length(cluster.normal);
+	  cluster.normal = length > 0.0f ? cluster.normal * (1.0f / length) : cluster.fallback;
+	}
+	cornerNormals[c] = cluster.normal;
+	localIds[c] = cluster.id;
+      }
+      counts[p + 1] = used;
+    }
+  });
+
+  for (size_t p = 0; p < numPositions; p++)
+    counts[p + 1] += counts[p];
+  const size_t firstNormal = attrib.normals.size() / 3;
+  attrib.normals.resize(3 * (firstNormal + counts[numPositions]));
+  parallelFor(numPositions, numThreads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t p = begin; p < end; p++)
+      for (size_t i = offsets[p]; i < offsets[p + 1]; i++) {
+	uint32_t c = around[i];
+	if (corners[c]->normal_index >= 0)
+	  continue;
+	const size_t id = firstNormal + counts[p] + localIds[c];
+	attrib.normals[3 * id] = cornerNormals[c].x;
+	attrib.normals[3 * id + 1] = cornerNormals[c].y;
+	attrib.normals[3 * id + 2] = cornerNormals[c].z;
+	corners[c]->normal_index = static_cast<int>(id);
+      }
+  });
+  return missing;
+}
+
+void fillVertexNormals(const std::vector<float>& positions, const std::vector<unsigned int>& indices,
+		       const std::vector<char>& missing, std::vector<float>& normals) {
+  std::vector<float> sums(normals.size(), 0.0f);
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const unsigned int* t = &indices[i];
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++)
+      p[k] = glm::vec3(positions[3 * t[k]], positions[3 * t[k] + 1], positions[3 * t[k] + 2]);
+    glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+    for (int k = 0; k < 3; k++)
+      if (missing[t[k]])
+	for (int axis = 0; axis < 3; axis++)
+	  sums[3 * t[k] + axis] += n[axis];
+  }
+  for (size_t v = 0; v < missing.size(); v++) {
+    if (!missing[v])
+      continue;
+    glm::vec3 n(sums[3 * v], sums[3 * v + 1], sums[3 * v + 2]);
+    float length = glm::length(n);
+    n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+    for (int axis = 0; axis < 3; axis++)
+      normals[3 * v + axis] = n[axis];
+  }
+}
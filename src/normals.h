@@ -0,0 +1,26 @@
+#ifndef NORMALS_H
+#define NORMALS_H
+
+#include "common/tiny_obj_loader.h"
+
+#include <vector>
+
+// Fills in normals for the face corners that have none (normal_index < 0).
+// The faces around every position are clustered: a face joins the first
+// cluster whose mean normal is within creaseAngle degrees of its own, else
+// it starts a new one, so hard edges stay hard (180 or more smooths
+// everything). A corner gets the sum of the normals of its face's cluster,
+// weighted by face area and by the face's angle at that position, and the
+// corners of one cluster share one entry appended to attrib.normals. The
+// faces must be triangles. Returns the number of corners that got a normal.
+size_t generateNormals(tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+		       float creaseAngle, unsigned numThreads = 0);
+
+// Sets the normal of every vertex flagged in missing to the area weighted
+// sum of the normals of its triangles, (0, 0, 1) when they cancel out. The
+// vertices are already indexed, so there are no creases. positions and
+// normals hold xyz per vertex.
+void fillVertexNormals(const std::vector<float>& positions, const std::vector<unsigned int>& indices,
+		       const std::vector<char>& missing, std::vector<float>& normals);
+
+#endif
@@ -0,0 +1,192 @@
+#include "numparse.h"
+#include "common/mappedfile.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+const char* parseDoubleSlow(const char* p, const char* end, double& out) {
+  const char* tokenEnd = p;
+  while (tokenEnd < end && *tokenEnd != ' ' && *tokenEnd != '\t' && *tokenEnd != '\r' &&
+	 *tokenEnd != '\n')
+    tokenEnd++;
+  std::string token(p, tokenEnd);
+  char* next;
+  double value = std::strtod(token.c_str(), &next);
+  if (next == token.c_str())
+    return p;
+  out = value;
+  return p + (next - token.c_str());
+}
+
+namespace {
+  struct Mismatch {
+    std::string token;
+    double expected, actual;
+    long expectedLength, actualLength;
+  };
+
+  // Same bits, or both nan, and the same number of characters consumed
+  bool checkToken(const std::string& token, std::vector<Mismatch>& mismatches) {
+    char* next;
+    double expected = std::strtod(token.c_str(), &next);
+    long expectedLength = static_cast<long>(next - token.c_str());
+    if (expectedLength == 0)
+      expected = 0.0;
+
+    double actual = 0.0;
+    const char* begin = token.data();
+    long actualLength = static_cast<long>(parseDouble(begin, begin + token.size(), actual) - begin);
+
+    bool same = expectedLength == actualLength &&
+      (std::memcmp(&expected, &actual, sizeof(double)) == 0 ||
+       (std::isnan(expected) && std::isnan(actual)));
+    if (!same)
+      mismatches.push_back({token, expected, actual, expectedLength, actualLength});
+    return same;
+  }
+
+  bool checkInteger(const std::string& token, std::vector<Mismatch>& mismatches) {
+    int expected = std::atoi(token.c_str());
+    int actual;
+    // Padding so the SIMD scan also runs on short tokens
+    std::string padded = token + "/               ";
+    parseInteger(padded.data(), padded.data() + padded.size(), actual);
+    if (expected != actual)
+      mismatches.push_back({token, double(expected), double(actual), 0, 0});
+    return expected == actual;
+  }
+
+  // Tokens of the v, vn, vt and f lines of an .obj file
+  size_t checkFile(const std::string& path, std::vector<Mismatch>& mismatches) {
+    MappedFile file;
+    if (!file.open(path)) {
+      std::cerr << "Cannot open " << path << "\n";
+      return 0;
+    }
+    size_t count = 0;
+    const char* p = file.data();
+    const char* end = p + file.size();
+    while (p < end) {
+      const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (!lineEnd)
+	lineEnd = end;
+      const char* q = p;
+      while (q < lineEnd && *q != ' ' && *q != '\t')
+	q++;
+      std::string keyword(p, q);
+      bool reals = keyword == "v" || keyword == "vn" || keyword == "vt";
+      if (reals || keyword == "f") {
+	while (q < lineEnd) {
+	  while (q < lineEnd && (*q == ' ' || *q == '\t' || *q == '\r'))
+	    q++;
+	  const char* tokenBegin = q;
+	  while (q < lineEnd && *q != ' ' && *q != '\t' && *q != '\r')
+	    q++;
+	  if (q == tokenBegin)
+	    break;
+	  if (reals) {
+	    checkToken(std::string(tokenBegin, q), mismatches);
+	    count++;
+	    continue;
+	  }
+	  // i/j/k corners: every component on its own
+	  for (const char* c = tokenBegin; c < q;) {
+	    const char* slash = c;
+	    while (slash < q && *slash != '/')
+	      slash++;
+	    if (slash > c) {
+	      checkInteger(std::string(c, slash), mismatches);
+	      count++;
+	    }
+	    c = slash + 1;
+	  }
+	}
+      }
+      p = lineEnd + 1;
+    }
+    return count;
+  }
+
+  // Random decimals in the formats exporters write, long digit strings and
+  // exponents that leave the fast path, and the special cases of strtod
+  size_t checkGenerated(std::vector<Mismatch>& mismatches) {
+    static const char* special[] = {
+      "0", "-0", "+0", "0.0", ".5", "5.", "-.5e+2", "1e", "1e+", "1.5e-",
+      "1e308", "1.7976931348623157e308", "1e309", "4.9e-324", "2.4e-324", "1e-400",
+      "9007199254740993", "9007199254740992.5", "123456789012345678901234567890",
+      "0.000000000000000000000000000001", "1e22", "1e23", "8.98846567431158e307",
+      "inf", "-Infinity", "nan", "0x1p3", "-0x1.8p1", "1.5.3", "--1", "+", "-", ".", "e5"};
+    size_t count = 0;
+    for (const char* token : special) {
+      checkToken(token, mismatches);
+      count++;
+    }
+
+    std::mt19937_64 random(1234);
+    char buffer[512];
+    for (int i = 0; i < 300000; i++) {
+      double magnitude = std::ldexp(1.0, static_cast<int>(random() % 200) - 100);
+      double value = (static_cast<double>(random() >> 11) / 9007199254740992.0 - 0.5) * magnitude;
+      int precision = static_cast<int>(random() % 18);
+      switch (random() % 3) {
+      case 0:
+	std::snprintf(buffer, sizeof(buffer), "%.*g", precision + 1, value);
+	break;
+      case 1:
+	std::snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+	break;
+      default:
+	std::snprintf(buffer, sizeof(buffer), "%.*e", precision, value);
+	break;
+      }
+      checkToken(buffer, mismatches);
+      count++;
+    }
+
+    for (int i = 0; i < 100000; i++) {
+      std::string token;
+      if (random() % 2)
+	token += random() % 2 ? '-' : '+';
+      int intDigits = static_cast<int>(random() % 25);
+      int fracDigits = static_cast<int>(random() % 25);
+      for (int d = 0; d < intDigits; d++)
+	token += static_cast<char>('0' + random() % 10);
+      if (random() % 4)
+	token += '.';
+      for (int d = 0; d < fracDigits; d++)
+	token += static_cast<char>('0' + random() % 10);
+      if (random() % 3 == 0) {
+	token += random() % 2 ? 'e' : 'E';
+	if (random() % 2)
+	  token += random() % 2 ? '-' : '+';
+	token += std::to_string(random() % 400);
+      }
+      checkToken(token, mismatches);
+      count++;
+
+      std::string integer = std::to_string(static_cast<int>(random() % 2000000000) - 1000000000);
+      checkInteger(integer, mismatches);
+      count++;
+    }
+    return count;
+  }
+}
+
+size_t verifyNumberParsing(const std::string& path) {
+  std::vector<Mismatch> mismatches;
+  size_t fromFile = checkFile(path, mismatches);
+  size_t generated = checkGenerated(mismatches);
+  for (size_t i = 0; i < mismatches.size() && i < 10; i++) {
+    const Mismatch& m = mismatches[i];
+    std::fprintf(stderr, "Mismatch on \"%s\": strtod %.17g (%ld chars), parser %.17g (%ld chars)\n",
+		 m.token.c_str(), m.expected, m.expectedLength, m.actual, m.actualLength);
+  }
+  std::cout << "Checked " << fromFile << " numbers from " << path << " and " << generated
+	    << " generated ones: " << mismatches.size() << " mismatches\n";
+  return mismatches.size();
+}
@@ -0,0 +1,140 @@
+#ifndef NUMPARSE_H
+#define NUMPARSE_H
+
+#include <cstdint>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define NUMPARSE_SSE2 1
+#endif
+
+// Number parsing for OBJ tokens. Both functions only read [p, end), so they
+// work on memory mapped text that is not null terminated.
+
+// strtod on a null terminated copy of the token starting at p
+const char* parseDoubleSlow(const char* p, const char* end, double& out);
+
+// Parses a number the way strtod does and returns the end of it, or p when
+// there is none. Plain decimals whose digits fit into 53 bits and whose
+// exponent is at most 22 are exact after one multiplication or division
+// (Clinger's fast path), which covers practically every OBJ coordinate;
+// everything else goes through parseDoubleSlow.
+inline const char* parseDouble(const char* p, const char* end, double& out) {
+  static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+				  1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+				  1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char* start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  uint64_t mantissa = 0;
+  int digits = 0;    // significant digits in mantissa
+  int exponent = 0;
+  bool any = false;  // at least one digit
+  while (p < end && *p >= '0' && *p <= '9') {
+    if (digits > 0 || *p != '0') {
+      if (digits == 19)
+	return parseDoubleSlow(start, end, out);
+      mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+      digits++;
+    }
+    any = true;
+    p++;
+  }
+  if (p < end && *p == '.') {
+    p++;
+    while (p < end && *p >= '0' && *p <= '9') {
+      if (digits > 0 || *p != '0') {
+	if (digits == 19)
+	  return parseDoubleSlow(start, end, out);
+	mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+	digits++;
+      }
+      exponent--;
+      any = true;
+      p++;
+    }
+  }
+  if (!any)
+    return parseDoubleSlow(start, end, out);
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negativeExponent = false;
+    if (q < end && (*q == '-' || *q == '+'))
+      negativeExponent = *q++ == '-';
+    if (q < end && *q >= '0' && *q <= '9') {
+      int value = 0;
+      while (q < end && *q >= '0' && *q <= '9') {
+	if (value < 100000)
+	  value = value * 10 + (*q - '0');
+	q++;
+      }
+      exponent += negativeExponent ? -value : value;
+      p = q;
+    }
+  }
+  // Hex floats, inf and nan are left to strtod
+  if (p < end && ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z'))
+    return parseDoubleSlow(start, end, out);
+
+  double value;
+  if (mantissa == 0)
+    value = 0.0;
+  else if (mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+    value = exponent < 0 ? double(mantissa) / powers[-exponent] : double(mantissa) * powers[exponent];
+  else
+    return parseDoubleSlow(start, end, out);
+  out = negative ? -value : value;
+  return p;
+}
+
+// Same semantics as atoi: optional sign followed by digits, 0 when there are
+// none. The end of the digit run is found sixteen bytes at a time.
+inline const char* parseInteger(const char* p, const char* end, int& out) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  const char* digitsEnd = p;
+#ifdef NUMPARSE_SSE2
+  if (end - p >= 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i value = _mm_sub_epi8(bytes, _mm_set1_epi8('0'));
+    // digits are the bytes whose distance from '0' is at most 9 unsigned
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(value, _mm_set1_epi8(9)), value);
+    // A sentinel bit above the lanes stops the count at 16
+    unsigned nonDigits = ~static_cast<unsigned>(_mm_movemask_epi8(isDigit)) | 0x10000u;
+#ifdef _MSC_VER
+    unsigned long count;
+    _BitScanForward(&count, nonDigits);
+#else
+    unsigned count = static_cast<unsigned>(__builtin_ctz(nonDigits));
+#endif
+    digitsEnd = p + count;
+    if (count == 16)
+      while (digitsEnd < end && *digitsEnd >= '0' && *digitsEnd <= '9')
+	digitsEnd++;
+  } else
+#endif
+  {
+    while (digitsEnd < end && *digitsEnd >= '0' && *digitsEnd <= '9')
+      digitsEnd++;
+  }
+  uint32_t value = 0;
+  for (; p < digitsEnd; p++)
+    value = value * 10 + static_cast<uint32_t>(*p - '0');
+  out = negative ? -static_cast<int>(value) : static_cast<int>(value);
+  return p;
+}
+
+// Compares parseDouble against strtod on every number in the file at path
+// and on generated inputs, printing the first mismatches. Returns the number
+// of mismatches.
+size_t verifyNumberParsing(const std::string& path);
+
+#endif
@@ -0,0 +1,1272 @@
+#include "objparser.h"
+#include "common/mappedfile.h"
+#include "common/parallel.h"
+#include "decompress.h"
+#include "numparse.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+
+namespace {
+  using tinyobj::real_t;
+
+  // Marks corner indices that were relative (negative) in the file and still
+  // need the attribute count of all previous chunks added.
+  enum RelativeFlags : uint8_t { RelativeVertex = 1, RelativeTexcoord = 2, RelativeNormal = 4 };
+
+  // Anything in a chunk that changes parser state for the faces after it
+  // and anything tinyobj keeps a shape for even without triangles: l/p
+  // lines and faces with fewer than three corners
+  struct ChunkEvent {
+    enum Type { Group, Object, UseMtl, Smoothing, MtlLib, Lines, EmptyFace } type;
+    size_t face;          // faces of the chunk parsed before the event
+    size_t vertex;        // v lines of the chunk parsed before the event
+    size_t triangle = 0;  // triangles of the chunk emitted before the event, counted after merging
+    std::string name;
+    unsigned smoothing = 0;
+    int materialId = -1;  // resolved while merging
+    bool flush = false;   // tinyobj triangulates the faces before it here, set while merging
+  };
+
+  struct Chunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<real_t> vertices;
+    std::vector<real_t> weights;
+    std::vector<real_t> colors;
+    std::vector<real_t> normals;
+    std::vector<real_t> texcoords;
+
+    std::vector<tinyobj::index_t> corners;
+    std::vector<uint8_t> relative;
+    std::vector<unsigned int> faceSizes;
+    std::vector<ChunkEvent> events;
+    size_t numTriangles = 0;  // known once the chunk is triangulated
+    size_t numLines = 0;
+    int greatestVertex = -1, greatestNormal = -1, greatestTexcoord = -1;
+
+    std::string warn;
+    std::string err;
+    size_t errLine = 0;
+  };
+
+  // The triangles between two g/o statements
+  struct ShapeRange {
+    std::string name;
+    size_t triBegin, triEnd;
+  };
+
+  // Positions tinyobj can see when it triangulates a face: it does so when
+  // the face's group ends at a g, an o, a usemtl changing the material or
+  // the end of the file, with the v lines read up to there. The faces
+  // before faces[k] and after faces[k - 1] see vertices[k] positions.
+  struct VertexLimits {
+    std::vector<size_t> faces;
+    std::vector<size_t> vertices;
+  };
+
+  inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+  inline const char* skipSpace(const char* p, const char* end) {
+    while (p < end && isSpace(*p))
+      p++;
+    return p;
+  }
+
+  // Advances past the current component of an i/j/k triple
+  inline const char* skipIndex(const char* p, const char* end) {
+    while (p < end && *p != '/' && !isSpace(*p))
+      p++;
+    return p;
+  }
+
+  // Returns false when the line has no further number
+  bool parseReal(const char*& p, const char* end, real_t& out) {
+    p = skipSpace(p, end);
+    if (p >= end || *p == '#')
+      return false;
+#ifdef OBJ_FAST_NUMBERS
+    double value;
+    const char* next = parseDouble(p, end, value);
+#else
+    char* next;
+    double value = std::strtod(p, &next);
+#endif
+    if (next == p)
+      return false;
+    p = next;
+    out = static_cast<real_t>(value);
+    return true;
+  }
+
+  real_t parseRealOr(const char*& p, const char* end, real_t fallback) {
+    real_t value;
+    return parseReal(p, end, value) ? value : fallback;
+  }
+
+  // Same semantics as atoi: optional sign followed by digits, 0 when absent
+  int parseInt(const char*& p, const char* end) {
+    p = skipSpace(p, end);
+#ifdef OBJ_FAST_NUMBERS
+    int value;
+    p = parseInteger(p, end, value);
+    return value;
+#else
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+      negative = *p++ == '-';
+    int value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+      value = value * 10 + (*p++ - '0');
+    return negative ? -value : value;
+#endif
+  }
+
+  std::string parseName(const char*& p, const char* end) {
+    p = skipSpace(p, end);
+    const char* begin = p;
+    while (p < end && !isSpace(*p))
+      p++;
+    return std::string(begin, p);
+  }
+
+  // Positive OBJ indices are 1-based, negative ones count back from the
+  // attributes seen so far. Relative results are chunk-local until merged.
+  bool resolveIndex(int index, size_t count, bool allowZero, int& out, bool& relative) {
+    relative = index < 0;
+    if (index > 0)
+      out = index - 1;
+    else if (index == 0)
+      out = -1;
+    else
+      out = static_cast<int>(count) + index;
+    return index != 0 || allowZero;
+  }
+
+  bool parseCorner(Chunk& c, const char*& p, const char* end) {
+    tinyobj::index_t idx = {-1, -1, -1};
+    uint8_t flags = 0;
+    bool relative;
+
+    if (!resolveIndex(parseInt(p, end), c.vertices.size() / 3, false, idx.vertex_index, relative))
+      return false;
+    flags |= relative ? RelativeVertex : 0;
+    p = skipIndex(p, end);
+
+    if (p < end && *p == '/') {
+      p++;
+      if (p < end && *p == '/') {
+	// i//k
+	p++;
+	resolveIndex(parseInt(p, end), c.normals.size() / 3, true, idx.normal_index, relative);
+	flags |= relative ? RelativeNormal : 0;
+	p = skipIndex(p, end);
+      } else {
+	// i/j or i/j/k
+	resolveIndex(parseInt(p, end), c.texcoords.size() / 2, true, idx.texcoord_index, relative);
+	flags |= relative ? RelativeTexcoord : 0;
+	p = skipIndex(p, end);
+	if (p < end && *p == '/') {
+	  p++;
+	  resolveIndex(parseInt(p, end), c.normals.size() / 3, true, idx.normal_index, relative);
+	  flags |= relative ? RelativeNormal : 0;
+	  p = skipIndex(p, end);
+	}
+      }
+    }
+
+    c.corners.push_back(idx);
+    c.relative.push_back(flags);
+    return true;
+  }
+
+  void addEvent(Chunk& c, ChunkEvent::Type type, std::string name, unsigned smoothing = 0) {
+    ChunkEvent event;
+    event.type = type;
+    event.face = c.faceSizes.size();
+    event.vertex = c.vertices.size() / 3;
+    event.name = std::move(name);
+    event.smoothing = smoothing;
+    c.events.push_back(std::move(event));
+  }
+
+  // Returns false on a fatal error, which is stored in the chunk
+  bool parseLine(Chunk& c, const char* p, const char* end) {
+    if (p >= end || *p == '#')
+      return true;
+    const bool second = p + 1 < end;
+
+    // vertex with optional weight or color
+    if (p[0] == 'v' && second && isSpace(p[1])) {
+      p += 2;
+      real_t x = parseRealOr(p, end, 0.0f);
+      real_t y = parseRealOr(p, end, 0.0f);
+      real_t z = parseRealOr(p, end, 0.0f);
+      real_t r = 1.0f, g = 1.0f, b = 1.0f;
+      if (parseReal(p, end, r)) {
+	if (parseReal(p, end, g)) {
+	  if (!parseReal(p, end, b))
+	    r = g = b = 1.0f;
+	} else {
+	  g = b = 1.0f;
+	}
+      }
+      c.vertices.insert(c.vertices.end(), {x, y, z});
+      c.weights.push_back(r);
+      c.colors.insert(c.colors.end(), {r, g, b});
+      return true;
+    }
+
+    // normal
+    if (p[0] == 'v' && second && p[1] == 'n' && p + 2 < end && isSpace(p[2])) {
+      p += 3;
+      real_t x = parseRealOr(p, end, 0.0f);
+      real_t y = parseRealOr(p, end, 0.0f);
+      real_t z = parseRealOr(p, end, 0.0f);
+      c.normals.insert(c.normals.end(), {x, y, z});
+      return true;
+    }
+
+    // texcoord
+    if (p[0] == 'v' && second && p[1] == 't' && p + 2 < end && isSpace(p[2])) {
+      p += 3;
+      real_t x = parseRealOr(p, end, 0.0f);
+      real_t y = parseRealOr(p, end, 0.0f);
+      c.texcoords.insert(c.texcoords.end(), {x, y});
+      return true;
+    }
+
+    // face
+    if (p[0] == 'f' && second && isSpace(p[1])) {
+      p = skipSpace(p + 2, end);
+      size_t first = c.corners.size();
+      while (p < end && *p != '#') {
+	if (!parseCorner(c, p, end)) {
+	  c.err = "Failed to parse `f' line (e.g. a zero value for vertex index "
+	    "or invalid relative vertex index). Line ";
+	  c.errLine = c.numLines;
+	  return false;
+	}
+	p = skipSpace(p, end);
+      }
+
+      size_t numCorners = c.corners.size() - first;
+      if (numCorners < 3) {
+	c.warn += "Degenerated face found\n.";
+	c.corners.resize(first);
+	c.relative.resize(first);
+	addEvent(c, ChunkEvent::EmptyFace, "");
+	return true;
+      }
+      c.faceSizes.push_back(static_cast<unsigned int>(numCorners));
+      return true;
+    }
+
+    // line or points: not loaded, but their indices are checked and an
+    // object with nothing else still becomes a shape, like in tinyobj
+    if ((p[0] == 'l' || p[0] == 'p') && second && isSpace(p[1])) {
+      const char type = p[0];
+      p = skipSpace(p + 2, end);
+      size_t first = c.corners.size();
+      bool ok = true;
+      while (ok && p < end && *p != '#') {
+	ok = parseCorner(c, p, end);
+	p = skipSpace(p, end);
+      }
+      c.corners.resize(first);
+      c.relative.resize(first);
+      if (!ok) {
+	c.err = std::string("Failed to parse `") + type + "' line (e.g. a zero value for vertex index. Line ";
+	c.errLine = c.numLines;
+	return false;
+      }
+      addEvent(c, ChunkEvent::Lines, "");
+      return true;
+    }
+
+    if (end - p >= 6 && std::strncmp(p, "usemtl", 6) == 0) {
+      p += 6;
+      addEvent(c, ChunkEvent::UseMtl, parseName(p, end));
+      return true;
+    }
+
+    if (end - p >= 7 && std::strncmp(p, "mtllib", 6) == 0 && isSpace(p[6])) {
+      addEvent(c, ChunkEvent::MtlLib, std::string(p + 7, end));
+      return true;
+    }
+
+    // group name, multiple names are joined with a space like tinyobj does.
+    // A bare g without a space after it is not a group statement for tinyobj.
+    if (p[0] == 'g' && second && isSpace(p[1])) {
+      p += 1;
+      std::string name;
+      while ((p = skipSpace(p, end)) < end && *p != '#') {
+	if (!name.empty())
+	  name += ' ';
+	name += parseName(p, end);
+      }
+      if (name.empty())
+	c.warn += "Empty group name.\n";
+      addEvent(c, ChunkEvent::Group, name);
+      return true;
+    }
+
+    // object name
+    if (p[0] == 'o' && second && isSpace(p[1])) {
+      addEvent(c, ChunkEvent::Object, std::string(p + 2, end));
+      return true;
+    }
+
+    // smoothing group
+    if (p[0] == 's' && second && isSpace(p[1])) {
+      p = skipSpace(p + 2, end);
+      if (p >= end)
+	return true;
+      int id = 0;
+      if (end - p < 3 || std::strncmp(p, "off", 3) != 0)
+	id = parseInt(p, end);
+      addEvent(c, ChunkEvent::Smoothing, "", id < 0 ? 0u : static_cast<unsigned>(id));
+      return true;
+    }
+
+    return true;
+  }
+
+  void parseChunk(Chunk& c) {
+    const char* p = c.begin;
+    while (p < c.end) {
+      const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', c.end - p));
+      if (!lineEnd)
+	lineEnd = c.end;
+      const char* end = lineEnd;
+      if (end > p && end[-1] == '\r')
+	end--;
+      c.numLines++;
+      if (!parseLine(c, skipSpace(p, end), end))
+	return;
+      p = lineEnd + 1;
+    }
+  }
+
+  void loadMaterialLibraries(const std::string& line, tinyobj::MaterialReader& reader,
+			     std::set<std::string>& loaded,
+			     std::map<std::string, int>& materialMap,
+			     std::vector<tinyobj::material_t>& materials,
+			     std::string& warn, std::string& err) {
+    std::vector<std::string> filenames;
+    std::istringstream stream(line);
+    for (std::string name; stream >> name;)
+      filenames.push_back(name);
+    if (filenames.empty()) {
+      warn += "Looks like empty filename for mtllib. Use default material.\n";
+      return;
+    }
+
+    for (const auto& filename : filenames) {
+      if (loaded.count(filename))
+	return;
+      std::string warnMtl, errMtl;
+      bool ok = reader(filename, &materials, &materialMap, &warnMtl, &errMtl);
+      warn += warnMtl;
+      err += errMtl;
+      if (ok) {
+	loaded.insert(filename);
+	return;
+      }
+    }
+    warn += "Failed to load material file(s). Use default material.\n";
+  }
+
+  // Adds the attribute counts of all previous chunks to relative indices.
+  // Returns false when one reaches before the first attribute.
+  bool resolveChunk(Chunk& c, size_t vertexBase, size_t normalBase, size_t texcoordBase) {
+    for (size_t i = 0; i < c.corners.size(); i++) {
+      tinyobj::index_t& idx = c.corners[i];
+      const uint8_t flags = c.relative[i];
+      if (flags & RelativeVertex)
+	idx.vertex_index += static_cast<int>(vertexBase);
+      if (flags & RelativeNormal)
+	idx.normal_index += static_cast<int>(normalBase);
+      if (flags & RelativeTexcoord)
+	idx.texcoord_index += static_cast<int>(texcoordBase);
+      if (((flags & RelativeVertex) && idx.vertex_index < 0) ||
+	  ((flags & RelativeNormal) && idx.normal_index < 0) ||
+	  ((flags & RelativeTexcoord) && idx.texcoord_index < 0)) {
+	c.err = "Failed to parse `f' line (invalid relative vertex index).\n";
+	return false;
+      }
+      c.greatestVertex = std::max(c.greatestVertex, idx.vertex_index);
+      c.greatestNormal = std::max(c.greatestNormal, idx.normal_index);
+      c.greatestTexcoord = std::max(c.greatestTexcoord, idx.texcoord_index);
+    }
+    return true;
+  }
+
+  // The point in polygon test tinyobj's ear clipping uses, on a triangle
+  bool pointInTriangle(const real_t* x, const real_t* y, real_t testX, real_t testY) {
+    bool inside = false;
+    for (int i = 0, j = 2; i < 3; j = i++)
+      if ((y[i] > testY) != (y[j] > testY) &&
+	  testX < (x[j] - x[i]) * (testY - y[i]) / (y[j] - y[i]) + x[i])
+	inside = !inside;
+    return inside;
+  }
+
+  // Splits a face into triangles the way tinyobj::LoadObj does, with the
+  // same arithmetic so that both give the same triangles. Indices from
+  // numVertices on have no position: tinyobj drops a quad with one, and a
+  // larger polygon clips such corners as if they were at the origin.
+  // Returns false when the face was dropped.
+  template <typename Emit>
+  bool triangulateFace(const tinyobj::index_t* idx, unsigned int n, const real_t* v, size_t numVertices,
+		       std::vector<tinyobj::index_t>& remaining, Emit&& emit) {
+    auto valid = [numVertices](const tinyobj::index_t& i) {
+      return static_cast<size_t>(i.vertex_index) < numVertices;
+    };
+    if (n == 3) {
+      emit(idx[0], idx[1], idx[2]);
+      return true;
+    }
+
+    if (n == 4) {
+      if (!valid(idx[0]) || !valid(idx[1]) || !valid(idx[2]) || !valid(idx[3]))
+	return false;
+      // split along the shorter diagonal
+      auto distance2 = [v](int a, int b) {
+	real_t dx = v[3 * b + 0] - v[3 * a + 0];
+	real_t dy = v[3 * b + 1] - v[3 * a + 1];
+	real_t dz = v[3 * b + 2] - v[3 * a + 2];
+	return dx * dx + dy * dy + dz * dz;
+      };
+      if (distance2(idx[0].vertex_index, idx[2].vertex_index) <
+	  distance2(idx[1].vertex_index, idx[3].vertex_index)) {
+	emit(idx[0], idx[1], idx[2]);
+	emit(idx[0], idx[2], idx[3]);
+      } else {
+	emit(idx[0], idx[1], idx[3]);
+	emit(idx[1], idx[2], idx[3]);
+      }
+      return true;
+    }
+
+    // Ear clipping in the plane of the two axes that the first corner
+    // which is not flat spans the most
+    size_t axes[2] = {1, 2};
+    for (unsigned int k = 0; k < n; k++) {
+      const tinyobj::index_t& i0 = idx[k];
+      const tinyobj::index_t& i1 = idx[(k + 1) % n];
+      const tinyobj::index_t& i2 = idx[(k + 2) % n];
+      if (!valid(i0) || !valid(i1) || !valid(i2))
+	continue;
+      const real_t* v0 = &v[3 * i0.vertex_index];
+      const real_t* v1 = &v[3 * i1.vertex_index];
+      const real_t* v2 = &v[3 * i2.vertex_index];
+      real_t e0x = v1[0] - v0[0], e0y = v1[1] - v0[1], e0z = v1[2] - v0[2];
+      real_t e1x = v2[0] - v1[0], e1y = v2[1] - v1[1], e1z = v2[2] - v1[2];
+      real_t cx = std::fabs(e0y * e1z - e0z * e1y);
+      real_t cy = std::fabs(e0z * e1x - e0x * e1z);
+      real_t cz = std::fabs(e0x * e1y - e0y * e1x);
+      const real_t epsilon = std::numeric_limits<real_t>::epsilon();
+      if (cx > epsilon || cy > epsilon || cz > epsilon) {
+	if (!(cx > cy && cx > cz)) {
+	  axes[0] = 0;
+	  if (cz > cx && cz > cy)
+	    axes[1] = 1;
+	}
+	break;
+      }
+    }
+
+    // Cuts off the triangle at guess + 1 when it is convex and holds no other
+    // corner, else moves on. A polygon that has no ear left after a full
+    // round loses its remaining corners, as in tinyobj.
+    remaining.assign(idx, idx + n);
+    size_t guess = 0;
+    size_t iterations = n, previousCount = n;
+    while (remaining.size() > 3 && iterations > 0) {
+      const size_t count = remaining.size();
+      if (guess >= count)
+	guess -= count;
+      if (previousCount != count) {
+	previousCount = count;
+	iterations = count;
+      } else {
+	iterations--;
+      }
+
+      tinyobj::index_t ind[3];
+      real_t x[3], y[3];
+      for (size_t k = 0; k < 3; k++) {
+	ind[k] = remaining[(guess + k) % count];
+	x[k] = valid(ind[k]) ? v[3 * ind[k].vertex_index + axes[0]] : real_t(0);
+	y[k] = valid(ind[k]) ? v[3 * ind[k].vertex_index + axes[1]] : real_t(0);
+      }
+      real_t e0x = x[1] - x[0], e0y = y[1] - y[0];
+      real_t e1x = x[2] - x[1], e1y = y[2] - y[1];
+      real_t cross = e0x * e1y - e0y * e1x;
+      real_t area = (x[0] * y[1] - y[0] * x[1]) * real_t(0.5);
+      if (cross * area < real_t(0)) {
+	guess++;
+	continue;
+      }
+
+      bool overlap = false;
+      for (size_t other = 3; other < count && !overlap; other++) {
+	const tinyobj::index_t& o = remaining[(guess + other) % count];
+	if (valid(o))
+	  overlap = pointInTriangle(x, y, v[3 * o.vertex_index + axes[0]], v[3 * o.vertex_index + axes[1]]);
+      }
+      if (overlap) {
+	guess++;
+	continue;
+      }
+
+      emit(ind[0], ind[1], ind[2]);
+      remaining.erase(remaining.begin() + (guess + 1) % count);
+    }
+    if (remaining.size() == 3)
+      emit(remaining[0], remaining[1], remaining[2]);
+    return true;
+  }
+
+  // Passes every triangle of a resolved chunk to emit(face, a, b, c,
+  // material, smoothing) in file order, where face is the index of the face
+  // within the chunk and faceBase that of its first face in the file.
+  // Returns the number of faces that were dropped.
+  template <typename Emit>
+  size_t triangulateChunk(const Chunk& c, size_t faceBase, int material, unsigned smoothing,
+			  const real_t* vertices, const VertexLimits& limits, Emit&& emit) {
+    size_t limit = std::upper_bound(limits.faces.begin(), limits.faces.end(), faceBase) - limits.faces.begin();
+    std::vector<tinyobj::index_t> remaining;
+    size_t dropped = 0;
+    size_t event = 0;
+    size_t corner = 0;
+    for (size_t f = 0; f < c.faceSizes.size(); f++) {
+      for (; event < c.events.size() && c.events[event].face <= f; event++) {
+	if (c.events[event].type == ChunkEvent::UseMtl)
+	  material = c.events[event].materialId;
+	else if (c.events[event].type == ChunkEvent::Smoothing)
+	  smoothing = c.events[event].smoothing;
+      }
+      while (limits.faces[limit] <= faceBase + f)
+	limit++;
+
+      const unsigned int n = c.faceSizes[f];
+      if (!triangulateFace(&c.corners[corner], n, vertices, limits.vertices[limit], remaining,
+			   [&](const tinyobj::index_t& a, const tinyobj::index_t& b, const tinyobj::index_t& d) {
+			     emit(f, a, b, d, material, smoothing);
+			   }))
+	dropped++;
+      corner += n;
+    }
+    return dropped;
+  }
+
+  // Splits [data, dataEnd) into numChunks pieces that end on a newline
+  void splitChunks(const char* data, const char* dataEnd, size_t numChunks,
+		   std::vector<Chunk>& chunks) {
+    const size_t size = static_cast<size_t>(dataEnd - data);
+    chunks.assign(numChunks, Chunk());
+    const char* begin = data;
+    for (size_t i = 0; i < numChunks; i++) {
+      const char* end = i + 1 == numChunks ? dataEnd : data + size * (i + 1) / numChunks;
+      if (end < begin)
+	end = begin;
+      while (end > data && end < dataEnd && end[-1] != '\n')
+	end++;
+      chunks[i].begin = begin;
+      chunks[i].end = end;
+      begin = end;
+    }
+  }
+
+  // Hands out the text of an .obj in windows of complete lines. Plain files
+  // are mapped; files that cannot be mapped (e.g. empty ones) are read into
+  // memory instead. .gz and .zst files are inflated on a background thread
+  // while the caller parses the previous window. The number parser needs a
+  // terminator after the last token, which the mapping does not guarantee,
+  // so an unterminated last line comes as a NUL terminated copy of its own.
+  class TextWindows {
+  public:
+    bool open(const std::string& path, size_t windowSize) {
+      m_windowSize = std::max<size_t>(windowSize, 1);
+      if (isCompressed(path)) {
+	// Windows of compressed text are parsed as they arrive, so they stay
+	// small enough for the inflating to run ahead
+	const size_t compressedWindowSize = size_t(16) << 20;
+	m_windowSize = std::min(m_windowSize, compressedWindowSize);
+	m_reader.reset(new DecompressingReader(path));
+	return true;
+      }
+
+      size_t size;
+      if (m_mapped.open(path)) {
+	m_mapped.adviseSequential();
+	m_data = m_mapped.data();
+	size = m_mapped.size();
+      } else {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	  return false;
+	m_fallback.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(&m_fallback[0], static_cast<std::streamsize>(m_fallback.size()));
+	m_data = m_fallback.c_str();
+	size = m_fallback.size();
+      }
+      m_dataEnd = m_data + size;
+      while (m_dataEnd > m_data && m_dataEnd[-1] != '\n')
+	m_dataEnd--;
+      m_lastLine.assign(m_dataEnd, m_data + size);
+      return true;
+    }
+
+    // [begin, end) of the next window, valid until the next call. Returns
+    // false after the last one.
+    bool next(const char*& begin, const char*& end) {
+      if (m_reader)
+	return nextInflated(begin, end);
+      if (m_data < m_dataEnd) {
+	const char* windowEnd = m_data + std::min<size_t>(m_windowSize, m_dataEnd - m_data);
+	while (windowEnd < m_dataEnd && windowEnd[-1] != '\n')
+	  windowEnd++;
+	begin = m_data;
+	end = windowEnd;
+	m_data = windowEnd;
+	return true;
+      }
+      if (m_lastLineDone || m_lastLine.empty())
+	return false;
+      m_lastLineDone = true;
+      begin = m_lastLine.c_str();
+      end = begin + m_lastLine.size();
+      return true;
+    }
+
+  private:
+    // The partial line at the end of a window moves to the next one
+    bool nextInflated(const char*& begin, const char*& end) {
+      m_window.swap(m_carry);
+      m_carry.clear();
+      bool more = true;
+      while (more && (m_window.size() < m_windowSize || m_window.find('\n') == std::string::npos)) {
+	more = m_reader->read(m_block);
+	if (more)
+	  m_window += m_block;
+      }
+      if (more) {
+	const size_t cut = m_window.rfind('\n') + 1;
+	m_carry.assign(m_window, cut, std::string::npos);
+	m_window.resize(cut);
+      }
+      if (m_window.empty())
+	return false;
+      begin = m_window.c_str();
+      end = begin + m_window.size();
+      return true;
+    }
+
+    size_t m_windowSize = 0;
+    MappedFile m_mapped;
+    std::string m_fallback;
+    const char* m_data = nullptr;
+    const char* m_dataEnd = nullptr;
+    std::string m_lastLine;
+    bool m_lastLineDone = false;
+
+    std::unique_ptr<DecompressingReader> m_reader;
+    std::string m_window, m_carry, m_block;
+  };
+
+  // Differences found by verifyObjParser, the first ones are printed
+  struct ParserDifferences {
+    size_t count = 0;
+
+    void add(const std::string& what) {
+      if (count++ < 10)
+	std::fprintf(stderr, "Mismatch: %s\n", what.c_str());
+    }
+  };
+
+  void compareReals(const std::string& name, const std::vector<real_t>& expected,
+		    const std::vector<real_t>& actual, ParserDifferences& differences) {
+    if (expected.size() != actual.size()) {
+      differences.add(name + " has " + std::to_string(actual.size()) + " values, tinyobj " +
+		      std::to_string(expected.size()));
+      return;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+      const real_t a = expected[i], b = actual[i];
+      if (a != b && !(std::fabs(a - b) <= 1e-6f * std::max(std::fabs(a), std::fabs(b))))
+	differences.add(name + "[" + std::to_string(i) + "] is " + std::to_string(b) + ", tinyobj " +
+			std::to_string(a));
+    }
+  }
+
+  template <typename T, typename Same>
+  void compareArrays(const std::string& name, const std::vector<T>& expected, const std::vector<T>& actual,
+		     Same&& same, ParserDifferences& differences) {
+    if (expected.size() != actual.size()) {
+      differences.add(name + " has " + std::to_string(actual.size()) + " entries, tinyobj " +
+		      std::to_string(expected.size()));
+      return;
+    }
+    for (size_t i = 0; i < expected.size(); i++)
+      if (!same(expected[i], actual[i]))
+	differences.add(name + " differs at " + std::to_string(i));
+  }
+}
+
+bool parseObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+		      std::vector<tinyobj::material_t>* materials, std::string* warn,
+		      std::string* err, const std::string& path,
+		      const std::string& mtlBaseDir, unsigned numThreads,
+		      tinyobj::MaterialReader* readMatFn) {
+  if (numThreads == 0)
+    numThreads = defaultThreadCount();
+
+  // Tokenize straight from the mapped pages. A plain file is one window;
+  // compressed ones come in windows that are parsed while the next one is
+  // inflated.
+  TextWindows text;
+  std::vector<Chunk> chunks;
+  try {
+    if (!text.open(path, std::numeric_limits<size_t>::max())) {
+      if (err)
+	*err = "Cannot open file [" + path + "]\n";
+      return false;
+    }
+
+    // Cut the text into chunks at newline boundaries. A few chunks per
+    // thread keep the load balanced when the statements are unevenly
+    // distributed.
+    const size_t minChunkSize = 1 << 20;
+    const char* data;
+    const char* dataEnd;
+    std::vector<Chunk> window;
+    while (text.next(data, dataEnd)) {
+      const size_t size = static_cast<size_t>(dataEnd - data);
+      splitChunks(data, dataEnd, std::min<size_t>(numThreads * 4, size / minChunkSize + 1), window);
+      parallelFor(window.size(), numThreads, [&](size_t first, size_t last, unsigned) {
+	for (size_t i = first; i < last; i++)
+	  parseChunk(window[i]);
+      });
+      std::move(window.begin(), window.end(), std::back_inserter(chunks));
+    }
+  } catch (const std::exception& e) {
+    if (err)
+      *err = std::string(e.what()) + "\n";
+    return false;
+  }
+  const size_t numChunks = chunks.size();
+
+  std::string warnings, errors;
+  size_t lineBase = 0;
+  for (const auto& c : chunks) {
+    warnings += c.warn;
+    if (!c.err.empty()) {
+      if (err)
+	*err = c.err + std::to_string(lineBase + c.errLine) + ").\n";
+      if (warn)
+	*warn = warnings;
+      return false;
+    }
+    lineBase += c.numLines;
+  }
+
+  // Prefix sums over the chunk sizes
+  std::vector<size_t> vertexBase(numChunks + 1, 0), normalBase(numChunks + 1, 0);
+  std::vector<size_t> texcoordBase(numChunks + 1, 0), faceBase(numChunks + 1, 0);
+  for (size_t i = 0; i < numChunks; i++) {
+    vertexBase[i + 1] = vertexBase[i] + chunks[i].vertices.size() / 3;
+    normalBase[i + 1] = normalBase[i] + chunks[i].normals.size() / 3;
+    texcoordBase[i + 1] = texcoordBase[i] + chunks[i].texcoords.size() / 2;
+    faceBase[i + 1] = faceBase[i] + chunks[i].faceSizes.size();
+  }
+
+  // Walk the state changes in file order: load material libraries, resolve
+  // material names, find where tinyobj would triangulate and the state at
+  // chunk starts.
+  std::map<std::string, int> materialMap;
+  std::set<std::string> loadedLibraries;
+  tinyobj::MaterialFileReader fileReader(mtlBaseDir);
+  tinyobj::MaterialReader& reader = readMatFn ? *readMatFn : fileReader;
+  materials->clear();
+
+  VertexLimits limits;
+  std::vector<int> startMaterial(numChunks);
+  std::vector<unsigned> startSmoothing(numChunks);
+  int material = -1;
+  unsigned smoothing = 0;
+  for (size_t i = 0; i < numChunks; i++) {
+    startMaterial[i] = material;
+    startSmoothing[i] = smoothing;
+    for (auto& e : chunks[i].events) {
+      switch (e.type) {
+      case ChunkEvent::Group:
+      case ChunkEvent::Object:
+	e.flush = true;
+	break;
+      case ChunkEvent::UseMtl: {
+	auto it = materialMap.find(e.name);
+	if (it == materialMap.end())
+	  warnings += "material [ '" + e.name + "' ] not found in .mtl\n";
+	e.materialId = it == materialMap.end() ? -1 : it->second;
+	e.flush = e.materialId != material;
+	material = e.materialId;
+	break;
+      }
+      case ChunkEvent::Smoothing:
+	smoothing = e.smoothing;
+	break;
+      case ChunkEvent::MtlLib:
+	loadMaterialLibraries(e.name, reader, loadedLibraries, materialMap,
+			      *materials, warnings, errors);
+	break;
+      case ChunkEvent::Lines:
+      case ChunkEvent::EmptyFace:
+	break;
+      }
+      if (e.flush) {
+	limits.faces.push_back(faceBase[i] + e.face);
+	limits.vertices.push_back(vertexBase[i] + e.vertex);
+      }
+    }
+  }
+  limits.faces.push_back(faceBase[numChunks]);
+  limits.vertices.push_back(vertexBase[numChunks]);
+
+  // Concatenate the attribute arrays
+  attrib->vertices.resize(3 * vertexBase[numChunks]);
+  attrib->vertex_weights.resize(vertexBase[numChunks]);
+  attrib->colors.resize(3 * vertexBase[numChunks]);
+  attrib->normals.resize(3 * normalBase[numChunks]);
+  attrib->texcoords.resize(2 * texcoordBase[numChunks]);
+  attrib->texcoord_ws.clear();
+  attrib->skin_weights.clear();
+  parallelFor(numChunks, numThreads, [&](size_t first, size_t last, unsigned) {
+    for (size_t i = first; i < last; i++) {
+      const Chunk& c = chunks[i];
+      std::copy(c.vertices.begin(), c.vertices.end(), attrib->vertices.begin() + 3 * vertexBase[i]);
+      std::copy(c.weights.begin(), c.weights.end(), attrib->vertex_weights.begin() + vertexBase[i]);
+      std::copy(c.colors.begin(), c.colors.end(), attrib->colors.begin() + 3 * vertexBase[i]);
+      std::copy(c.normals.begin(), c.normals.end(), attrib->normals.begin() + 3 * normalBase[i]);
+      std::copy(c.texcoords.begin(), c.texcoords.end(), attrib->texcoords.begin() + 2 * texcoordBase[i]);
+    }
+  });
+
+  // Counting pass: resolve the relative indices and count the triangles of
+  // every chunk and before each of its events. Polygons of five or more
+  // corners are clipped twice, once here and once when writing.
+  parallelFor(numChunks, numThreads, [&](size_t first, size_t last, unsigned) {
+    for (size_t i = first; i < last; i++) {
+      Chunk& c = chunks[i];
+      if (!resolveChunk(c, vertexBase[i], normalBase[i], texcoordBase[i]))
+	continue;
+      size_t event = 0;
+      c.numTriangles = 0;
+      size_t dropped = triangulateChunk(c, faceBase[i], startMaterial[i], startSmoothing[i],
+					attrib->vertices.data(), limits,
+					[&](size_t f, const tinyobj::index_t&, const tinyobj::index_t&,
+					    const tinyobj::index_t&, int, unsigned) {
+					  for (; event < c.events.size() && c.events[event].face <= f; event++)
+					    c.events[event].triangle = c.numTriangles;
+					  c.numTriangles++;
+					});
+      for (; event < c.events.size(); event++)
+	c.events[event].triangle = c.numTriangles;
+      c.warn = dropped > 0 ? "Face with invalid vertex index found.\n" : "";
+    }
+  });
+  int greatestVertex = -1, greatestNormal = -1, greatestTexcoord = -1;
+  for (const auto& c : chunks) {
+    if (!c.err.empty()) {
+      if (err)
+	*err = errors + c.err;
+      if (warn)
+	*warn = warnings;
+      return false;
+    }
+    warnings += c.warn;
+    greatestVertex = std::max(greatestVertex, c.greatestVertex);
+    greatestNormal = std::max(greatestNormal, c.greatestNormal);
+    greatestTexcoord = std::max(greatestTexcoord, c.greatestTexcoord);
+  }
+  // Indices past the end are kept, as tinyobj does
+  if (greatestVertex >= static_cast<int>(vertexBase[numChunks]))
+    warnings += "Vertex indices out of bounds.\n";
+  if (greatestNormal >= static_cast<int>(normalBase[numChunks]))
+    warnings += "Vertex normal indices out of bounds.\n";
+  if (greatestTexcoord >= static_cast<int>(texcoordBase[numChunks]))
+    warnings += "Vertex texcoord indices out of bounds.\n";
+
+  std::vector<size_t> triBase(numChunks + 1, 0);
+  for (size_t i = 0; i < numChunks; i++)
+    triBase[i + 1] = triBase[i] + chunks[i].numTriangles;
+
+  // Find the shapes by tinyobj's rules: a g ends a shape that has
+  // triangles, an o also one with only lines or points, and the end of
+  // the file one with any statement since it was last triangulated
+  std::vector<ShapeRange> ranges;
+  std::string name;
+  size_t shapeTri = 0, flushFace = 0;
+  bool shapeLines = false, emptyFaces = false;
+  for (size_t i = 0; i < numChunks; i++) {
+    for (const auto& e : chunks[i].events) {
+      const size_t tri = triBase[i] + e.triangle;
+      if (e.type == ChunkEvent::Group || e.type == ChunkEvent::Object) {
+	if (tri > shapeTri || (e.type == ChunkEvent::Object && shapeLines))
+	  ranges.push_back({name, shapeTri, tri});
+	shapeTri = tri;
+	shapeLines = false;
+	// tinyobj only clears the name of an empty g when it reports it
+	if (!e.name.empty() || e.type == ChunkEvent::Object || warn)
+	  name = e.name;
+      } else if (e.type == ChunkEvent::Lines) {
+	shapeLines = true;
+      } else if (e.type == ChunkEvent::EmptyFace) {
+	emptyFaces = true;
+      }
+      if (e.flush) {
+	flushFace = faceBase[i] + e.face;
+	emptyFaces = false;
+      }
+    }
+  }
+  if (triBase[numChunks] > shapeTri || shapeLines || emptyFaces || faceBase[numChunks] > flushFace)
+    ranges.push_back({name, shapeTri, triBase[numChunks]});
+
+  shapes->assign(ranges.size(), tinyobj::shape_t());
+  for (size_t s = 0; s < ranges.size(); s++) {
+    const size_t numTriangles = ranges[s].triEnd - ranges[s].triBegin;
+    tinyobj::mesh_t& mesh = (*shapes)[s].mesh;
+    (*shapes)[s].name = ranges[s].name;
+    mesh.indices.resize(3 * numTriangles);
+    mesh.num_face_vertices.assign(numTriangles, 3);
+    mesh.material_ids.resize(numTriangles);
+    mesh.smoothing_group_ids.resize(numTriangles);
+  }
+
+  parallelFor(numChunks, numThreads, [&](size_t first, size_t last, unsigned) {
+    for (size_t i = first; i < last; i++) {
+      // first shape that ends after this chunk's first triangle
+      size_t tri = triBase[i];
+      size_t shape = std::upper_bound(ranges.begin(), ranges.end(), tri,
+				      [](size_t t, const ShapeRange& r) { return t < r.triEnd; })
+	- ranges.begin();
+
+      triangulateChunk(chunks[i], faceBase[i], startMaterial[i], startSmoothing[i],
+		       attrib->vertices.data(), limits,
+		       [&](size_t, const tinyobj::index_t& a, const tinyobj::index_t& b,
+			   const tinyobj::index_t& c, int material, unsigned smoothing) {
+			 while (ranges[shape].triEnd <= tri)
+			   shape++;
+			 tinyobj::mesh_t& mesh = (*shapes)[shape].mesh;
+			 const size_t out = tri++ - ranges[shape].triBegin;
+			 mesh.indices[3 * out + 0] = a;
+			 mesh.indices[3 * out + 1] = b;
+			 mesh.indices[3 * out + 2] = c;
+			 mesh.material_ids[out] = material;
+			 mesh.smoothing_group_ids[out] = smoothing;
+		       });
+    }
+  });
+
+  // errors from the material libraries are reported but not fatal
+  if (warn)
+    *warn = warnings;
+  if (err)
+    *err = errors;
+  return true;
+}
+
+ObjStats scanObj(const std::string& path, unsigned numThreads) {
+  TextWindows text;
+  if (!text.open(path, std::numeric_limits<size_t>::max()))
+    return ObjStats();
+
+  // Counts the corners of every face line without parsing them
+  auto scanRange = [](const char* p, const char* end) {
+    ObjStats stats;
+    while (p < end) {
+      const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (!lineEnd)
+	lineEnd = end;
+      p = skipSpace(p, lineEnd);
+      if (p + 1 < lineEnd && p[0] == 'f' && isSpace(p[1])) {
+	size_t numCorners = 0;
+	p += 2;
+	while ((p = skipSpace(p, lineEnd)) < lineEnd && *p != '#' && *p != '\r') {
+	  numCorners++;
+	  while (p < lineEnd && !isSpace(*p) && *p != '\r')
+	    p++;
+	}
+	if (numCorners >= 3)
+	  stats.numTriangles += numCorners - 2;
+      } else if (p + 1 < lineEnd && p[0] == 'v' && isSpace(p[1])) {
+	stats.numVertices++;
+      } else if (p + 2 < lineEnd && p[0] == 'v' && isSpace(p[2])) {
+	stats.numNormals += p[1] == 'n';
+	stats.numTexcoords += p[1] == 't';
+      }
+      p = lineEnd + 1;
+    }
+    return stats;
+  };
+
+  if (numThreads == 0)
+    numThreads = defaultThreadCount();
+  ObjStats stats;
+  std::vector<Chunk> chunks;
+  std::vector<ObjStats> counts;
+  const char* data;
+  const char* dataEnd;
+  while (text.next(data, dataEnd)) {
+    splitChunks(data, dataEnd, numThreads, chunks);
+    counts.assign(chunks.size(), ObjStats());
+    parallelFor(chunks.size(), numThreads, [&](size_t first, size_t last, unsigned) {
+      for (size_t i = first; i < last; i++)
+	counts[i] = scanRange(chunks[i].begin, chunks[i].end);
+    });
+    for (const ObjStats& count : counts) {
+      stats.numTriangles += count.numTriangles;
+      stats.numVertices += count.numVertices;
+      stats.numNormals += count.numNormals;
+      stats.numTexcoords += count.numTexcoords;
+    }
+  }
+  stats.hasNormals = stats.numNormals > 0;
+  stats.hasTexcoords = stats.numTexcoords > 0;
+  return stats;
+}
+
+bool streamObj(const ObjStats& stats, std::vector<tinyobj::material_t>* materials,
+	       std::string* warn, std::string* err, const std::string& path,
+	       const std::string& mtlBaseDir, size_t windowSize, unsigned numThreads,
+	       const ObjTriangleSink& sink) {
+  if (numThreads == 0)
+    numThreads = defaultThreadCount();
+
+  TextWindows text;
+  try {
+    if (!text.open(path, windowSize)) {
+      if (err)
+	*err = "Cannot open file [" + path + "]\n";
+      return false;
+    }
+  } catch (const std::exception& e) {
+    if (err)
+      *err = std::string(e.what()) + "\n";
+    return false;
+  }
+
+  // Positions, then normals, then texcoords, each at the size scanObj counted
+  MappedFile spill;
+  const size_t spillReals = 3 * stats.numVertices + 3 * stats.numNormals + 2 * stats.numTexcoords;
+  if (!spill.createTemporary(spillReals * sizeof(real_t))) {
+    if (err)
+      *err = "Cannot create a temporary file for the attributes of [" + path + "]\n";
+    return false;
+  }
+  real_t* spilled = reinterpret_cast<real_t*>(spill.writableData());
+  ObjAttributes attrib;
+  attrib.vertices = spilled;
+  attrib.normals = spilled + 3 * stats.numVertices;
+  attrib.texcoords = attrib.normals + 3 * stats.numNormals;
+
+  std::map<std::string, int> materialMap;
+  std::set<std::string> loadedLibraries;
+  tinyobj::MaterialFileReader reader(mtlBaseDir);
+  std::string warnings, errors;
+  int material = -1;
+  unsigned smoothing = 0;
+  size_t lineBase = 0;
+  materials->clear();
+
+  std::vector<Chunk> chunks;
+  std::vector<tinyobj::index_t> corners;
+  std::vector<int> materialIds;
+
+  // Consumes the text window by window. Every window is split over the
+  // threads, and only the parse results of the current window are alive.
+  const char* window;
+  const char* windowEnd;
+  while (true) {
+    try {
+      if (!text.next(window, windowEnd))
+	break;
+    } catch (const std::exception& e) {
+      if (err)
+	*err = errors + e.what() + "\n";
+      if (warn)
+	*warn = warnings;
+      return false;
+    }
+    splitChunks(window, windowEnd, numThreads, chunks);
+
+    parallelFor(chunks.size(), numThreads, [&](size_t first, size_t end, unsigned) {
+      for (size_t i = first; i < end; i++)
+	parseChunk(chunks[i]);
+    });
+
+    for (auto& c : chunks) {
+      warnings += c.warn;
+      if (!c.err.empty()) {
+	if (err)
+	  *err = c.err + std::to_string(lineBase + c.errLine) + ").\n";
+	if (warn)
+	  *warn = warnings;
+	return false;
+      }
+      lineBase += c.numLines;
+
+      // state changes in file order
+      const int startMaterial = material;
+      const unsigned startSmoothing = smoothing;
+      for (auto& e : c.events) {
+	if (e.type == ChunkEvent::MtlLib) {
+	  loadMaterialLibraries(e.name, reader, loadedLibraries, materialMap,
+				*materials, warnings, errors);
+	} else if (e.type == ChunkEvent::UseMtl) {
+	  auto it = materialMap.find(e.name);
+	  if (it == materialMap.end())
+	    warnings += "material [ '" + e.name + "' ] not found in .mtl\n";
+	  e.materialId = material = it == materialMap.end() ? -1 : it->second;
+	} else if (e.type == ChunkEvent::Smoothing) {
+	  smoothing = e.smoothing;
+	}
+      }
+
+      const size_t vertexBase = attrib.numVertices;
+      const size_t normalBase = attrib.numNormals;
+      const size_t texcoordBase = attrib.numTexcoords;
+      if (vertexBase + c.vertices.size() / 3 > stats.numVertices ||
+	  normalBase + c.normals.size() / 3 > stats.numNormals ||
+	  texcoordBase + c.texcoords.size() / 2 > stats.numTexcoords) {
+	if (err)
+	  *err = errors + "Object changed while it was streamed.\n";
+	if (warn)
+	  *warn = warnings;
+	return false;
+      }
+      // Weights and colors are not kept, nothing downstream reads them
+      std::copy(c.vertices.begin(), c.vertices.end(), spilled + 3 * vertexBase);
+      std::copy(c.normals.begin(), c.normals.end(), spilled + 3 * (stats.numVertices + normalBase));
+      std::copy(c.texcoords.begin(), c.texcoords.end(),
+		spilled + 3 * (stats.numVertices + stats.numNormals) + 2 * texcoordBase);
+      attrib.numVertices += c.vertices.size() / 3;
+      attrib.numNormals += c.normals.size() / 3;
+      attrib.numTexcoords += c.texcoords.size() / 2;
+
+      if (!resolveChunk(c, vertexBase, normalBase, texcoordBase)) {
+	if (err)
+	  *err = errors + c.err;
+	if (warn)
+	  *warn = warnings;
+	return false;
+      }
+
+      // Faces can only use the positions read so far
+      corners.clear();
+      materialIds.clear();
+      const VertexLimits limits = {{c.faceSizes.size()}, {attrib.numVertices}};
+      if (triangulateChunk(c, 0, startMaterial, startSmoothing, attrib.vertices, limits,
+			   [&](size_t, const tinyobj::index_t& a, const tinyobj::index_t& b,
+			       const tinyobj::index_t& d, int id, unsigned) {
+			     corners.push_back(a);
+			     corners.push_back(b);
+			     corners.push_back(d);
+			     materialIds.push_back(id);
+			   }) > 0)
+	warnings += "Face with invalid vertex index found.\n";
+      if (!materialIds.empty())
+	sink(attrib, corners, materialIds);
+    }
+  }
+
+  if (warn)
+    *warn = warnings;
+  if (err)
+    *err = errors;
+  return true;
+}
+
+size_t verifyObjParser(const std::string& path, unsigned numThreads) {
+  std::string mtlBaseDir;
+  size_t separator = path.find_last_of("/\\");
+  if (separator != std::string::npos)
+    mtlBaseDir = path.substr(0, separator + 1);
+
+  // tinyobj reads a stream, which for compressed files is inflated first
+  std::unique_ptr<std::istream> stream;
+  if (isCompressed(path)) {
+    DecompressingReader reader(path);
+    std::string text, block;
+    while (reader.read(block))
+      text += block;
+    stream.reset(new std::istringstream(text));
+  } else {
+    stream.reset(new std::ifstream(path));
+  }
+  tinyobj::attrib_t expectedAttrib, attrib;
+  std::vector<tinyobj::shape_t> expectedShapes, shapes;
+  std::vector<tinyobj::material_t> expectedMaterials, materials;
+  std::string warn, err;
+  tinyobj::MaterialFileReader reader(mtlBaseDir);
+  const bool expectedOk = *stream && tinyobj::LoadObj(&expectedAttrib, &expectedShapes, &expectedMaterials,
+						      &warn, &err, stream.get(), &reader);
+  const bool ok = parseObjParallel(&attrib, &shapes, &materials, &warn, &err, path, mtlBaseDir, numThreads);
+
+  ParserDifferences differences;
+  if (ok != expectedOk)
+    differences.add(std::string("the parser ") + (ok ? "loads" : "fails on") + " the file, tinyobj " +
+		    (expectedOk ? "loads" : "fails on") + " it");
+  if (ok && expectedOk) {
+    compareReals("v", expectedAttrib.vertices, attrib.vertices, differences);
+    compareReals("v weight", expectedAttrib.vertex_weights, attrib.vertex_weights, differences);
+    compareReals("v color", expectedAttrib.colors, attrib.colors, differences);
+    compareReals("vn", expectedAttrib.normals, attrib.normals, differences);
+    compareReals("vt", expectedAttrib.texcoords, attrib.texcoords, differences);
+
+    auto sameIndex = [](const tinyobj::index_t& a, const tinyobj::index_t& b) {
+      return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index &&
+	a.texcoord_index == b.texcoord_index;
+    };
+    auto equal = [](const auto& a, const auto& b) { return a == b; };
+    if (shapes.size() != expectedShapes.size())
+      differences.add(std::to_string(shapes.size()) + " shapes, tinyobj " + std::to_string(expectedShapes.size()));
+    for (size_t s = 0; s < std::min(shapes.size(), expectedShapes.size()); s++) {
+      const tinyobj::shape_t& expected = expectedShapes[s];
+      const tinyobj::shape_t& shape = shapes[s];
+      const std::string name = "shape " + std::to_string(s);
+      if (shape.name != expected.name)
+	differences.add(name + " is named '" + shape.name + "', tinyobj '" + expected.name + "'");
+      compareArrays(name + " indices", expected.mesh.indices, shape.mesh.indices, sameIndex, differences);
+      compareArrays(name + " face sizes", expected.mesh.num_face_vertices, shape.mesh.num_face_vertices, equal,
+		    differences);
+      compareArrays(name + " material ids", expected.mesh.material_ids, shape.mesh.material_ids, equal,
+		    differences);
+      compareArrays(name + " smoothing groups", expected.mesh.smoothing_group_ids,
+		    shape.mesh.smoothing_group_ids, equal, differences);
+    }
+    compareArrays("materials", expectedMaterials, materials,
+		  [](const tinyobj::material_t& a, const tinyobj::material_t& b) { return a.name == b.name; },
+		  differences);
+  }
+  std::cout << "Compared the parser against tinyobj on " << path << " (" << shapes.size() << " shapes, "
+	    << attrib.vertices.size() / 3 << " positions): " << differences.count << " differences\n";
+  return differences.count;
+}
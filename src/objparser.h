@@ -0,0 +1,86 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include "common/tiny_obj_loader.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Parses a Wavefront .obj file on several threads.
+//
+// The file is memory mapped and tokenized in place without copying lines.
+// Files ending in .gz or .zst are inflated on a background thread instead
+// and parsed in windows of whole lines while the next window is inflated.
+// The text is split at newline boundaries into chunks that are tokenized
+// independently. Every chunk collects its own v/vn/vt/f arrays, relative
+// indices are resolved against the chunk and a prefix sum over the chunk
+// sizes turns them into absolute indices while the results are merged.
+// The output matches tinyobj::LoadObj with triangulation and vertex colors
+// enabled: quads are split along the shorter diagonal, larger polygons are
+// ear clipped by a port of tinyobj's clipping, shapes start and end where
+// tinyobj starts and ends them, and indices past the end of the attribute
+// arrays are kept with a warning. Lines, points, skin weights and tags are
+// not loaded.
+//
+// numThreads = 0 uses one thread per core. readMatFn, like in tinyobj, reads
+// the mtllib files instead of a tinyobj::MaterialFileReader on mtlBaseDir.
+bool parseObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+		      std::vector<tinyobj::material_t>* materials, std::string* warn,
+		      std::string* err, const std::string& path,
+		      const std::string& mtlBaseDir, unsigned numThreads = 0,
+		      tinyobj::MaterialReader* readMatFn = nullptr);
+
+struct ObjStats {
+  size_t numTriangles = 0;
+  // Number of v, vn and vt lines
+  size_t numVertices = 0;
+  size_t numNormals = 0;
+  size_t numTexcoords = 0;
+  bool hasNormals = false;    // the file has vn lines
+  bool hasTexcoords = false;  // the file has vt lines
+};
+
+// Counts the attribute lines and the triangles the .obj file will produce
+// without parsing numbers. The triangles are an upper bound: faces without
+// positions and polygons without ears give fewer. A compressed file is
+// inflated for this, and once more when it is parsed.
+ObjStats scanObj(const std::string& path, unsigned numThreads = 0);
+
+// Loads the .obj with tinyobj::LoadObj and with parseObjParallel, prints
+// the first differences between their attributes, shapes and materials and
+// returns how many there are. Values may differ in their last bits, as
+// tinyobj rounds numbers its own way.
+size_t verifyObjParser(const std::string& path, unsigned numThreads = 0);
+
+// Positions, normals and texcoords of a streamed .obj as far as it has been
+// read. They live in a temporary file mapping rather than on the heap;
+// vertex weights and colors are not kept.
+struct ObjAttributes {
+  const tinyobj::real_t* vertices = nullptr;
+  const tinyobj::real_t* normals = nullptr;
+  const tinyobj::real_t* texcoords = nullptr;
+  size_t numVertices = 0;
+  size_t numNormals = 0;
+  size_t numTexcoords = 0;
+};
+
+// Receives the triangles of one window: three corners and one material id per
+// triangle. Like in tinyobj, corners may refer past the attributes read so
+// far, which the sink has to check.
+using ObjTriangleSink = std::function<void(const ObjAttributes& attrib,
+					   const std::vector<tinyobj::index_t>& corners,
+					   const std::vector<int>& materialIds)>;
+
+// Parses an .obj file in windows of about windowSize bytes of text and hands
+// the triangles of each window to sink before parsing the next one. Faces may
+// refer to any earlier attribute, so the attributes are spilled to a
+// temporary file mapping sized by the counts from scanObj; everything on the
+// heap is bounded by the window size. Fails when the file has more attributes
+// than stats counted.
+bool streamObj(const ObjStats& stats, std::vector<tinyobj::material_t>* materials,
+	       std::string* warn, std::string* err, const std::string& path,
+	       const std::string& mtlBaseDir, size_t windowSize, unsigned numThreads,
+	       const ObjTriangleSink& sink);
+
+#endif
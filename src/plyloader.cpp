@@ -0,0 +1,545 @@
+#include "plyloader.h"
+#include "bounds.h"
+#include "common/parallel.h"
+#include "normals.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+  enum class PlyType : uint8_t { None, Int8, Uint8, Int16, Uint16, Int32, Uint32, Float32, Float64 };
+
+  PlyType parseType(const std::string& name) {
+    if (name == "char" || name == "int8") return PlyType::Int8;
+    if (name == "uchar" || name == "uint8") return PlyType::Uint8;
+    if (name == "short" || name == "int16") return PlyType::Int16;
+    if (name == "ushort" || name == "uint16") return PlyType::Uint16;
+    if (name == "int" || name == "int32") return PlyType::Int32;
+    if (name == "uint" || name == "uint32") return PlyType::Uint32;
+    if (name == "float" || name == "float32") return PlyType::Float32;
+    if (name == "double" || name == "float64") return PlyType::Float64;
+    return PlyType::None;
+  }
+
+  size_t typeSize(PlyType type) {
+    switch (type) {
+    case PlyType::Int8:
+    case PlyType::Uint8:
+      return 1;
+    case PlyType::Int16:
+    case PlyType::Uint16:
+      return 2;
+    case PlyType::Int32:
+    case PlyType::Uint32:
+    case PlyType::Float32:
+      return 4;
+    case PlyType::Float64:
+      return 8;
+    default:
+      return 0;
+    }
+  }
+
+  struct PlyProperty {
+    std::string name;
+    PlyType type = PlyType::None;       // of the value, or of the list items
+    PlyType countType = PlyType::None;  // None for scalar properties
+    size_t offset = 0;                  // in the record, when no list comes before it
+  };
+
+  struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    bool fixedSize = true;  // no list properties
+    size_t stride = 0;      // record size of fixed size elements
+    const unsigned char* data = nullptr;  // first record, once located
+
+    const PlyProperty* find(const char* property) const {
+      for (const auto& p : properties)
+	if (p.name == property)
+	  return &p;
+      return nullptr;
+    }
+  };
+
+  struct PlyFile {
+    std::string path;
+    bool bigEndian = false;
+    std::vector<PlyElement> elements;
+    const unsigned char* end = nullptr;
+
+    [[noreturn]] void fail(const std::string& what) const {
+      throw std::runtime_error("Invalid PLY file " + path + ": " + what);
+    }
+
+    PlyElement* find(const char* name) {
+      for (auto& e : elements)
+	if (e.name == name)
+	  return &e;
+      return nullptr;
+    }
+  };
+
+  template <typename T>
+  T load(const unsigned char* p, bool swap) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, p, sizeof(T));
+    if (swap)
+      std::reverse(bytes, bytes + sizeof(T));
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+  }
+
+  double readScalar(const unsigned char* p, PlyType type, bool swap) {
+    switch (type) {
+    case PlyType::Int8: return load<int8_t>(p, swap);
+    case PlyType::Uint8: return load<uint8_t>(p, swap);
+    case PlyType::Int16: return load<int16_t>(p, swap);
+    case PlyType::Uint16: return load<uint16_t>(p, swap);
+    case PlyType::Int32: return load<int32_t>(p, swap);
+    case PlyType::Uint32: return load<uint32_t>(p, swap);
+    case PlyType::Float32: return load<float>(p, swap);
+    case PlyType::Float64: return load<double>(p, swap);
+    default: return 0.0;
+    }
+  }
+
+  // Negative values wrap around and fail the range check later
+  uint32_t readIndex(const unsigned char* p, PlyType type, bool swap) {
+    switch (type) {
+    case PlyType::Int8: return static_cast<uint32_t>(static_cast<int32_t>(load<int8_t>(p, swap)));
+    case PlyType::Uint8: return load<uint8_t>(p, swap);
+    case PlyType::Int16: return static_cast<uint32_t>(static_cast<int32_t>(load<int16_t>(p, swap)));
+    case PlyType::Uint16: return load<uint16_t>(p, swap);
+    case PlyType::Int32:
+    case PlyType::Uint32: return load<uint32_t>(p, swap);
+    default: return std::numeric_limits<uint32_t>::max();
+    }
+  }
+
+  PlyFile readHeader(const std::string& path, const MappedFile& file) {
+    PlyFile ply;
+    ply.path = path;
+    const char* p = file.data();
+    const char* end = p + file.size();
+    ply.end = reinterpret_cast<const unsigned char*>(end);
+    if (file.size() < 4 || std::memcmp(p, "ply", 3) != 0 || (p[3] != '\n' && p[3] != '\r'))
+      ply.fail("not a PLY file");
+
+    bool haveFormat = false;
+    while (true) {
+      const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (!lineEnd)
+	ply.fail("no end_header");
+      std::istringstream line(std::string(p, lineEnd));
+      p = lineEnd + 1;
+      std::string keyword;
+      line >> keyword;
+      if (keyword == "end_header")
+	break;
+      if (keyword == "format") {
+	std::string format;
+	line >> format;
+	if (format == "ascii")
+	  ply.fail("ASCII PLY files are not supported, only binary ones");
+	if (format != "binary_little_endian" && format != "binary_big_endian")
+	  ply.fail("unknown format " + format);
+	ply.bigEndian = format == "binary_big_endian";
+	haveFormat = true;
+      } else if (keyword == "element") {
+	PlyElement element;
+	line >> element.name >> element.count;
+	if (!line)
+	  ply.fail("bad element line");
+	ply.elements.push_back(element);
+      } else if (keyword == "property") {
+	if (ply.elements.empty())
+	  ply.fail("property before the first element");
+	PlyProperty property;
+	std::string type;
+	line >> type;
+	if (type == "list") {
+	  std::string countType;
+	  line >> countType >> type;
+	  property.countType = parseType(countType);
+	  if (property.countType == PlyType::None || property.countType == PlyType::Float32 ||
+	      property.countType == PlyType::Float64)
+	    ply.fail("bad list count type " + countType);
+	}
+	line >> property.name;
+	property.type = parseType(type);
+	if (!line || property.type == PlyType::None)
+	  ply.fail("bad property line");
+	ply.elements.back().properties.push_back(property);
+      }
+      // comment and obj_info lines are ignored
+    }
+    if (!haveFormat)
+      ply.fail("no format line");
+
+    for (auto& element : ply.elements) {
+      size_t offset = 0;
+      for (auto& property : element.properties) {
+	property.offset = offset;
+	if (property.countType != PlyType::None)
+	  element.fixedSize = false;
+	offset += typeSize(property.type);
+      }
+      element.stride = element.fixedSize ? offset : 0;
+    }
+
+    // The element blocks follow each other; those with lists have to be
+    // walked to find where the next one starts
+    const unsigned char* cursor = reinterpret_cast<const unsigned char*>(p);
+    for (auto& element : ply.elements) {
+      element.data = cursor;
+      if (element.fixedSize) {
+	if (element.count > static_cast<size_t>(ply.end - cursor) / std::max<size_t>(element.stride, 1))
+	  ply.fail("element " + element.name + " is truncated");
+	cursor += element.count * element.stride;
+	continue;
+      }
+      // Nothing after the face element is needed
+      if (element.name == "face")
+	break;
+      for (size_t r = 0; r < element.count; r++)
+	for (const auto& property : element.properties) {
+	  size_t bytes = typeSize(property.type);
+	  if (property.countType != PlyType::None) {
+	    if (static_cast<size_t>(ply.end - cursor) < typeSize(property.countType))
+	      ply.fail("element " + element.name + " is truncated");
+	    bytes = typeSize(property.countType) +
+	      readIndex(cursor, property.countType, ply.bigEndian) * bytes;
+	  }
+	  if (static_cast<size_t>(ply.end - cursor) < bytes)
+	    ply.fail("element " + element.name + " is truncated");
+	  cursor += bytes;
+	}
+    }
+    return ply;
+  }
+
+  // The first scalar property with one of the names of each alternative
+  bool findProperties(const PlyElement& element, std::initializer_list<std::vector<const char*>> alternatives,
+		      const PlyProperty** out) {
+    for (const auto& names : alternatives) {
+      bool all = true;
+      for (size_t k = 0; k < names.size(); k++) {
+	out[k] = element.find(names[k]);
+	all = all && out[k] && out[k]->countType == PlyType::None;
+      }
+      if (all)
+	return true;
+    }
+    return false;
+  }
+
+  // Float components that follow each other on a 4 byte boundary can be
+  // read by GL as they are
+  bool mappedAttribute(const PlyProperty* const* properties, int components, VertexAttribute& attribute) {
+    if (properties[0]->offset % 4 != 0 || properties[0]->offset > std::numeric_limits<uint16_t>::max())
+      return false;
+    for (int k = 0; k < components; k++)
+      if (properties[k]->type != PlyType::Float32 || properties[k]->offset != properties[0]->offset + 4 * k)
+	return false;
+    attribute.format = VertexFormat::Float;
+    attribute.components = static_cast<uint8_t>(components);
+    attribute.offset = static_cast<uint16_t>(properties[0]->offset);
+    return true;
+  }
+
+  // Box and sphere of the positions [begin, end)
+  template <typename Position>
+  void rangeBounds(const Position& position, size_t begin, size_t end, Submesh& submesh) {
+    for (int axis = 0; axis < 3; axis++) {
+      submesh.boundsMin[axis] = std::numeric_limits<float>::max();
+      submesh.boundsMax[axis] = -std::numeric_limits<float>::max();
+    }
+    for (size_t i = begin; i < end; i++) {
+      float p[3];
+      position(i, p);
+      for (int axis = 0; axis < 3; axis++) {
+	submesh.boundsMin[axis] = std::min(submesh.boundsMin[axis], p[axis]);
+	submesh.boundsMax[axis] = std::max(submesh.boundsMax[axis], p[axis]);
+      }
+    }
+    if (begin == end)
+      for (int axis = 0; axis < 3; axis++)
+	submesh.boundsMin[axis] = submesh.boundsMax[axis] = 0.0f;
+    float extent = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+      submesh.center[axis] = (submesh.boundsMin[axis] + submesh.boundsMax[axis]) * 0.5f;
+      float half = (submesh.boundsMax[axis] - submesh.boundsMin[axis]) * 0.5f;
+      extent += half * half;
+    }
+    submesh.radius = std::sqrt(extent);
+  }
+
+  // One submesh per run of pointsPerSubmesh vertices, or a single one for
+  // the triangles, with bounds computed in parallel. Sets the mesh bounds.
+  template <typename Position>
+  void splitVertices(MeshData& mesh, size_t numVertices, size_t numIndices, bool points,
+		     const Position& position, unsigned threads) {
+    const size_t pointsPerSubmesh = size_t(1) << 16;
+    const size_t chunk = points ? pointsPerSubmesh : std::max<size_t>(numVertices / std::max(threads, 1u), 1);
+    const size_t numChunks = std::max<size_t>((numVertices + chunk - 1) / chunk, 1);
+    std::vector<Submesh> chunks(numChunks, Submesh());
+    parallelFor(numChunks, threads, [&](size_t begin, size_t end, unsigned) {
+      for (size_t c = begin; c < end; c++)
+	rangeBounds(position, c * chunk, std::min(numVertices, (c + 1) * chunk), chunks[c]);
+    });
+    for (size_t c = 0; c < numChunks; c++) {
+      glm::vec3 lower(chunks[c].boundsMin[0], chunks[c].boundsMin[1], chunks[c].boundsMin[2]);
+      glm::vec3 upper(chunks[c].boundsMax[0], chunks[c].boundsMax[1], chunks[c].boundsMax[2]);
+      mesh.boundsMin = c == 0 ? lower : glm::min(mesh.boundsMin, lower);
+      mesh.boundsMax = c == 0 ? upper : glm::max(mesh.boundsMax, upper);
+    }
+
+    mesh.submeshes.clear();
+    mesh.lods.clear();
+    if (!points) {
+      Submesh whole = {};
+      for (int axis = 0; axis < 3; axis++) {
+	whole.boundsMin[axis] = mesh.boundsMin[axis];
+	whole.boundsMax[axis] = mesh.boundsMax[axis];
+	whole.center[axis] = (mesh.boundsMin[axis] + mesh.boundsMax[axis]) * 0.5f;
+      }
+      whole.radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f;
+      whole.material = -1;
+      whole.lodCount = 1;
+      mesh.submeshes.push_back(whole);
+      mesh.lods.push_back(MeshLod{0, static_cast<uint32_t>(numIndices), 0.0f});
+      return;
+    }
+    for (size_t c = 0; c < numChunks; c++) {
+      Submesh& submesh = chunks[c];
+      submesh.material = -1;
+      submesh.firstLod = static_cast<uint32_t>(c);
+      submesh.lodCount = 1;
+      mesh.submeshes.push_back(submesh);
+      const size_t first = c * chunk;
+      mesh.lods.push_back(MeshLod{static_cast<uint32_t>(first),
+				  static_cast<uint32_t>(std::min(numVertices, first + chunk) - first), 0.0f});
+    }
+  }
+
+  // Triangles of the face element. Faces that are all triangles with
+  // scalar properties around the list have a fixed record size and are
+  // copied in parallel; anything else is walked once and polygons fanned.
+  void readFaces(const PlyFile& ply, const PlyElement& face, size_t numVertices, unsigned threads,
+		 std::vector<unsigned int>& indices) {
+    size_t list = face.properties.size();
+    bool scalarOthers = true;
+    size_t before = 0, after = 0;
+    for (size_t i = 0; i < face.properties.size(); i++) {
+      const PlyProperty& property = face.properties[i];
+      if (list == face.properties.size() && property.countType != PlyType::None &&
+	  (property.name == "vertex_indices" || property.name == "vertex_index")) {
+	list = i;
+	continue;
+      }
+      scalarOthers = scalarOthers && property.countType == PlyType::None;
+      (list == face.properties.size() ? before : after) += typeSize(property.type);
+    }
+    if (list == face.properties.size())
+      ply.fail("the face element has no vertex_indices list");
+    const PlyProperty& corners = face.properties[list];
+    const size_t countSize = typeSize(corners.countType);
+    const size_t indexSize = typeSize(corners.type);
+    if (corners.type == PlyType::Float32 || corners.type == PlyType::Float64)
+      ply.fail("face indices are not integers");
+    const bool swap = ply.bigEndian;
+    const size_t available = static_cast<size_t>(ply.end - face.data);
+
+    const size_t record = before + countSize + 3 * indexSize + after;
+    bool uniform = scalarOthers && face.count <= available / record;
+    if (uniform) {
+      std::vector<char> threadUniform(std::max(threads, 1u), 1);
+      parallelFor(face.count, threads, [&](size_t begin, size_t end, unsigned t) {
+	for (size_t f = begin; f < end && threadUniform[t]; f++)
+	  threadUniform[t] = readIndex(face.data + f * record + before, corners.countType, swap) == 3;
+      });
+      uniform = std::find(threadUniform.begin(), threadUniform.end(), 0) == threadUniform.end();
+    }
+    if (uniform) {
+      // Every record starts with count 3, so by induction they all sit at
+      // multiples of the record size
+      indices.resize(3 * face.count);
+      const bool direct = !swap && (corners.type == PlyType::Int32 || corners.type == PlyType::Uint32);
+      parallelFor(face.count, threads, [&](size_t begin, size_t end, unsigned) {
+	for (size_t f = begin; f < end; f++) {
+	  const unsigned char* items = face.data + f * record + before + countSize;
+	  if (direct) {
+	    std::memcpy(&indices[3 * f], items, 3 * sizeof(unsigned int));
+	    continue;
+	  }
+	  for (size_t k = 0; k < 3; k++)
+	    indices[3 * f + k] = readIndex(items + k * indexSize, corners.type, swap);
+	}
+      });
+    } else {
+      indices.clear();
+      const unsigned char* p = face.data;
+      auto need = [&](size_t bytes) {
+	if (static_cast<size_t>(ply.end - p) < bytes)
+	  ply.fail("the face element is truncated");
+      };
+      for (size_t f = 0; f < face.count; f++)
+	for (size_t i = 0; i < face.properties.size(); i++) {
+	  const PlyProperty& property = face.properties[i];
+	  if (property.countType == PlyType::None) {
+	    need(typeSize(property.type));
+	    p += typeSize(property.type);
+	    continue;
+	  }
+	  need(typeSize(property.countType));
+	  const size_t count = readIndex(p, property.countType, swap);
+	  p += typeSize(property.countType);
+	  need(count * typeSize(property.type));
+	  if (i == list)
+	    for (size_t k = 1; k + 1 < count; k++) {
+	      indices.push_back(readIndex(p, corners.type, swap));
+	      indices.push_back(readIndex(p + k * indexSize, corners.type, swap));
+	      indices.push_back(readIndex(p + (k + 1) * indexSize, corners.type, swap));
+	    }
+	  p += count * typeSize(property.type);
+	}
+    }
+
+    // Out of range indices would read outside the vertex buffer
+    std::vector<char> threadValid(std::max(threads, 1u), 1);
+    parallelFor(indices.size(), threads, [&](size_t begin, size_t end, unsigned t) {
+      for (size_t i = begin; i < end; i++)
+	if (indices[i] >= numVertices)
+	  threadValid[t] = 0;
+    });
+    if (std::find(threadValid.begin(), threadValid.end(), 0) != threadValid.end())
+      ply.fail("face index out of range");
+  }
+}
+
+bool isPly(const std::string& path) {
+  return std::filesystem::path(path).extension() == ".ply";
+}
+
+bool loadPlyMesh(const std::string& path, const LoadOptions& options, LoadedMesh& mesh) {
+  auto start = std::chrono::steady_clock::now();
+  if (!mesh.source.open(path))
+    throw std::runtime_error("Failed to open " + path);
+  PlyFile ply = readHeader(path, mesh.source);
+  const unsigned threads = options.loaderThreads ? options.loaderThreads : defaultThreadCount();
+
+  const PlyElement* vertex = ply.find("vertex");
+  const PlyElement* face = ply.find("face");
+  if (!vertex || !vertex->data)
+    ply.fail("no vertex element");
+  if (!vertex->fixedSize)
+    ply.fail("list properties in the vertex element are not supported");
+  if (face && !face->data)
+    face = nullptr;
+  const bool points = !face || face->count == 0;
+  const size_t numVertices = vertex->count;
+  if (numVertices > static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+    ply.fail("more vertices than 32-bit indices can address");
+
+  const PlyProperty* position[3];
+  const PlyProperty* normal[3];
+  const PlyProperty* uv[2];
+  if (!findProperties(*vertex, {{"x", "y", "z"}}, position))
+    ply.fail("the vertices have no x, y and z");
+  const bool hasNormals = findProperties(*vertex, {{"nx", "ny", "nz"}}, normal);
+  const bool hasUVs = findProperties(*vertex, {{"u", "v"}, {"s", "t"}, {"texture_u", "texture_v"},
+					       {"texture_s", "texture_t"}}, uv);
+  const bool swap = ply.bigEndian;
+  const size_t stride = vertex->stride;
+
+  mesh.materials.clear();
+  mesh.shapeNames.assign(1, std::string());
+  MeshData& data = mesh.data;
+  data.points = points;
+
+  // Meshes need normals to be lit, point clouds do without
+  VertexLayout layout;
+  layout.stride = static_cast<uint32_t>(stride);
+  bool mapped = options.mapSourceBuffers && !swap && stride % 4 == 0 &&
+    mappedAttribute(position, 3, layout.position) &&
+    (hasNormals ? mappedAttribute(normal, 3, layout.normal) : points) &&
+    (!hasUVs || mappedAttribute(uv, 2, layout.uv));
+
+  if (!points)
+    readFaces(ply, *face, numVertices, threads, data.indices);
+
+  if (mapped) {
+    auto read = [&](size_t i, float* p) {
+      std::memcpy(p, vertex->data + i * stride + layout.position.offset, 3 * sizeof(float));
+    };
+    splitVertices(data, numVertices, data.indices.size(), points, read, threads);
+
+    MeshView& v = mesh.view;
+    v = MeshView();
+    v.vertexData = vertex->data;
+    v.layout = layout;
+    v.indices = data.indices.data();
+    v.lods = data.lods.data();
+    v.submeshes = data.submeshes.data();
+    v.numVertices = numVertices;
+    v.numIndices = data.indices.size();
+    v.numLods = data.lods.size();
+    v.numSubmeshes = data.submeshes.size();
+    v.boundsMin = data.boundsMin;
+    v.boundsMax = data.boundsMax;
+    v.points = points;
+    auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    std::cout << "Mapped " << path << " in " << time.count() << " ms: " << numVertices << " vertices, "
+	      << (points ? std::string("point cloud") : std::to_string(v.numIndices / 3) + " triangles")
+	      << ", " << stride << " bytes per vertex\n";
+    return true;
+  }
+
+  // Strided reads of the properties into the float arrays
+  data.vertices.resize(3 * numVertices);
+  data.normals.resize(3 * numVertices);
+  data.uvs.resize(2 * numVertices);
+  parallelFor(numVertices, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      const unsigned char* record = vertex->data + i * stride;
+      for (int k = 0; k < 3; k++) {
+	data.vertices[3 * i + k] = static_cast<float>(readScalar(record + position[k]->offset, position[k]->type, swap));
+	data.normals[3 * i + k] = hasNormals ?
+	  static_cast<float>(readScalar(record + normal[k]->offset, normal[k]->type, swap)) : (k == 2 ? 1.0f : 0.0f);
+      }
+      for (int k = 0; k < 2; k++)
+	data.uvs[2 * i + k] = hasUVs ? static_cast<float>(readScalar(record + uv[k]->offset, uv[k]->type, swap)) : 0.0f;
+    }
+  });
+  if (!hasNormals && !points)
+    fillVertexNormals(data.vertices, data.indices, std::vector<char>(numVertices, 1), data.normals);
+  data.hasNormals = hasNormals || !points;
+  data.hasUVs = hasUVs;
+  data.hasTangents = false;
+  auto read = [&](size_t i, float* p) { std::copy(&data.vertices[3 * i], &data.vertices[3 * i] + 3, p); };
+  splitVertices(data, numVertices, data.indices.size(), points, read, threads);
+
+  auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+  std::cout << "Converted " << path << " in " << time.count() << " ms: " << numVertices << " vertices, "
+	    << (points ? std::string("point cloud") : std::to_string(data.indices.size() / 3) + " triangles")
+	    << "\n";
+  if (!points) {
+    computeSubmeshBounds(data, options.loaderThreads);
+    return false;
+  }
+  // Point clouds have nothing to optimize or simplify
+  data.pack();
+  mesh.view = data.view();
+  return true;
+}
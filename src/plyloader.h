@@ -0,0 +1,30 @@
+#ifndef PLY_LOADER_H
+#define PLY_LOADER_H
+
+#include "meshbuilder.h"
+
+#include <string>
+
+// Loader for binary PLY files as written by scanners and photogrammetry
+// tools. The vertex element provides x/y/z, optionally nx/ny/nz and u/v
+// (or s/t, texture_u/texture_v); other properties such as colors are
+// skipped. Faces come from the vertex_indices (or vertex_index) list of the
+// face element and are fanned into triangles. A file without faces is a
+// point cloud, split into submeshes of consecutive vertices so that culling
+// has something to work with. Everything becomes one unnamed shape without
+// materials. ASCII files are rejected.
+
+bool isPly(const std::string& path);
+
+// Maps the file at path into mesh.source. When options.mapSourceBuffers is
+// set and the vertex element is little endian with 4-byte aligned float
+// positions (and normals, which meshes with faces need), mesh.view points
+// straight into the mapping and the face lists are copied into the index
+// buffer, one record stride at a time when all faces are triangles. Point
+// clouds are finished either way. In these cases true is returned.
+// Otherwise the vertices and faces are converted into mesh.data, ready for
+// the same steps as an .obj, and false is returned. Throws
+// std::runtime_error when the file is invalid.
+bool loadPlyMesh(const std::string& path, const LoadOptions& options, LoadedMesh& mesh);
+
+#endif
@@ -1,121 +1,372 @@
 #include "sceneobject.h"
-#include "common/stb_image.h"
+#include "meshbuilder.h"
+#include "objparser.h"
+#include "stlloader.h"
+#include "common/mappedfile.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "common/tiny_obj_loader.h"
-
-#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 
-void SceneObject::loadObject(std::string& path, std::string& mtlPath) {
-  loadModel(path);
-  
+namespace {
+  // Points a vertex attribute at its place in the interleaved buffer
+  void setVertexAttribute(GLuint location, const VertexAttribute& attribute, GLsizei stride) {
+    if (!attribute.present()) {
+      glDisableVertexAttribArray(location);
+      return;
+    }
+    GLenum type = GL_FLOAT;
+    GLboolean normalized = GL_FALSE;
+    switch (attribute.format) {
+    case VertexFormat::Unorm16:
+      type = GL_UNSIGNED_SHORT;
+      normalized = GL_TRUE;
+      break;
+    case VertexFormat::Snorm16:
+      type = GL_SHORT;
+      normalized = GL_TRUE;
+      break;
+    case VertexFormat::Half:
+      type = GL_HALF_FLOAT;
+      break;
+    case VertexFormat::Snorm8:
+      type = GL_BYTE;
+      normalized = GL_TRUE;
+      break;
+    default:
+      break;
+    }
+    glVertexAttribPointer(location, attribute.components, type, normalized, stride,
+			  reinterpret_cast<void*>(static_cast<uintptr_t>(attribute.offset)));
+    glEnableVertexAttribArray(location);
+  }
+
+  // Points the bound VAO at the buffer bound to GL_ARRAY_BUFFER
+  void setVertexAttributes(const VertexLayout& layout) {
+    setVertexAttribute(0, layout.position, layout.stride);
+    setVertexAttribute(1, layout.normal, layout.stride);
+    setVertexAttribute(2, layout.uv, layout.stride);
+    setVertexAttribute(3, layout.tangent, layout.stride);
+  }
 }
 
-void SceneObject::loadModel(std::string &path) {
-  tinyobj::ObjReaderConfig reader_config;
-  tinyobj::ObjReader reader;
+void SceneObject::loadObject(std::string& path, std::string& mtlPath, const LoadOptions& options) {
+  if (isMappedFormat(path))
+    loadMapped(path, options);
+  else
+    loadModel(path, options);
+}
 
-  if (!reader.ParseFromFile(path, reader_config)) {
-    if (!reader.Error().empty()) 
-      std::cerr << "TinyObjReader: " << reader.Error();
-    throw std::runtime_error("Failed to Load Object");
+void SceneObject::loadMapped(std::string& path, const LoadOptions& options) {
+  // Never streamed: a mapped .glb or .ply costs no host memory beyond the mapping
+  LoadedMesh mesh;
+  loadMesh(path, options, mesh);
+  m_materials = std::move(mesh.materials);
+  shapeNames = std::move(mesh.shapeNames);
+  textureDir = std::move(mesh.textureDir);
+  upload(mesh.view);
+}
+
+void SceneObject::loadModel(std::string &path, const LoadOptions& options) {
+  // The streaming parser reads .obj text only
+  if (options.streamBudget > 0 && !isStl(path)) {
+    loadModelStreaming(path, options);
+    return;
   }
-  if (!reader.Warning().empty())
-    std::cout << "TinyObjReader: " << reader.Warning();
 
-  auto& attrib = reader.GetAttrib();
-  auto& shapes = reader.GetShapes();
+  LoadedMesh mesh;
+  loadMesh(path, options, mesh);
+  m_materials = std::move(mesh.materials);
+  shapeNames = std::move(mesh.shapeNames);
+  textureDir = std::move(mesh.textureDir);
+  upload(mesh.view);
+}
+
+void SceneObject::loadModelStreaming(std::string &path, const LoadOptions& options) {
+  // The vertex buffer is indexed by position: every v line gets one vertex,
+  // with the normal and texcoord of the first corner that uses it. A corner
+  // pairing the position with others gets a vertex of its own, appended
+  // after the positions. The pair every position took is kept in a table
+  // in a temporary file mapping, like the attributes streamObj spills, so
+  // neither grows the heap with the mesh.
+  const ObjStats stats = scanObj(path, options.loaderThreads);
+  // The bounds are only known at the end, so positions stay floats
+  const VertexLayout streamLayout = packedLayout(stats.hasNormals, stats.hasTexcoords, false);
+  const size_t stride = streamLayout.stride;
+  // Staged per corner: its index and at most one new vertex, with its target
+  // and a sorted copy
+  const size_t cornerBytes = sizeof(unsigned int) + 2 * stride + 2 * sizeof(uint32_t);
+
+  // Half of the budget goes to the staging arrays, a quarter to the text
+  // window being parsed and the rest to its parse results
+  const size_t batchCorners = std::max<size_t>(3, options.streamBudget / 2 / cornerBytes / 3 * 3);
+  const size_t windowSize = std::max<size_t>(options.streamBudget / 4, 4096);
+
+  MappedFile pairTable;
+  if (!pairTable.createTemporary(stats.numVertices * sizeof(uint64_t)))
+    throw std::runtime_error("Cannot create a temporary file to stream " + path);
+  // 0 while the position is unused, else its normal and texcoord index + 2
+  uint64_t* pairs = reinterpret_cast<uint64_t*>(pairTable.writableData());
+
+  std::string mtlBaseDir;
+  size_t separator = path.find_last_of("/\\");
+  if (separator != std::string::npos)
+    mtlBaseDir = path.substr(0, separator + 1);
+  textureDir = mtlBaseDir;
 
-  // Vectors to store the vertex data
-  std::vector<float> vertices;
-  std::vector<float> normals;
+  // Allocate the GPU buffers up front, then fill them batch by batch. The
+  // vertex buffer grows on the GPU when the appended vertices do not fit.
+  size_t capacity = stats.numVertices + stats.numVertices / 8;
+  MeshView empty;
+  empty.layout = streamLayout;
+  empty.numVertices = capacity;
+  empty.numIndices = 3 * stats.numTriangles;
+  upload(empty);
+  auto reserveVertices = [&](size_t count) {
+    if (count <= capacity)
+      return;
+    const size_t grown = std::max(count, capacity + capacity / 2);
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, grown * stride, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, vertexBuffer);
+    if (capacity > 0)
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, 0, capacity * stride);
+    setVertexAttributes(streamLayout);
+    glBindVertexArray(0);
+    glDeleteBuffers(1, &vertexBuffer);
+    vertexBuffer = buffer;
+    capacity = grown;
+  };
+
+  std::vector<unsigned char> packed, sorted;
+  std::vector<uint32_t> targets, order;
   std::vector<unsigned int> indices;
-  std::vector<int> material_ids;
-
-  for (const auto& shape : shapes) {
-    // Loop over faces (polygon)
-    size_t index_offset = 0;
-    for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
-      size_t fv = shape.mesh.num_face_vertices[f];
-      
-      // Loop over vertices in the face
-      for (size_t v = 0; v < fv; v++) {
-        // access to vertex
-        tinyobj::index_t idx = shape.mesh.indices[index_offset + v];
-        
-        // vertex position
-        vertices.push_back(attrib.vertices[3 * idx.vertex_index + 0]);
-        vertices.push_back(attrib.vertices[3 * idx.vertex_index + 1]);
-        vertices.push_back(attrib.vertices[3 * idx.vertex_index + 2]);
-        
-        // vertex normals
-        if (idx.normal_index >= 0) {
-          normals.push_back(attrib.normals[3 * idx.normal_index + 0]);
-          normals.push_back(attrib.normals[3 * idx.normal_index + 1]);
-          normals.push_back(attrib.normals[3 * idx.normal_index + 2]);
-        } else {
-          // Default normal if not provided
-          normals.push_back(0.0f);
-          normals.push_back(0.0f);
-          normals.push_back(1.0f);
-        }
-        // Add index (we're using a flat array, so indices are sequential)
-        indices.push_back(index_offset + v);
-	int material_id = shape.mesh.material_ids[f];
-	material_ids.push_back(material_id);
+  packed.reserve(batchCorners * stride);
+  targets.reserve(batchCorners);
+  indices.reserve(batchCorners);
+  size_t uploaded = 0, appended = stats.numVertices, dropped = 0;
+  glm::vec3 lower(std::numeric_limits<float>::max());
+  glm::vec3 upper(-std::numeric_limits<float>::max());
+
+  auto flush = [&]() {
+    const size_t count = indices.size();
+    if (uploaded + count > numIndices)
+      throw std::runtime_error("Object changed while it was streamed");
+    reserveVertices(appended);
+    glBindVertexArray(0);
+
+    // New vertices in buffer order, uploaded a run of consecutive ones at a time
+    order.resize(targets.size());
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = static_cast<uint32_t>(i);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return targets[a] < targets[b]; });
+    sorted.resize(packed.size());
+    for (size_t i = 0; i < order.size(); i++)
+      std::copy(&packed[order[i] * stride], &packed[order[i] * stride] + stride, &sorted[i * stride]);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    for (size_t begin = 0, end; begin < order.size(); begin = end) {
+      for (end = begin + 1; end < order.size() && targets[order[end]] == targets[order[end - 1]] + 1; end++)
+	;
+      glBufferSubData(GL_ARRAY_BUFFER, targets[order[begin]] * stride, (end - begin) * stride,
+		      &sorted[begin * stride]);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, uploaded * sizeof(unsigned int), count * sizeof(unsigned int), indices.data());
+    uploaded += count;
+    packed.clear();
+    targets.clear();
+    indices.clear();
+  };
+
+  // Vertex of a corner, staging it when the corner is the first to need it
+  auto vertexOf = [&](const ObjAttributes& attrib, const tinyobj::index_t& idx) {
+    // Indices past the attributes read so far count as missing, like -1
+    const int normal = static_cast<size_t>(idx.normal_index) < attrib.numNormals ? idx.normal_index : -1;
+    const int texcoord = static_cast<size_t>(idx.texcoord_index) < attrib.numTexcoords ? idx.texcoord_index : -1;
+    const uint64_t pair = (static_cast<uint64_t>(normal + 2) << 32) | static_cast<uint64_t>(texcoord + 2);
+    uint64_t& taken = pairs[idx.vertex_index];
+    if (taken == pair)
+      return static_cast<unsigned int>(idx.vertex_index);
+    size_t target = idx.vertex_index;
+    if (taken == 0)
+      taken = pair;
+    else
+      target = appended++;
+
+    static const float defaultNormal[3] = {0.0f, 0.0f, 1.0f};
+    static const float defaultUV[2] = {0.0f, 0.0f};
+    const float* position = &attrib.vertices[3 * idx.vertex_index];
+    lower = glm::min(lower, glm::vec3(position[0], position[1], position[2]));
+    upper = glm::max(upper, glm::vec3(position[0], position[1], position[2]));
+    packed.resize(packed.size() + stride);
+    packVertex(streamLayout, lower, upper, position, normal >= 0 ? &attrib.normals[3 * normal] : defaultNormal,
+	       texcoord >= 0 ? &attrib.texcoords[2 * texcoord] : defaultUV, nullptr, &packed[packed.size() - stride]);
+    targets.push_back(static_cast<uint32_t>(target));
+    return static_cast<unsigned int>(target);
+  };
+
+  auto sink = [&](const ObjAttributes& attrib, const std::vector<tinyobj::index_t>& corners,
+		  const std::vector<int>&) {
+    for (size_t t = 0; t + 2 < corners.size(); t += 3) {
+      // Triangles with a position that is not there (yet) are not drawn
+      if (static_cast<size_t>(corners[t].vertex_index) >= attrib.numVertices ||
+	  static_cast<size_t>(corners[t + 1].vertex_index) >= attrib.numVertices ||
+	  static_cast<size_t>(corners[t + 2].vertex_index) >= attrib.numVertices) {
+	dropped++;
+	continue;
       }
-      index_offset += fv;
+      for (size_t k = 0; k < 3; k++)
+	indices.push_back(vertexOf(attrib, corners[t + k]));
+      if (indices.size() + 3 > batchCorners)
+	flush();
     }
+  };
+
+  std::string warn, err;
+  bool loaded = streamObj(stats, &m_materials, &warn, &err, path, mtlBaseDir,
+			  windowSize, options.loaderThreads, sink);
+  if (!loaded) {
+    if (!err.empty())
+      std::cerr << "TinyObjReader: " << err;
+    throw std::runtime_error("Failed to Load Object");
   }
-  numIndices = indices.size();
-  std::cout << "Loaded: " << vertices.size()/3 << " vertices, " << normals.size()/3 << " normals\n";
-  
+  if (!warn.empty())
+    std::cout << "TinyObjReader: " << warn;
+  if (dropped > 0)
+    std::cout << "Dropped " << dropped << " triangles whose positions are missing\n";
+  flush();
+
+  numVertices = appended;
+  numIndices = uploaded;
+  // Shapes and material ids are not kept while streaming, so everything is
+  // one submesh with the default material and a single level
+  lods.assign(1, MeshLod{0, static_cast<uint32_t>(uploaded), 0.0f});
+  if (uploaded > 0) {
+    boundsMin = lower;
+    boundsMax = upper;
+  }
+  Submesh whole = {};
+  whole.material = -1;
+  whole.lodCount = 1;
+  for (int axis = 0; axis < 3; axis++) {
+    whole.boundsMin[axis] = boundsMin[axis];
+    whole.boundsMax[axis] = boundsMax[axis];
+    whole.center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+  }
+  whole.radius = glm::length(boundsMax - boundsMin) * 0.5f;
+  submeshes.assign(1, whole);
+  drawOrder.assign(1, 0);
+  shapeNames.assign(1, std::string());
+  shapeVisible.assign(1, 1);
+  std::cout << "Streamed: " << uploaded / 3 << " triangles, " << appended - stats.numVertices
+	    << " vertices besides the " << stats.numVertices << " positions, in batches of "
+	    << batchCorners << " corners (" << batchCorners * cornerBytes << " bytes staging)\n";
+}
+
+void SceneObject::upload(const MeshView& mesh) {
+  numVertices = mesh.numVertices;
+  numIndices = mesh.numIndices;
+  points = mesh.points;
+  meshlets.assign(mesh.meshlets, mesh.meshlets + mesh.numMeshlets);
+  lods.assign(mesh.lods, mesh.lods + mesh.numLods);
+  submeshes.assign(mesh.submeshes, mesh.submeshes + mesh.numSubmeshes);
+  drawOrder.resize(submeshes.size());
+  for (size_t i = 0; i < drawOrder.size(); i++)
+    drawOrder[i] = static_cast<uint32_t>(i);
+  std::stable_sort(drawOrder.begin(), drawOrder.end(), [this](uint32_t a, uint32_t b) {
+    return submeshes[a].material < submeshes[b].material;
+  });
+  uint32_t numShapes = 0;
+  for (const Submesh& submesh : submeshes)
+    numShapes = std::max(numShapes, submesh.shape + 1);
+  shapeNames.resize(std::max<size_t>(shapeNames.size(), numShapes));
+  shapeVisible.assign(shapeNames.size(), 1);
+  boundsMin = mesh.boundsMin;
+  boundsMax = mesh.boundsMax;
+
   // Generate and bind VAO
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
 
-  // Generate and bind Vertex buffer
+  // One interleaved buffer holds every attribute the mesh has
+  layout = mesh.layout;
   glGenBuffers(1, &vertexBuffer);
   glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-  glEnableVertexAttribArray(0);
-  
-  // Generate and bind Normal buffer
-  glGenBuffers(1, &normalBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-  glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), normals.data(), GL_STATIC_DRAW);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-  glEnableVertexAttribArray(1);
+  glBufferData(GL_ARRAY_BUFFER, mesh.numVertices * layout.stride, mesh.vertexData, GL_STATIC_DRAW);
+  setVertexAttributes(layout);
 
   // Generate and bind Element buffer
   glGenBuffers(1, &elementBuffer);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.numIndices * sizeof(unsigned int), mesh.indices, GL_STATIC_DRAW);
 
-  std::cout << "Vertex buffer size: " << vertices.size() * sizeof(float) << " bytes\n";
-  std::cout << "Normal buffer size: " << normals.size() * sizeof(float) << " bytes\n";
+  std::cout << "Vertex buffer size: " << mesh.numVertices * layout.stride << " bytes ("
+	    << layout.stride << " bytes per vertex)\n";
   std::cout << "Index count: " << numIndices << "\n";
 }
 
-void SceneObject::loadTexture(std::string &filename){
-  int width, height, channels;
-    unsigned char* image = stbi_load(filename.c_str(), &width, &height, &channels, STBI_rgb_alpha);
-    
-    if (!image) {
-        std::cerr << "Failed to load texture: " << filename << std::endl;
-        return;
+size_t SceneObject::uploadSlice(const MeshView& mesh, size_t offset, size_t maxBytes) {
+  // Vertices and indices are copied as if they were one stream
+  struct Section { GLenum target; GLuint buffer; const void* data; size_t size; };
+  const Section sections[] = {
+    {GL_ARRAY_BUFFER, vertexBuffer, mesh.vertexData, mesh.numVertices * mesh.layout.stride},
+    {GL_ELEMENT_ARRAY_BUFFER, elementBuffer, mesh.indices, mesh.numIndices * sizeof(unsigned int)},
+  };
+
+  // Leave the element buffer binding of the VAO alone
+  glBindVertexArray(0);
+  size_t sectionStart = 0;
+  for (const auto& section : sections) {
+    const size_t sectionEnd = sectionStart + section.size;
+    if (offset < sectionEnd && maxBytes > 0) {
+      const size_t begin = offset - sectionStart;
+      const size_t bytes = std::min(maxBytes, section.size - begin);
+      glBindBuffer(section.target, section.buffer);
+      glBufferSubData(section.target, begin, bytes, static_cast<const char*>(section.data) + begin);
+      offset += bytes;
+      maxBytes -= bytes;
+    }
+    sectionStart = sectionEnd;
+  }
+  return offset;
+}
+
+size_t SceneObject::uploadSize(const MeshView& mesh) {
+  return mesh.numVertices * mesh.layout.stride + mesh.numIndices * sizeof(unsigned int);
+}
+
+void SceneObject::copyBuffers(const SceneObject& other) {
+  const size_t vertexBytes = std::min(numVertices * layout.stride, other.numVertices * other.layout.stride);
+  const size_t indexBytes = std::min(numIndices, other.numIndices) * sizeof(unsigned int);
+  glBindVertexArray(0);
+  glBindBuffer(GL_COPY_READ_BUFFER, other.vertexBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+  if (vertexBytes > 0)
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertexBytes);
+  glBindBuffer(GL_COPY_READ_BUFFER, other.elementBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, elementBuffer);
+  if (indexBytes > 0)
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, indexBytes);
+}
+
+void SceneObject::release() {
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &vertexBuffer);
+  glDeleteBuffers(1, &elementBuffer);
+}
+
+size_t SceneObject::setShapeVisible(const std::string& name, bool visible) {
+  size_t matched = 0;
+  for (size_t shape = 0; shape < shapeNames.size(); shape++)
+    if (shapeNames[shape] == name) {
+      shapeVisible[shape] = visible;
+      matched++;
     }
-    
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    stbi_image_free(image);  
+  return matched;
 }
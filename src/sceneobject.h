@@ -5,27 +5,70 @@
 #include <glm/glm.hpp>
 
 #include "common/tiny_obj_loader.h"
+#include "meshdata.h"
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 struct SceneObject {
-  GLuint vao;
-  GLuint vertexBuffer;
-  GLuint normalBuffer;
-  GLuint elementBuffer;
-  GLuint textureID;
+  GLuint vao = 0;
+  GLuint vertexBuffer = 0;  // interleaved, see layout
+  GLuint elementBuffer = 0;
+  size_t numVertices = 0;
   size_t numIndices;
+  bool points = false;  // drawn with glDrawArrays, lods count vertices
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+  VertexLayout layout;
+  // Culled per frame; empty for streamed meshes, which are drawn whole
+  std::vector<Meshlet> meshlets;
+  // Index ranges of the levels of detail of every submesh, level 0 first
+  std::vector<MeshLod> lods;
+  // Index ranges of one shape and material, sorted by shape; each owns a
+  // run of meshlets and of lods
+  std::vector<Submesh> submeshes;
+  // Indices into submeshes sorted by material, the order they are drawn in
+  std::vector<uint32_t> drawOrder;
+  // Names of the OBJ shapes and whether each is drawn, by Submesh::shape
+  std::vector<std::string> shapeNames;
+  std::vector<char> shapeVisible;
   
   glm::mat4 modelMatrix;
   tinyobj::material_t material;
   
   std::vector<tinyobj::material_t> m_materials;
-  std::map<std::string, GLuint> m_textures;
+  // Directory the texture names of m_materials are relative to, and the
+  // TexturePool handle of the diffuse texture of every material, -1 for none
+  std::string textureDir;
+  std::vector<int> diffuseTextures;
 
-  void loadModel(std::string &path);
-  void loadTexture(std::string &path);
-  void loadObject(std::string& path, std::string& mtlPath);
+  // File the object was loaded from and the chunk hashes of its buffers as
+  // uploaded, empty when unknown; a reload only copies chunks that differ
+  std::string path;
+  std::vector<uint64_t> vertexChunkHashes;
+  std::vector<uint64_t> indexChunkHashes;
+
+  void loadModel(std::string &path, const LoadOptions& options);
+  void loadModelStreaming(std::string &path, const LoadOptions& options);
+  // Creates the buffers and fills them when the mesh pointers are set
+  void upload(const MeshView& mesh);
+  // Copies up to maxBytes of the mesh, starting at byte offset of its vertex
+  // stream and indices laid end to end, into buffers created by upload(). Returns the
+  // new offset, which reaches uploadSize() when everything is copied.
+  size_t uploadSlice(const MeshView& mesh, size_t offset, size_t maxBytes);
+  static size_t uploadSize(const MeshView& mesh);
+  // Copies the first bytes of the vertex and element buffers of other, as
+  // far as both are large enough, on the GPU
+  void copyBuffers(const SceneObject& other);
+  // Deletes the vertex array and buffers
+  void release();
+  // Shows or hides every shape with this name; returns how many there are
+  size_t setShapeVisible(const std::string& name, bool visible);
+  void loadObject(std::string& path, std::string& mtlPath, const LoadOptions& options);
+  // Binary glTF and PLY, chosen by loadObject for .glb and .ply files
+  void loadMapped(std::string& path, const LoadOptions& options);
 };
 
 
@@ -0,0 +1,127 @@
+#include "scenepack.h"
+#include "meshcache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+  const char packMagic[8] = {'S', 'R', 'P', 'A', 'C', 'K', '\0', '\0'};
+  const uint32_t packVersion = 1;
+
+  struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t numMeshes;
+    uint64_t entryOffset;
+  };
+
+  struct PackEntry {
+    uint64_t offset;  // of the mesh section, from the start of the file
+    uint64_t size;
+    uint64_t nameOffset;
+    uint64_t nameLength;
+  };
+
+  uint64_t alignUp(uint64_t offset) { return (offset + 15) & ~uint64_t(15); }
+
+  void pad(std::ostream& out, uint64_t offset) {
+    static const char padding[16] = {};
+    out.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(out.tellp())));
+  }
+}
+
+bool isScenePack(const std::string& path) {
+  return std::filesystem::path(path).extension() == ".srpack";
+}
+
+std::vector<std::unique_ptr<LoadedMesh>> loadScenePack(const std::string& path) {
+  auto file = std::make_shared<MappedFile>();
+  if (!file->open(path))
+    throw std::runtime_error("Failed to open scene pack " + path);
+
+  PackHeader header;
+  if (file->size() < sizeof(PackHeader))
+    throw std::runtime_error("Not a scene pack: " + path);
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (std::memcmp(header.magic, packMagic, sizeof(packMagic)) != 0 ||
+      header.version != packVersion || header.headerSize != sizeof(PackHeader) ||
+      header.entryOffset + header.numMeshes * sizeof(PackEntry) > file->size())
+    throw std::runtime_error("Not a scene pack or an unsupported version: " + path);
+
+  std::vector<std::unique_ptr<LoadedMesh>> meshes;
+  for (uint64_t i = 0; i < header.numMeshes; i++) {
+    PackEntry entry;
+    std::memcpy(&entry, file->data() + header.entryOffset + i * sizeof(PackEntry), sizeof(entry));
+    if (entry.offset + entry.size > file->size() || entry.offset % 16 != 0 ||
+	entry.nameOffset + entry.nameLength > file->size())
+      throw std::runtime_error("Corrupt scene pack " + path);
+
+    std::unique_ptr<LoadedMesh> mesh(new LoadedMesh());
+    mesh->path = std::string(file->data() + entry.nameOffset, entry.nameLength);
+    mesh->pack = file;
+    // assetc rebases texture names onto the pack
+    mesh->textureDir = std::filesystem::path(path).parent_path().string();
+    if (!readMeshBlob(file->data() + entry.offset, entry.size, mesh->view, mesh->materials,
+		      mesh->shapeNames))
+      throw std::runtime_error("Corrupt mesh " + mesh->path + " in scene pack " + path);
+    meshes.push_back(std::move(mesh));
+  }
+  return meshes;
+}
+
+bool writeScenePack(const std::string& path, const std::vector<const LoadedMesh*>& meshes,
+		    const LoadOptions& options) {
+  PackHeader header = {};
+  std::memcpy(header.magic, packMagic, sizeof(packMagic));
+  header.version = packVersion;
+  header.headerSize = sizeof(PackHeader);
+  header.numMeshes = meshes.size();
+  header.entryOffset = sizeof(PackHeader);
+  std::vector<PackEntry> entries(meshes.size());
+
+  // Same as the mesh cache: a reader never maps a half written pack
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    // The entries are filled in once the section sizes are known
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()),
+	      static_cast<std::streamsize>(entries.size() * sizeof(PackEntry)));
+    for (size_t i = 0; i < meshes.size(); i++) {
+      entries[i].nameOffset = static_cast<uint64_t>(out.tellp());
+      entries[i].nameLength = meshes[i]->path.size();
+      out.write(meshes[i]->path.data(), static_cast<std::streamsize>(meshes[i]->path.size()));
+    }
+    bool written = true;
+    for (size_t i = 0; i < meshes.size() && written; i++) {
+      entries[i].offset = alignUp(static_cast<uint64_t>(out.tellp()));
+      pad(out, entries[i].offset);
+      written = writeMeshBlob(out, meshes[i]->path, options, meshes[i]->view, meshes[i]->materials,
+			      meshes[i]->shapeNames, meshes[i]->materialLibraries);
+      entries[i].size = static_cast<uint64_t>(out.tellp()) - entries[i].offset;
+    }
+    out.seekp(static_cast<std::streamoff>(header.entryOffset));
+    out.write(reinterpret_cast<const char*>(entries.data()),
+	      static_cast<std::streamsize>(entries.size() * sizeof(PackEntry)));
+    if (!written || !out) {
+      out.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tmpPath, path, error);
+  if (error) {
+    std::remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
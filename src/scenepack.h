@@ -0,0 +1,29 @@
+#ifndef SCENE_PACK_H
+#define SCENE_PACK_H
+
+#include "meshbuilder.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Scene pack (.srpack): several meshes compiled offline by
+// SmallRendererAssetc into one file that is mapped and uploaded as it is.
+// A header and a table of entries are followed by the mesh names and one
+// section per mesh in the mesh cache layout (vertex stream, indices,
+// meshlets, levels of detail, submeshes, materials, shape names), each
+// starting on a 16 byte boundary. Texture names in the materials are
+// relative to the directory of the pack.
+
+bool isScenePack(const std::string& path);
+
+// Maps the pack and returns one mesh per entry, all sharing the mapping.
+// Throws std::runtime_error when the file is missing or not a valid pack.
+std::vector<std::unique_ptr<LoadedMesh>> loadScenePack(const std::string& path);
+
+// Writes the meshes, which need their view set, into a pack at path.
+// options are recorded with every mesh. Returns false on a write error.
+bool writeScenePack(const std::string& path, const std::vector<const LoadedMesh*>& meshes,
+		    const LoadOptions& options);
+
+#endif
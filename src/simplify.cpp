@@ -0,0 +1,310 @@
+#include "simplify.h"
+#include "meshopt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+  // Symmetric 4x4 matrix summing squared distances to planes, weighted by
+  // the area of the triangles they came from
+  struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+
+    void addPlane(double x, double y, double z, double w, double area) {
+      a00 += area * x * x; a01 += area * x * y; a02 += area * x * z; a03 += area * x * w;
+      a11 += area * y * y; a12 += area * y * z; a13 += area * y * w;
+      a22 += area * z * z; a23 += area * z * w;
+      a33 += area * w * w;
+      weight += area;
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+      a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+      a11 += q.a11; a12 += q.a12; a13 += q.a13;
+      a22 += q.a22; a23 += q.a23;
+      a33 += q.a33;
+      weight += q.weight;
+      return *this;
+    }
+
+    // Mean squared distance of p to the planes
+    double evaluate(const glm::vec3& p) const {
+      const double x = p.x, y = p.y, z = p.z;
+      double sum = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+	+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+	+ a22 * z * z + 2 * a23 * z
+	+ a33;
+      return weight > 0 ? std::max(0.0, sum / weight) : 0.0;
+    }
+  };
+
+  struct PositionHash {
+    size_t operator()(const glm::vec3& p) const {
+      uint32_t bits[3];
+      std::memcpy(bits, &p.x, sizeof(bits));
+      return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+  };
+
+  struct PositionEqual {
+    bool operator()(const glm::vec3& a, const glm::vec3& b) const {
+      return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+  };
+
+  struct Collapse {
+    unsigned from;      // position being removed
+    unsigned to;        // position it moves onto
+    unsigned toVertex;  // vertex of `to` that replaces the vertex of `from`
+    double cost;
+  };
+
+  glm::vec3 triangleNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    return glm::cross(b - a, c - a);
+  }
+}
+
+std::vector<SimplifiedLevel> simplifyLevels(const std::vector<unsigned int>& indices,
+					    const std::vector<float>& positions,
+					    const std::vector<size_t>& targetIndexCounts) {
+  std::vector<SimplifiedLevel> levels;
+  const size_t numVertices = positions.size() / 3;
+  if (indices.empty() || numVertices == 0)
+    return levels;
+
+  // Vertices that only differ in normal or uv share one position. The
+  // simplification works on positions; vertices are rewritten along.
+  std::vector<unsigned> positionOf(numVertices);
+  std::vector<glm::vec3> points;
+  std::vector<unsigned> vertexOf;       // a vertex at each position
+  std::vector<unsigned> vertexCount;    // vertices at each position
+  {
+    std::unordered_map<glm::vec3, unsigned, PositionHash, PositionEqual> lookup;
+    for (size_t v = 0; v < numVertices; v++) {
+      glm::vec3 p(positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]);
+      auto inserted = lookup.emplace(p, static_cast<unsigned>(points.size()));
+      if (inserted.second) {
+	points.push_back(p);
+	vertexOf.push_back(static_cast<unsigned>(v));
+	vertexCount.push_back(0);
+      }
+      positionOf[v] = inserted.first->second;
+      vertexCount[inserted.first->second]++;
+    }
+  }
+  const size_t numPoints = points.size();
+
+  // Work in a unit box so the quadrics stay well conditioned
+  glm::vec3 lower = points[0], upper = points[0];
+  for (const glm::vec3& p : points) {
+    lower = glm::min(lower, p);
+    upper = glm::max(upper, p);
+  }
+  const glm::vec3 extent = upper - lower;
+  const float scale = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-20f));
+  for (glm::vec3& p : points)
+    p = (p - lower) * (1.0f / scale);
+
+  // Seams and open or non-manifold edges stay where they are
+  std::vector<bool> locked(numPoints, false);
+  for (size_t p = 0; p < numPoints; p++)
+    locked[p] = vertexCount[p] > 1;
+  {
+    std::unordered_map<uint64_t, unsigned> edgeUse;
+    for (size_t i = 0; i < indices.size(); i += 3)
+      for (int k = 0; k < 3; k++) {
+	uint64_t a = positionOf[indices[i + k]], b = positionOf[indices[i + (k + 1) % 3]];
+	if (a != b)
+	  edgeUse[std::min(a, b) << 32 | std::max(a, b)]++;
+      }
+    for (const auto& edge : edgeUse)
+      if (edge.second != 2) {
+	locked[edge.first >> 32] = true;
+	locked[edge.first & 0xffffffffu] = true;
+      }
+  }
+
+  std::vector<Quadric> quadrics(numPoints);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const glm::vec3& a = points[positionOf[indices[i]]];
+    glm::vec3 n = triangleNormal(a, points[positionOf[indices[i + 1]]], points[positionOf[indices[i + 2]]]);
+    float length = glm::length(n);
+    if (length == 0.0f)
+      continue;
+    n = n / length;
+    Quadric q;
+    q.addPlane(n.x, n.y, n.z, -glm::dot(n, a), 0.5 * length);
+    for (int k = 0; k < 3; k++)
+      quadrics[positionOf[indices[i + k]]] += q;
+  }
+
+  std::vector<unsigned int> current = indices;
+  std::vector<unsigned int> remap(numVertices);
+  std::vector<size_t> offsets(numPoints + 1);
+  std::vector<unsigned> adjacency;
+  std::vector<Collapse> candidates;
+  std::vector<bool> touched(numPoints);
+  double maxCost = 0.0;
+
+  for (size_t target : targetIndexCounts) {
+    while (current.size() > target) {
+      const size_t numTriangles = current.size() / 3;
+
+      // Triangles around every position
+      std::fill(offsets.begin(), offsets.end(), 0);
+      for (unsigned int v : current)
+	offsets[positionOf[v] + 1]++;
+      for (size_t p = 0; p < numPoints; p++)
+	offsets[p + 1] += offsets[p];
+      adjacency.resize(current.size());
+      {
+	std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < current.size(); i++)
+	  adjacency[fill[positionOf[current[i]]]++] = static_cast<unsigned>(i / 3);
+      }
+
+      // Cheapest collapse of every free position along one of its edges
+      const double none = std::numeric_limits<double>::max();
+      std::vector<Collapse> best(numPoints, Collapse{0, 0, 0, none});
+      for (size_t i = 0; i < current.size(); i += 3)
+	for (int k = 0; k < 3; k++)
+	  for (int d = 1; d <= 2; d++) {
+	    unsigned from = positionOf[current[i + k]];
+	    unsigned toVertex = current[i + (k + d) % 3];
+	    unsigned to = positionOf[toVertex];
+	    if (from == to || locked[from])
+	      continue;
+	    Quadric q = quadrics[from];
+	    q += quadrics[to];
+	    double cost = q.evaluate(points[to]);
+	    if (cost < best[from].cost)
+	      best[from] = Collapse{from, to, toVertex, cost};
+	  }
+      candidates.clear();
+      for (const Collapse& c : best)
+	if (c.cost != none)
+	  candidates.push_back(c);
+      std::sort(candidates.begin(), candidates.end(),
+		[](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+      // Every collapse removes about two triangles; collapses in one pass
+      // must not share triangles, so the adjacency above stays valid
+      const size_t allowed = (numTriangles - target / 3) / 2 + 1;
+      std::fill(touched.begin(), touched.end(), false);
+      for (size_t v = 0; v < numVertices; v++)
+	remap[v] = static_cast<unsigned int>(v);
+      size_t collapsed = 0;
+      for (const Collapse& c : candidates) {
+	if (collapsed >= allowed)
+	  break;
+	if (touched[c.from] || touched[c.to])
+	  continue;
+
+	// Reject collapses that flip a triangle
+	bool flips = false;
+	for (size_t j = offsets[c.from]; j < offsets[c.from + 1] && !flips; j++) {
+	  const unsigned int* tri = &current[3 * adjacency[j]];
+	  unsigned p[3] = {positionOf[tri[0]], positionOf[tri[1]], positionOf[tri[2]]};
+	  if (p[0] == c.to || p[1] == c.to || p[2] == c.to)
+	    continue;
+	  glm::vec3 before = triangleNormal(points[p[0]], points[p[1]], points[p[2]]);
+	  glm::vec3 moved[3];
+	  for (int k = 0; k < 3; k++)
+	    moved[k] = points[p[k] == c.from ? c.to : p[k]];
+	  glm::vec3 after = triangleNormal(moved[0], moved[1], moved[2]);
+	  flips = glm::dot(before, after) <= 0.0f;
+	}
+	if (flips)
+	  continue;
+
+	remap[vertexOf[c.from]] = c.toVertex;
+	quadrics[c.to] += quadrics[c.from];
+	maxCost = std::max(maxCost, c.cost);
+	for (size_t j = offsets[c.from]; j < offsets[c.from + 1]; j++)
+	  for (int k = 0; k < 3; k++)
+	    touched[positionOf[current[3 * adjacency[j] + k]]] = true;
+	collapsed++;
+      }
+      if (collapsed == 0)
+	break;
+
+      // Rewrite the triangles and drop the ones that became degenerate
+      size_t write = 0;
+      for (size_t i = 0; i < current.size(); i += 3) {
+	unsigned int a = remap[current[i]], b = remap[current[i + 1]], c = remap[current[i + 2]];
+	if (positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[a] == positionOf[c])
+	  continue;
+	current[write++] = a;
+	current[write++] = b;
+	current[write++] = c;
+      }
+      current.resize(write);
+    }
+
+    // Stuck: the remaining targets would only repeat this level
+    if (!levels.empty() && current.size() >= levels.back().indices.size())
+      break;
+    SimplifiedLevel level;
+    level.indices = current;
+    level.error = static_cast<float>(std::sqrt(maxCost)) * scale;
+    levels.push_back(std::move(level));
+    if (current.size() > target)
+      break;
+  }
+  return levels;
+}
+
+void buildLods(MeshData& mesh) {
+  // Coarser levels than this are not worth a draw call of their own
+  const size_t minTriangles = 256;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<unsigned int> localOf(mesh.vertices.size() / 3, ~0u);
+  LocalRange range;
+  std::vector<MeshLod> lods;
+  size_t numLevels = 0;
+  size_t coarsest = 0;
+  for (Submesh& submesh : mesh.submeshes) {
+    // Level 0 of every submesh stays where groupTriangles put it
+    const MeshLod full = mesh.lods[submesh.firstLod];
+    submesh.firstLod = static_cast<uint32_t>(lods.size());
+    lods.push_back(full);
+
+    std::vector<size_t> targets;
+    for (size_t triangles = full.indexCount / 3 / 2; triangles >= minTriangles; triangles /= 2)
+      targets.push_back(3 * triangles);
+    if (!targets.empty()) {
+      // Simplified on the submesh's own vertices; a seam with another
+      // submesh is an open border here and stays locked
+      localizeRange(mesh.indices.data() + full.firstIndex, full.indexCount, mesh.vertices, localOf, range);
+      std::vector<SimplifiedLevel> levels = simplifyLevels(range.indices, range.positions, targets);
+      for (SimplifiedLevel& level : levels) {
+	// Keep a level only if it saves at least a tenth of the previous one
+	if (level.indices.size() * 10 > lods.back().indexCount * 9)
+	  continue;
+	optimizeVertexCache(level.indices, range.vertices.size());
+	lods.push_back(MeshLod{static_cast<uint32_t>(mesh.indices.size()),
+			       static_cast<uint32_t>(level.indices.size()), level.error});
+	mesh.indices.resize(mesh.indices.size() + level.indices.size());
+	globalizeIndices(range, level.indices, mesh.indices.data() + mesh.indices.size() - level.indices.size());
+      }
+    }
+    submesh.lodCount = static_cast<uint32_t>(lods.size() - submesh.firstLod);
+    numLevels += submesh.lodCount - 1;
+    coarsest += lods.back().indexCount / 3;
+  }
+  mesh.lods = std::move(lods);
+  auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+  std::cout << "Built " << numLevels << " LODs for " << mesh.submeshes.size() << " submeshes in "
+	    << time.count() << " ms, " << coarsest << " triangles at the coarsest levels\n";
+}
@@ -0,0 +1,30 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "meshdata.h"
+
+#include <vector>
+
+// One level of detail produced by simplifyLevels
+struct SimplifiedLevel {
+  std::vector<unsigned int> indices;
+  float error = 0.0f;  // geometric error in model units
+};
+
+// Quadric error edge collapse simplification. Vertices are only removed, never
+// moved, so every level indexes the original vertex buffer. Vertices on open
+// borders and on attribute seams (several vertices sharing a position) are
+// kept, so a level may stop short of its target; the result then ends at the
+// last level that made progress. targetIndexCounts must be decreasing, the
+// levels are taken from one continuous run, so each level's error includes
+// the collapses of the ones before it.
+std::vector<SimplifiedLevel> simplifyLevels(const std::vector<unsigned int>& indices,
+					    const std::vector<float>& positions,
+					    const std::vector<size_t>& targetIndexCounts);
+
+// Appends LODs at 50%, 25%, ... of the triangles of every submesh to the index
+// buffer and records all levels, including the full submesh, in mesh.lods.
+// Works on the unpacked float arrays.
+void buildLods(MeshData& mesh);
+
+#endif
@@ -1,19 +1,25 @@
 #include "smallrender.h"
+#include "meshbuilder.h"
+#include "bufferdiff.h"
+#include "scenepack.h"
 
 #include "common/shader.hpp"
 #include "glfw3.h"
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <stdexcept>
 
 void SmallRenderer::init(std::string& model, std::string mtl){
   initWindow();
-  loadScene(model);
   initShader();
-  
+  loadScene(model);
+
 }
 
 void SmallRenderer::initWindow(){
@@ -55,11 +61,215 @@ void SmallRenderer::initWindow(){
   glDepthFunc(GL_LESS);
 }
 void SmallRenderer::loadScene(std::string &path) {
+  // Streaming loads upload while they parse, so they have to stay on the GL
+  // thread. Scene packs and .glb files are never streamed, they hold
+  // finished buffers.
+  const bool pack = isScenePack(path);
+  // A scene pack is compiled output; its sources are what gets edited
+  WatchedFile* watched = nullptr;
+  if (m_watchFiles && !pack && !findWatchedFile(path)) {
+    m_watchedFiles.push_back({std::unique_ptr<FileWatcher>(new FileWatcher(path)), false, false, false});
+    watched = &m_watchedFiles.back();
+    std::cout << "Watching " << path << " for changes\n";
+  }
+  if (m_loadOptions.asyncLoading && (pack || isMappedFormat(path) || m_loadOptions.streamBudget == 0)) {
+    if (watched)
+      watched->reloading = true;
+    m_assetLoader.load(path, m_loadOptions, watched != nullptr);
+    return;
+  }
+  if (pack) {
+    for (auto& mesh : loadScenePack(path)) {
+      SceneObject object;
+      object.m_materials = std::move(mesh->materials);
+      object.shapeNames = std::move(mesh->shapeNames);
+      object.textureDir = std::move(mesh->textureDir);
+      object.upload(mesh->view);
+      addSceneObject(object);
+    }
+    return;
+  }
+  if (watched)
+    watched->streamed = m_loadOptions.streamBudget > 0;
   std::string mtl = "./";
   SceneObject object;
-  object.loadObject(path, mtl);
-  m_sceneObjects.emplace_back(object);
+  object.loadObject(path, mtl, m_loadOptions);
+  object.path = path;
+  addSceneObject(object);
+}
+
+// Objects join the scene with the shapes hidden so far already hidden
+void SmallRenderer::addSceneObject(SceneObject& object) {
+  for (const std::string& name : m_hiddenShapes)
+    object.setShapeVisible(name, false);
+  requestTextures(object);
+  m_sceneObjects.push_back(object);
+}
+
+// Texture names are resolved against the object's directory; the pool
+// loads each file once however many materials name it
+void SmallRenderer::requestTextures(SceneObject& object) {
+  object.diffuseTextures.assign(object.m_materials.size(), -1);
+  for (size_t m = 0; m < object.m_materials.size(); m++) {
+    const std::string& name = object.m_materials[m].diffuse_texname;
+    if (!name.empty())
+      object.diffuseTextures[m] = m_texturePool.request((std::filesystem::path(object.textureDir) / name).string());
+  }
 }
+
+void SmallRenderer::setShapeVisible(const std::string& name, bool visible) {
+  auto hidden = std::find(m_hiddenShapes.begin(), m_hiddenShapes.end(), name);
+  if (!visible && hidden == m_hiddenShapes.end())
+    m_hiddenShapes.push_back(name);
+  else if (visible && hidden != m_hiddenShapes.end())
+    m_hiddenShapes.erase(hidden);
+  for (SceneObject& object : m_sceneObjects)
+    object.setShapeVisible(name, visible);
+}
+
+/**
+ * Uploads meshes finished by the asset loader until the per-frame budget is
+ * used up. Large meshes are copied in slices over several frames and only
+ * join the scene once they are complete. A reload of a watched file starts
+ * from a GPU copy of the resident buffers, copies only the chunks whose
+ * hashes changed and then takes the place of the old object. Textures get
+ * what is left of the budget.
+ */
+void SmallRenderer::processUploads() {
+  const size_t sliceBytes = 4 << 20;
+  const double budget = m_loadOptions.uploadBudgetMs / 1000.0;
+  const double start = glfwGetTime();
+  do {
+    if (!m_uploadMesh) {
+      m_uploadMesh = m_assetLoader.pop();
+      if (!m_uploadMesh)
+	break;
+      MeshView buffers = m_uploadMesh->view;
+      buffers.vertexData = nullptr;
+      buffers.indices = nullptr;
+      m_uploadObject = SceneObject();
+      m_uploadObject.m_materials = std::move(m_uploadMesh->materials);
+      m_uploadObject.shapeNames = std::move(m_uploadMesh->shapeNames);
+      m_uploadObject.upload(buffers);
+      m_uploadObject.path = m_uploadMesh->path;
+      m_uploadObject.textureDir = std::move(m_uploadMesh->textureDir);
+      m_uploadObject.vertexChunkHashes = std::move(m_uploadMesh->vertexChunkHashes);
+      m_uploadObject.indexChunkHashes = std::move(m_uploadMesh->indexChunkHashes);
+      m_uploadOffset = 0;
+      m_uploadRange = 0;
+      m_uploadRanges.assign(1, std::make_pair(size_t(0), SceneObject::uploadSize(buffers)));
+
+      m_reloadTarget = m_sceneObjects.size();
+      if (findWatchedFile(m_uploadMesh->path))
+	for (size_t i = 0; i < m_sceneObjects.size() && m_reloadTarget == m_sceneObjects.size(); i++)
+	  if (m_sceneObjects[i].path == m_uploadMesh->path)
+	    m_reloadTarget = i;
+      if (m_reloadTarget < m_sceneObjects.size()) {
+	const SceneObject& old = m_sceneObjects[m_reloadTarget];
+	m_uploadObject.copyBuffers(old);
+	const size_t vertexBytes = buffers.numVertices * buffers.layout.stride;
+	m_uploadRanges = changedRanges(old.vertexChunkHashes, m_uploadObject.vertexChunkHashes, vertexBytes);
+	for (const auto& range : changedRanges(old.indexChunkHashes, m_uploadObject.indexChunkHashes,
+					       buffers.numIndices * sizeof(unsigned int)))
+	  m_uploadRanges.emplace_back(vertexBytes + range.first, vertexBytes + range.second);
+      }
+    }
+
+    const MeshView& mesh = m_uploadMesh->view;
+    if (m_uploadRange < m_uploadRanges.size()) {
+      const auto& range = m_uploadRanges[m_uploadRange];
+      const size_t begin = std::max(m_uploadOffset, range.first);
+      m_uploadOffset = m_uploadObject.uploadSlice(mesh, begin, std::min(sliceBytes, range.second - begin));
+      if (m_uploadOffset >= range.second)
+	m_uploadRange++;
+    }
+    if (m_uploadRange >= m_uploadRanges.size()) {
+      if (WatchedFile* watched = findWatchedFile(m_uploadMesh->path))
+	watched->reloading = false;
+      if (m_reloadTarget < m_sceneObjects.size()) {
+	size_t copied = 0;
+	for (const auto& range : m_uploadRanges)
+	  copied += range.second - range.first;
+	std::cout << "Reloaded " << m_uploadMesh->path << ": uploaded " << copied << " of "
+		  << SceneObject::uploadSize(mesh) << " bytes in " << m_uploadRanges.size() << " ranges\n";
+	// Swapped between two frames, so no frame draws a mix of both
+	for (const std::string& name : m_hiddenShapes)
+	  m_uploadObject.setShapeVisible(name, false);
+	requestTextures(m_uploadObject);
+	SceneObject& old = m_sceneObjects[m_reloadTarget];
+	old.release();
+	old = m_uploadObject;
+      } else {
+	std::cout << "Uploaded " << m_uploadMesh->path << " after "
+		  << glfwGetTime() << " s\n";
+	addSceneObject(m_uploadObject);
+      }
+      m_uploadMesh.reset();
+    }
+  } while (glfwGetTime() - start < budget);
+  m_texturePool.processUploads(budget - (glfwGetTime() - start));
+}
+
+/**
+ * Starts a background reload of every watched file that changed on disk.
+ * Only one load per file is in flight; a change during it triggers another
+ * reload once it is done. Streamed files are streamed again instead, since
+ * a background load holds the whole mesh in host memory.
+ */
+void SmallRenderer::checkWatchedFiles() {
+  // A load that failed never arrives, so an idle loader ends it as well
+  const bool idle = m_assetLoader.pending() == 0 && !m_uploadMesh;
+  for (WatchedFile& file : m_watchedFiles) {
+    if (file.watcher->changed())
+      file.changed = true;
+    if (idle)
+      file.reloading = false;
+    if (file.changed && !file.reloading) {
+      file.changed = false;
+      file.reloading = true;
+      std::cout << "Reloading " << file.watcher->path() << "\n";
+      if (file.streamed) {
+	reloadStreamed(file.watcher->path());
+	file.reloading = false;
+      } else {
+	m_assetLoader.load(file.watcher->path(), m_loadOptions, true);
+      }
+    }
+  }
+}
+
+// Streams the file on the GL thread like loadScene did and swaps the result
+// in for the old object, which stays when the new load fails
+void SmallRenderer::reloadStreamed(const std::string& path) {
+  SceneObject object;
+  try {
+    std::string source = path, mtl = "./";
+    object.loadObject(source, mtl, m_loadOptions);
+  } catch (const std::exception& e) {
+    object.release();
+    std::cerr << "Failed to reload " << path << ": " << e.what() << std::endl;
+    return;
+  }
+  object.path = path;
+  for (const std::string& name : m_hiddenShapes)
+    object.setShapeVisible(name, false);
+  requestTextures(object);
+  for (SceneObject& old : m_sceneObjects)
+    if (old.path == path) {
+      old.release();
+      old = object;
+      return;
+    }
+  m_sceneObjects.push_back(object);
+}
+
+SmallRenderer::WatchedFile* SmallRenderer::findWatchedFile(const std::string& path) {
+  for (WatchedFile& file : m_watchedFiles)
+    if (file.watcher->path() == path)
+      return &file;
+  return nullptr;
+}
+
 void SmallRenderer::run(){
   double lastTime = glfwGetTime();
   while(glfwGetKey(m_window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
@@ -83,7 +293,10 @@ void SmallRenderer::run(){
     if (glfwGetKey(m_window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
       m_camera.processKeyboard(GLFW_KEY_LEFT_CONTROL, deltaTime);
 
-    //Render Scene
+    // Reload changed files, upload finished background loads, then render
+    // the scene
+    checkWatchedFiles();
+    processUploads();
     render();
   }
   cleanUp();
@@ -107,18 +320,17 @@ void SmallRenderer::render() {
     GLuint lightPosID = glGetUniformLocation(m_shaderProgram, "lightPos");
     GLuint timeID = glGetUniformLocation(m_shaderProgram, "fTime");
     GLuint viewPosID = glGetUniformLocation(m_shaderProgram, "viewPos");
-    GLuint shininessID = glGetUniformLocation(m_shaderProgram, "shininess");
       
     // Set uniform values
     glUniform3f(lightPosID, 0.0f, 1.0f, 0.0f); // Light position
     glUniform3f(viewPosID, 0.0f, 0.0f, 10.0f); // Camera position
-    glUniform1f(shininessID, 32.0f); // Shininess factor
 
     // Create model, view, projection matrices
     glm::mat4 M = glm::mat4(1.0f); // Identity matrix for model
     glm::mat4 V = m_camera.getViewMatrix(); // Use camera's view matrix
+    const float fovY = glm::radians(45.0f);
     glm::mat4 P = glm::perspective(
-				   glm::radians(45.0f), // FOV
+				   fovY, // FOV
 				   (float)m_width / (float)m_height, // Aspect ratio
 				   0.1f, 100.0f // Near and far planes
 				   );
@@ -131,25 +343,134 @@ void SmallRenderer::render() {
     // glUniform4f(lightPosID, 0.0f, 1.0f, 0.0f, 1.0f);
     // glUniform1f(timeID, (float)glfwGetTime()); // Current time
 
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, obj.vertexBuffer);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, obj.normalBuffer);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    // The VAO holds the interleaved layout; these undo its quantization
+    glm::vec3 offset = positionOffset(obj.layout, obj.boundsMin);
+    glm::vec3 scale = positionScale(obj.layout, obj.boundsMin, obj.boundsMax);
+    glUniform3fv(glGetUniformLocation(m_shaderProgram, "positionOffset"), 1, &offset[0]);
+    glUniform3fv(glGetUniformLocation(m_shaderProgram, "positionScale"), 1, &scale[0]);
+    glUniform1i(glGetUniformLocation(m_shaderProgram, "octNormals"), obj.layout.octNormals());
+    // Meshes without normals read this constant instead
+    if (!obj.layout.normal.present())
+      glVertexAttrib3f(1, 0.0f, 0.0f, 1.0f);
 
-    // Bind the element buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.elementBuffer);
-  
-    glDrawElements(GL_TRIANGLES, obj.numIndices, GL_UNSIGNED_INT, 0);
-    checkGLError("glDrawElements");
+    // Submeshes are drawn sorted by material, so the material uniforms
+    // change once per material and each material is one multi-draw. Hidden
+    // shapes and submeshes outside the frustum are skipped, coarser levels
+    // are drawn whole, the meshlets only cover level 0. Point clouds use
+    // the same ranges as vertex ranges.
+    // M is the identity, so model space is world space.
+    Frustum frustum = frustumFromMatrix(P * V * M);
+    int material = -2;
+    m_drawCounts.clear();
+    m_drawOffsets.clear();
+    m_drawFirsts.clear();
+    size_t rangeEnd = ~size_t(0);
+    auto addRange = [&](size_t first, size_t count) {
+      // Neighbouring ranges are merged into one
+      if (first == rangeEnd) {
+	m_drawCounts.back() += static_cast<GLsizei>(count);
+      } else {
+	if (obj.points)
+	  m_drawFirsts.push_back(static_cast<GLint>(first));
+	else
+	  m_drawOffsets.push_back(reinterpret_cast<const void*>(first * sizeof(unsigned int)));
+	m_drawCounts.push_back(static_cast<GLsizei>(count));
+      }
+      rangeEnd = first + count;
+    };
+    auto flush = [&]() {
+      if (!m_drawCounts.empty() && obj.points) {
+	glMultiDrawArrays(GL_POINTS, m_drawFirsts.data(), m_drawCounts.data(),
+			  static_cast<GLsizei>(m_drawCounts.size()));
+	checkGLError("glMultiDrawArrays");
+      } else if (!m_drawCounts.empty()) {
+	glMultiDrawElements(GL_TRIANGLES, m_drawCounts.data(), GL_UNSIGNED_INT,
+			    m_drawOffsets.data(), static_cast<GLsizei>(m_drawCounts.size()));
+	checkGLError("glMultiDrawElements");
+      }
+      m_drawCounts.clear();
+      m_drawOffsets.clear();
+      m_drawFirsts.clear();
+      rangeEnd = ~size_t(0);
+    };
+    for (uint32_t index : obj.drawOrder) {
+      const Submesh& submesh = obj.submeshes[index];
+      if (!obj.shapeVisible[submesh.shape] ||
+	  !sphereInFrustum(frustum, submesh.center, submesh.radius) ||
+	  !boxInFrustum(frustum, submesh.boundsMin, submesh.boundsMax))
+	continue;
+      if (submesh.material != material) {
+	flush();
+	material = submesh.material;
+	setMaterial(obj, material);
+      }
+      const size_t lod = selectLod(obj, submesh, fovY);
+      if (lod > 0 || submesh.meshletCount == 0) {
+	const MeshLod& level = obj.lods[submesh.firstLod + lod];
+	addRange(level.firstIndex, level.indexCount);
+	continue;
+      }
+      // Only the meshlets that are in the frustum and not backfacing
+      for (uint32_t i = 0; i < submesh.meshletCount; i++) {
+	const Meshlet& meshlet = obj.meshlets[submesh.firstMeshlet + i];
+	if (meshletVisible(meshlet, frustum, m_camera.position))
+	  addRange(meshlet.firstIndex, meshlet.indexCount);
+      }
+    }
+    flush();
   }
   // Swap buffers
   glfwSwapBuffers(m_window);
   glfwPollEvents();
 }
 
+/**
+ * Picks the coarsest level of detail of submesh whose geometric error,
+ * projected at the distance of its bounding sphere, stays below
+ * m_lodPixelError pixels.
+ */
+size_t SmallRenderer::selectLod(const SceneObject& object, const Submesh& submesh, float fovY) const {
+  if (submesh.lodCount < 2)
+    return 0;
+  glm::vec3 center(submesh.center[0], submesh.center[1], submesh.center[2]);
+  float radius = submesh.radius;
+  // Inside the sphere counts as being at the near plane
+  float distance = std::max(glm::length(center - m_camera.position) - radius, 0.1f);
+  float pixelsPerUnit = m_height / (2.0f * std::tan(fovY * 0.5f) * distance);
+
+  size_t lod = 0;
+  for (size_t i = 1; i < submesh.lodCount; i++)
+    if (object.lods[submesh.firstLod + i].error * pixelsPerUnit <= m_lodPixelError)
+      lod = i;
+  return lod;
+}
+
+/**
+ * Sets the material uniforms and binds the diffuse texture for one of the
+ * object's materials, or the default gray for -1 and ids without a
+ * material. A texture that is still loading is left out until it arrives.
+ */
+void SmallRenderer::setMaterial(const SceneObject& object, int material) const {
+  glm::vec3 diffuse(0.75f), specular(0.75f);
+  float shininess = 32.0f;
+  GLuint texture = 0;
+  if (material >= 0 && size_t(material) < object.m_materials.size()) {
+    const tinyobj::material_t& m = object.m_materials[material];
+    diffuse = glm::vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
+    specular = glm::vec3(m.specular[0], m.specular[1], m.specular[2]);
+    if (m.shininess > 0.0f)
+      shininess = m.shininess;
+    if (size_t(material) < object.diffuseTextures.size())
+      texture = m_texturePool.texture(object.diffuseTextures[material]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glUniform1i(glGetUniformLocation(m_shaderProgram, "useDiffuseTexture"), texture != 0);
+  glUniform3fv(glGetUniformLocation(m_shaderProgram, "diffuseColor"), 1, &diffuse[0]);
+  glUniform3fv(glGetUniformLocation(m_shaderProgram, "specularColor"), 1, &specular[0]);
+  glUniform1f(glGetUniformLocation(m_shaderProgram, "shininess"), shininess);
+}
+
 void SmallRenderer::initShader(){
   m_shaderProgram = LoadShaders("shader/vertex.glsl", "shader/fragment.glsl");
   if (!m_shaderProgram) {
@@ -164,6 +485,7 @@ void SmallRenderer::initShader(){
 void SmallRenderer::cleanUp() {
   for (auto object : m_sceneObjects)
     glDeleteVertexArrays(1, &object.vao);
+  m_texturePool.release();
     
   glDeleteProgram(m_shaderProgram);
   glfwTerminate();
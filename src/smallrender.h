@@ -7,10 +7,15 @@
 
 #include "common/tiny_obj_loader.h"
 #include "sceneobject.h"
+#include "assetloader.h"
+#include "texturepool.h"
 #include "camera.h"
+#include "common/filewatcher.h"
 
+#include<memory>
 #include<vector>
 #include<string>
+#include<utility>
 
 class SmallRenderer{
 private:
@@ -29,13 +34,65 @@ private:
   glm::vec2 m_lastMousePos; // Store the last mouse position for rotation
   
   std::vector<SceneObject> m_sceneObjects;
+  // Index ranges of the visible meshlets and levels of one material,
+  // rebuilt for every draw
+  std::vector<GLsizei> m_drawCounts;
+  std::vector<const void*> m_drawOffsets;
+  std::vector<GLint> m_drawFirsts;  // of point ranges
+  LoadOptions m_loadOptions;
+  // Largest screen space error in pixels a level of detail may have
+  float m_lodPixelError;
+
+  // Background loading: meshes come out of the loader and are copied to the
+  // GPU a slice at a time, so uploads never stall a frame for long
+  AssetLoader m_assetLoader;
+  std::unique_ptr<LoadedMesh> m_uploadMesh;
+  SceneObject m_uploadObject;
+  size_t m_uploadOffset;
+  // Byte ranges of the upload still to copy, in uploadSlice offsets; all of
+  // it for new objects, the changed chunks for reloads
+  std::vector<std::pair<size_t, size_t>> m_uploadRanges;
+  size_t m_uploadRange;
+  // Index of the object m_uploadObject replaces once it is complete, or
+  // m_sceneObjects.size() for a new one
+  size_t m_reloadTarget;
+  void processUploads();
+  void addSceneObject(SceneObject& object);
+  // Textures of all objects; a file used by many materials is loaded once
+  TexturePool m_texturePool;
+  void requestTextures(SceneObject& object);
+  // Shape names hidden with setShapeVisible, applied to objects loaded later
+  std::vector<std::string> m_hiddenShapes;
+  // Files given to loadScene that are reloaded when they change on disk
+  struct WatchedFile {
+    std::unique_ptr<FileWatcher> watcher;
+    bool changed;    // waiting for the reload in flight to finish
+    bool reloading;  // a load of the file has not arrived yet
+    bool streamed;   // loaded by streaming, so reloaded that way too
+  };
+  bool m_watchFiles;
+  std::vector<WatchedFile> m_watchedFiles;
+  void checkWatchedFiles();
+  void reloadStreamed(const std::string& path);
+  WatchedFile* findWatchedFile(const std::string& path);
+  size_t selectLod(const SceneObject& object, const Submesh& submesh, float fovY) const;
+  void setMaterial(const SceneObject& object, int material) const;
   
 public:
   SmallRenderer(const int width, const int height) :
-    m_width{width}, m_height{height}, m_mouseMiddlePressed{false} {}
+    m_width{width}, m_height{height}, m_mouseMiddlePressed{false}, m_lodPixelError{1.0f}, m_uploadOffset{0},
+    m_uploadRange{0}, m_reloadTarget{0}, m_watchFiles{false} {}
   ~SmallRenderer(){cleanUp();};
   void init(std::string &model, std::string mtl);
   void loadScene(std::string& path);
+  void setLoadOptions(const LoadOptions& options) { m_loadOptions = options; }
+  // Applies to the textures requested after this
+  void setTextureOptions(const TextureOptions& options) { m_texturePool.setTextureOptions(options); }
+  void setLodPixelError(float pixels) { m_lodPixelError = pixels; }
+  // Watches the files loaded after this and reloads them when they change
+  void setWatchFiles(bool watch) { m_watchFiles = watch; }
+  // Shows or hides the OBJ shapes with this name in every object
+  void setShapeVisible(const std::string& name, bool visible);
   void run();
   void render();
   void initShader();
@@ -0,0 +1,125 @@
+#include "stlloader.h"
+#include "common/mappedfile.h"
+#include "common/parallel.h"
+#include "meshbuilder.h"
+#include "weld.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+  const size_t headerSize = 84;
+  const size_t recordSize = 50;
+
+  // Grid cell of a position with a weld tolerance, its bit pattern without
+  struct PositionKey {
+    int64_t p[3];
+
+    bool operator==(const PositionKey& o) const {
+      return p[0] == o.p[0] && p[1] == o.p[1] && p[2] == o.p[2];
+    }
+  };
+
+  struct PositionKeyHash {
+    size_t operator()(const PositionKey& k) const {
+      uint64_t h = 14695981039346656037ull;
+      for (int i = 0; i < 3; i++)
+	h = (h ^ static_cast<uint64_t>(k.p[i])) * 1099511628211ull;
+      return static_cast<size_t>(h ^ (h >> 32));
+    }
+  };
+
+  // Corners follow the face normal in the record, unaligned
+  void cornerPosition(const unsigned char* records, size_t corner, float position[3]) {
+    std::memcpy(position, records + (corner / 3) * recordSize + 12 + 12 * (corner % 3), 3 * sizeof(float));
+  }
+}
+
+bool isStl(const std::string& path) {
+  return std::filesystem::path(path).extension() == ".stl";
+}
+
+void loadStlMesh(const std::string& path, const LoadOptions& options, MeshData& mesh,
+		 std::vector<std::string>& shapeNames) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file;
+  if (!file.open(path))
+    throw std::runtime_error("Failed to open " + path);
+  uint32_t numTriangles = 0;
+  if (file.size() >= headerSize)
+    std::memcpy(&numTriangles, file.data() + 80, sizeof(numTriangles));
+  if (file.size() < headerSize || (file.size() - headerSize) / recordSize < numTriangles) {
+    // Binary headers may start with "solid" too, but only text has facets
+    const std::string start(file.data(), std::min<size_t>(file.size(), 1024));
+    if (start.compare(0, 5, "solid") == 0 && start.find("facet", 5) != std::string::npos)
+      throw std::runtime_error("ASCII STL files are not supported, only binary ones: " + path);
+    throw std::runtime_error("Invalid STL file " + path + ": truncated");
+  }
+  const size_t numCorners = 3 * size_t(numTriangles);
+  if (numCorners > static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+    throw std::runtime_error("Invalid STL file " + path + ": too many triangles");
+  const unsigned char* records = reinterpret_cast<const unsigned char*>(file.data()) + headerSize;
+  const unsigned threads = options.loaderThreads ? options.loaderThreads : defaultThreadCount();
+
+  // Welding by position only; the normals come later
+  const bool weld = options.weldTolerance > 0.0f;
+  const float invTolerance = weld ? 1.0f / options.weldTolerance : 0.0f;
+  auto keyOf = [&](size_t c) {
+    float position[3];
+    cornerPosition(records, c, position);
+    PositionKey key;
+    for (int i = 0; i < 3; i++) {
+      if (weld) {
+	key.p[i] = static_cast<int64_t>(std::floor(position[i] * invTolerance + 0.5f));
+      } else {
+	// + 0.0f turns -0 into 0
+	float value = position[i] + 0.0f;
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	key.p[i] = bits;
+      }
+    }
+    return key;
+  };
+  std::vector<uint32_t> firstCorner = findFirstOccurrences<PositionKey, PositionKeyHash>(numCorners, threads, keyOf);
+  std::vector<size_t> threadUnique;
+  const size_t numPositions = countFirstOccurrences(firstCorner, threads, threadUnique);
+
+  // One tinyobj shape of triangles for the normal and weld steps
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes(1);
+  attrib.vertices.resize(3 * numPositions);
+  tinyobj::mesh_t& shape = shapes[0].mesh;
+  shape.indices.resize(numCorners);
+  shape.num_face_vertices.assign(numTriangles, 3);
+  shape.material_ids.assign(numTriangles, -1);
+  parallelFor(numCorners, threads, [&](size_t begin, size_t end, unsigned t) {
+    size_t next = threadUnique[t];
+    for (size_t c = begin; c < end; c++) {
+      if (firstCorner[c] != c)
+	continue;
+      cornerPosition(records, c, &attrib.vertices[3 * next]);
+      shape.indices[c] = tinyobj::index_t{static_cast<int>(next), -1, -1};
+      next++;
+    }
+  });
+  parallelFor(numCorners, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t c = begin; c < end; c++)
+      if (firstCorner[c] != c)
+	shape.indices[c] = shape.indices[firstCorner[c]];
+  });
+  std::vector<uint32_t>().swap(firstCorner);
+  file.close();
+
+  auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+  std::cout << "Read " << path << " in " << time.count() << " ms: " << numTriangles << " triangles, "
+	    << numPositions << " unique positions of " << numCorners << " corners\n";
+  buildIndexedMesh(attrib, shapes, 0, options, mesh, shapeNames);
+}
@@ -0,0 +1,25 @@
+#ifndef STL_LOADER_H
+#define STL_LOADER_H
+
+#include "meshdata.h"
+
+#include <string>
+#include <vector>
+
+// Loader for binary STL files: an 80 byte header, the triangle count and one
+// 50 byte record per triangle with a face normal, three corners and an
+// attribute word. Every corner is stored on its own, so the positions are
+// welded and get smooth normals within the crease angle; the stored face
+// normals are ignored since many exporters leave them zero. Everything
+// becomes one unnamed shape without materials. ASCII files are rejected.
+
+bool isStl(const std::string& path);
+
+// Reads the records from a mapping of path, welds the corners by position
+// in parallel (within options.weldTolerance when set) and builds mesh the
+// same way loadObjMesh does. Throws std::runtime_error when the file is
+// invalid.
+void loadStlMesh(const std::string& path, const LoadOptions& options, MeshData& mesh,
+		 std::vector<std::string>& shapeNames);
+
+#endif
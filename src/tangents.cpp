@@ -0,0 +1,169 @@
+#include "tangents.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  glm::vec3 load3(const std::vector<float>& values, size_t i) {
+    return glm::vec3(values[3 * i], values[3 * i + 1], values[3 * i + 2]);
+  }
+
+  // Component of v in the plane orthogonal to the unit vector n, normalized
+  glm::vec3 projectToPlane(const glm::vec3& v, const glm::vec3& n) {
+    glm::vec3 p = v - n * glm::dot(n, v);
+    float length = glm::length(p);
+    return length > 0.0f ? p * (1.0f / length) : glm::vec3(0.0f);
+  }
+}
+
+void generateTangents(MeshData& mesh, unsigned numThreads) {
+  const size_t numVertices = mesh.vertices.size() / 3;
+  const size_t numCorners = mesh.indices.size();
+  const size_t numTriangles = numCorners / 3;
+
+  // Per corner: angle weighted tangent and bitangent in the corner's plane,
+  // and the orientation of its triangle's UV mapping
+  std::vector<glm::vec3> cornerTangents(numCorners), cornerBitangents(numCorners);
+  std::vector<signed char> orientations(numTriangles);
+  parallelFor(numTriangles, numThreads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t t = begin; t < end; t++) {
+      const unsigned int* tri = &mesh.indices[3 * t];
+      glm::vec3 p[3];
+      glm::vec2 uv[3];
+      for (int k = 0; k < 3; k++) {
+	p[k] = load3(mesh.vertices, tri[k]);
+	uv[k] = glm::vec2(mesh.uvs[2 * tri[k]], mesh.uvs[2 * tri[k] + 1]);
+      }
+      const glm::vec3 e1 = p[1] - p[0], e2 = p[2] - p[0];
+      const float du1 = uv[1].x - uv[0].x, dv1 = uv[1].y - uv[0].y;
+      const float du2 = uv[2].x - uv[0].x, dv2 = uv[2].y - uv[0].y;
+      // Only the orientation of the UV mapping matters, the vectors are
+      // normalized per corner
+      const float area = du1 * dv2 - du2 * dv1;
+      const float orientation = area > 0.0f ? 1.0f : (area < 0.0f ? -1.0f : 0.0f);
+      const glm::vec3 sDir = (e1 * dv2 - e2 * dv1) * orientation;
+      const glm::vec3 tDir = (e2 * du1 - e1 * du2) * orientation;
+      orientations[t] = static_cast<signed char>(orientation);
+
+      for (int k = 0; k < 3; k++) {
+	glm::vec3 a = p[(k + 1) % 3] - p[k], b = p[(k + 2) % 3] - p[k];
+	float la = glm::length(a), lb = glm::length(b);
+	float angle = 0.0f;
+	if (la > 0.0f && lb > 0.0f)
+	  angle = std::acos(std::min(std::max(glm::dot(a, b) / (la * lb), -1.0f), 1.0f));
+	const glm::vec3 n = load3(mesh.normals, tri[k]);
+	cornerTangents[3 * t + k] = projectToPlane(sDir, n) * angle;
+	cornerBitangents[3 * t + k] = projectToPlane(tDir, n) * angle;
+      }
+    }
+  });
+
+  // Corners around every vertex; each vertex gathers its own sums
+  std::vector<size_t> offsets(numVertices + 1, 0);
+  for (unsigned int v : mesh.indices)
+    offsets[v + 1]++;
+  for (size_t v = 0; v < numVertices; v++)
+    offsets[v + 1] += offsets[v];
+  std::vector<unsigned> around(numCorners);
+  {
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t c = 0; c < numCorners; c++)
+      around[fill[mesh.indices[c]]++] = static_cast<unsigned>(c);
+  }
+
+  // Like MikkTSpace, corners whose tangent frames conflict do not share a
+  // vertex: the corners around a vertex are grouped by the orientation of
+  // their UV mapping, so mirrored islands keep their own bitangent sign,
+  // and within it by tangent direction, so islands rotated against each
+  // other more than 90 degrees are not averaged either. The first group
+  // keeps the vertex, every other one gets a copy appended to the arrays.
+  // Corners without a UV gradient take the first group.
+  struct Frame {
+    int orientation;
+    glm::vec3 direction;  // sum of the unit corner tangents, to compare corners against
+    glm::vec3 tangent;    // sums of the weighted corner vectors
+    glm::vec3 bitangent;
+    float sign;
+  };
+  const unsigned noFrame = ~0u;
+  std::vector<glm::vec4> cornerFrames(numCorners);
+  std::vector<unsigned> frameOf(numCorners, 0);
+  std::vector<size_t> copies(numVertices + 1, 0);
+  parallelFor(numVertices, numThreads, [&](size_t begin, size_t end, unsigned) {
+    std::vector<Frame> frames;
+    for (size_t v = begin; v < end; v++) {
+      const glm::vec3 n = load3(mesh.normals, v);
+      frames.clear();
+      for (size_t j = offsets[v]; j < offsets[v + 1]; j++) {
+	const unsigned c = around[j];
+	const int orientation = orientations[c / 3];
+	const float length = glm::length(cornerTangents[c]);
+	frameOf[c] = noFrame;
+	if (orientation == 0 || length == 0.0f)
+	  continue;
+	const glm::vec3 unit = cornerTangents[c] * (1.0f / length);
+	size_t k = 0;
+	while (k < frames.size() &&
+	       (frames[k].orientation != orientation || glm::dot(unit, frames[k].direction) < 0.0f))
+	  k++;
+	if (k == frames.size())
+	  frames.push_back({orientation, glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 1.0f});
+	frames[k].direction += unit;
+	frames[k].tangent += cornerTangents[c];
+	frames[k].bitangent += cornerBitangents[c];
+	frameOf[c] = static_cast<unsigned>(k);
+      }
+      if (frames.empty())
+	frames.push_back({1, glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 1.0f});
+      for (size_t j = offsets[v]; j < offsets[v + 1]; j++) {
+	const unsigned c = around[j];
+	if (frameOf[c] == noFrame) {
+	  frameOf[c] = 0;
+	  frames[0].tangent += cornerTangents[c];
+	  frames[0].bitangent += cornerBitangents[c];
+	}
+      }
+
+      for (Frame& frame : frames) {
+	glm::vec3 t = projectToPlane(frame.tangent, n);
+	if (t.x == 0.0f && t.y == 0.0f && t.z == 0.0f) {
+	  // No usable UV gradient: any vector in the tangent plane will do
+	  glm::vec3 axis = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	  t = projectToPlane(axis, n);
+	}
+	frame.tangent = t;
+	frame.sign = glm::dot(glm::cross(n, t), frame.bitangent) < 0.0f ? -1.0f : 1.0f;
+      }
+      for (size_t j = offsets[v]; j < offsets[v + 1]; j++) {
+	const Frame& frame = frames[frameOf[around[j]]];
+	cornerFrames[around[j]] = glm::vec4(frame.tangent, frame.sign);
+      }
+      copies[v + 1] = frames.size() - 1;
+    }
+  });
+
+  for (size_t v = 0; v < numVertices; v++)
+    copies[v + 1] += copies[v];
+  const size_t total = numVertices + copies[numVertices];
+  mesh.vertices.resize(3 * total);
+  mesh.normals.resize(3 * total);
+  mesh.uvs.resize(2 * total);
+  mesh.tangents.assign(4 * total, 0.0f);
+  parallelFor(numVertices, numThreads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t v = begin; v < end; v++)
+      for (size_t j = offsets[v]; j < offsets[v + 1]; j++) {
+	const unsigned c = around[j];
+	size_t target = v;
+	if (frameOf[c] > 0) {
+	  target = numVertices + copies[v] + frameOf[c] - 1;
+	  std::copy(&mesh.vertices[3 * v], &mesh.vertices[3 * v] + 3, &mesh.vertices[3 * target]);
+	  std::copy(&mesh.normals[3 * v], &mesh.normals[3 * v] + 3, &mesh.normals[3 * target]);
+	  std::copy(&mesh.uvs[2 * v], &mesh.uvs[2 * v] + 2, &mesh.uvs[2 * target]);
+	  mesh.indices[c] = static_cast<unsigned int>(target);
+	}
+	for (int k = 0; k < 4; k++)
+	  mesh.tangents[4 * target + k] = cornerFrames[c][k];
+      }
+  });
+  mesh.hasTangents = true;
+}
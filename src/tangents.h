@@ -0,0 +1,15 @@
+#ifndef TANGENTS_H
+#define TANGENTS_H
+
+#include "meshdata.h"
+
+// Computes per vertex tangents of the welded mesh for normal mapping,
+// following MikkTSpace: the UV derivative of every triangle is projected
+// into the tangent plane of each corner's normal, normalized, and summed
+// weighted by the corner angle. w holds the sign of the bitangent. Vertices
+// shared by conflicting tangent frames (mirrored or rotated UV islands) are
+// split, appending copies to the vertex arrays and remapping the indices.
+// Needs normals and UVs; works on the unpacked float arrays.
+void generateTangents(MeshData& mesh, unsigned numThreads = 0);
+
+#endif
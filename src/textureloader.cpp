@@ -0,0 +1,200 @@
+#include "textureloader.h"
+#include "bcencode.h"
+#include "common/parallel.h"
+#include "common/stb_image.h"
+#include "ktx2.h"
+#include "mipmaps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+bool isBlockCompressed(TextureFormat format) {
+  return format == TextureFormat::BC1 || format == TextureFormat::BC4 || format == TextureFormat::BC5 ||
+    format == TextureFormat::BC7;
+}
+
+const char* textureFormatName(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::R8: return "R8";
+  case TextureFormat::RG8: return "RG8";
+  case TextureFormat::RGB8: return "RGB8";
+  case TextureFormat::RGBA8: return "RGBA8";
+  case TextureFormat::BC1: return "BC1";
+  case TextureFormat::BC4: return "BC4";
+  case TextureFormat::BC5: return "BC5";
+  case TextureFormat::BC7: return "BC7";
+  default: return "none";
+  }
+}
+
+size_t textureRowSize(TextureFormat format, int width) {
+  const size_t blocks = (size_t(width) + 3) / 4;
+  switch (format) {
+  case TextureFormat::R8: return size_t(width);
+  case TextureFormat::RG8: return size_t(width) * 2;
+  case TextureFormat::RGB8: return size_t(width) * 3;
+  case TextureFormat::RGBA8: return size_t(width) * 4;
+  case TextureFormat::BC1:
+  case TextureFormat::BC4: return blocks * 8;
+  case TextureFormat::BC5:
+  case TextureFormat::BC7: return blocks * 16;
+  default: return 0;
+  }
+}
+
+size_t textureLevelSize(TextureFormat format, int width, int height) {
+  const size_t rows = isBlockCompressed(format) ? (size_t(height) + 3) / 4 : size_t(height);
+  return textureRowSize(format, width) * rows;
+}
+
+MipFilter mipFilterByName(const std::string& name) {
+  if (name == "box")
+    return MipFilter::Box;
+  if (name == "kaiser")
+    return MipFilter::Kaiser;
+  throw std::runtime_error("Unknown mip filter " + name + ", expected box or kaiser");
+}
+
+std::string textureCachePath(const std::string& path) {
+  return path + ".ktx2";
+}
+
+namespace {
+  int channelCount(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::R8: return 1;
+    case TextureFormat::RG8: return 2;
+    case TextureFormat::RGB8: return 3;
+    case TextureFormat::RGBA8: return 4;
+    default: return 0;
+    }
+  }
+
+  // Decodes with stb_image, keeping the channel count of the file
+  void decodeImage(const std::string& path, const MappedFile& file, TextureData& image) {
+    static const TextureFormat formats[5] = {TextureFormat::None, TextureFormat::R8, TextureFormat::RG8,
+					     TextureFormat::RGB8, TextureFormat::RGBA8};
+    stbi_set_flip_vertically_on_load_thread(1);
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()),
+					    static_cast<int>(file.size()), &width, &height, &channels, 0);
+    if (!pixels)
+      throw std::runtime_error("Cannot decode texture " + path + ": " + stbi_failure_reason());
+    image.format = formats[channels];
+    image.width = width;
+    image.height = height;
+    const size_t size = textureLevelSize(image.format, width, height);
+    image.storage.assign(pixels, pixels + size);
+    stbi_image_free(pixels);
+    image.data = image.storage.data();
+    image.levels = {{width, height, 0, size}};
+  }
+
+  // Encodes one level block by block. Blocks past the edge repeat the last
+  // row and column; missing channels read as 0, alpha as opaque.
+  void encodeLevel(const unsigned char* pixels, int width, int height, int channels, TextureFormat format,
+		   unsigned char* out, unsigned numThreads) {
+    const size_t blocksX = (size_t(width) + 3) / 4, blocksY = (size_t(height) + 3) / 4;
+    const size_t blockBytes = textureRowSize(format, 4);
+    parallelFor(blocksY, numThreads, [&](size_t begin, size_t end, unsigned) {
+      uint8_t rgba[64], values[16];
+      for (size_t by = begin; by < end; by++)
+	for (size_t bx = 0; bx < blocksX; bx++) {
+	  for (int p = 0; p < 16; p++) {
+	    const size_t x = std::min<size_t>(bx * 4 + p % 4, width - 1);
+	    const size_t y = std::min<size_t>(by * 4 + p / 4, height - 1);
+	    const unsigned char* src = pixels + (y * width + x) * channels;
+	    for (int c = 0; c < 4; c++)
+	      rgba[p * 4 + c] = c < channels ? src[c] : (c == 3 ? 255 : 0);
+	  }
+	  unsigned char* block = out + (by * blocksX + bx) * blockBytes;
+	  switch (format) {
+	  case TextureFormat::BC1:
+	    encodeBc1Block(rgba, block);
+	    break;
+	  case TextureFormat::BC7:
+	    encodeBc7Block(rgba, block);
+	    break;
+	  default:
+	    // BC4 and the two halves of BC5, one source channel each
+	    for (int c = 0; c * 8 < int(blockBytes); c++) {
+	      for (int p = 0; p < 16; p++)
+		values[p] = rgba[p * 4 + c];
+	      encodeBc4Block(values, block + c * 8);
+	    }
+	  }
+	}
+    });
+  }
+}
+
+TextureFormat compressedFormat(const TextureData& image, bool bc1) {
+  switch (image.format) {
+  case TextureFormat::R8: return TextureFormat::BC4;
+  case TextureFormat::RG8: return TextureFormat::BC5;
+  case TextureFormat::RGB8: return bc1 ? TextureFormat::BC1 : TextureFormat::BC7;
+  case TextureFormat::RGBA8: {
+    if (!bc1)
+      return TextureFormat::BC7;
+    const size_t numPixels = size_t(image.width) * image.height;
+    for (size_t i = 0; i < numPixels; i++)
+      if (image.data[i * 4 + 3] != 255)
+	return TextureFormat::BC7;
+    return TextureFormat::BC1;
+  }
+  default: return image.format;
+  }
+}
+
+void compressTexture(const TextureData& image, TextureFormat format, TextureData& compressed, unsigned numThreads) {
+  const int channels = channelCount(image.format);
+  if (channels == 0 || !isBlockCompressed(format))
+    throw std::runtime_error(std::string("Cannot compress a ") + textureFormatName(image.format) + " texture to " +
+			     textureFormatName(format));
+  compressed.format = format;
+  compressed.width = image.width;
+  compressed.height = image.height;
+  compressed.levels.clear();
+  size_t size = 0;
+  for (const TextureLevel& level : image.levels) {
+    compressed.levels.push_back({level.width, level.height, size,
+				 textureLevelSize(format, level.width, level.height)});
+    size += compressed.levels.back().size;
+  }
+  compressed.storage.resize(size);
+  compressed.data = compressed.storage.data();
+  for (size_t i = 0; i < compressed.levels.size(); i++) {
+    const TextureLevel& out = compressed.levels[i];
+    encodeLevel(image.data + image.levels[i].offset, out.width, out.height, channels, format,
+		compressed.storage.data() + out.offset, numThreads);
+  }
+}
+
+void loadTexture(const std::string& path, const MappedFile& file, uint64_t hash, const TextureOptions& options,
+		 TextureData& texture, unsigned numThreads) {
+  // A cache made with other options does not match; bump the version when
+  // the mipmaps or the encoders change
+  const uint64_t cacheVersion = 1;
+  const uint64_t settings = (cacheVersion << 8) | (options.bc1 ? 0 : 32) | (uint64_t(options.mipFilter) << 2) |
+    (options.srgb ? 2 : 0) | (options.compress ? 1 : 0);
+  const uint64_t cacheKey = hash ^ ((settings + 1) * 0x9E3779B97F4A7C15ull);
+  const std::string cachePath = textureCachePath(path);
+  if (readKtx2(cachePath, cacheKey, texture))
+    return;
+
+  auto start = std::chrono::steady_clock::now();
+  TextureData image, mipmapped;
+  decodeImage(path, file, image);
+  generateMipmaps(image, options.mipFilter, options.srgb, mipmapped, numThreads);
+  if (options.compress)
+    compressTexture(mipmapped, compressedFormat(mipmapped, options.bc1), texture, numThreads);
+  else
+    texture = std::move(mipmapped);
+  auto time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+  std::cout << "Built " << texture.levels.size() << " mip levels of " << path << " as "
+	    << textureFormatName(texture.format) << " in " << time.count() << " ms\n";
+  if (!writeKtx2(cachePath, texture, cacheKey))
+    std::cerr << "Warning: could not write the texture cache " << cachePath << std::endl;
+}
@@ -0,0 +1,93 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include "common/mappedfile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Texel formats of loaded textures. The uncompressed ones keep the channel
+// count of the source image; grey and grey-alpha images are R8 and RG8.
+enum class TextureFormat : uint8_t {
+  None,
+  R8,
+  RG8,
+  RGB8,
+  RGBA8,
+  BC1,  // RGB, 8 bytes per 4x4 block
+  BC4,  // one channel, 8 bytes per block
+  BC5,  // two channels, 16 bytes per block
+  BC7,  // RGBA, 16 bytes per block
+};
+
+bool isBlockCompressed(TextureFormat format);
+const char* textureFormatName(TextureFormat format);
+// Bytes of one row of pixels, or of one row of 4x4 blocks for the BC formats
+size_t textureRowSize(TextureFormat format, int width);
+size_t textureLevelSize(TextureFormat format, int width, int height);
+
+struct TextureLevel {
+  int width;
+  int height;
+  size_t offset;  // into TextureData::data
+  size_t size;
+};
+
+// A texture on the CPU, bottom row first as OpenGL expects. The levels are
+// tightly packed rows, largest level first; a decoded image has level 0
+// only, loaded textures have every level down to 1x1. data points into
+// storage, or into mapping for a cached .ktx2.
+struct TextureData {
+  TextureFormat format = TextureFormat::None;
+  int width = 0;
+  int height = 0;
+  std::vector<TextureLevel> levels;
+  const unsigned char* data = nullptr;
+  std::vector<unsigned char> storage;
+  MappedFile mapping;
+};
+
+// Filter that reduces one mip level to the next
+enum class MipFilter : uint8_t {
+  Box,     // mean of 2x2 pixels, like glGenerateMipmap
+  Kaiser,  // 8 taps of a Kaiser windowed sinc, sharper
+};
+
+struct TextureOptions {
+  // Block compress, see compressedFormat
+  bool compress = true;
+  // The color channels hold sRGB values, so mipmaps are filtered in linear
+  // light; alpha is always linear
+  bool srgb = true;
+  MipFilter mipFilter = MipFilter::Kaiser;
+  // BC1 may be chosen. GL 4.6 core only has it through the
+  // EXT_texture_compression_s3tc extension; without it BC7 is used instead.
+  bool bc1 = true;
+};
+
+// Filter named "box" or "kaiser"; throws std::runtime_error for other names
+MipFilter mipFilterByName(const std::string& name);
+
+// Path of the cache written next to a texture
+std::string textureCachePath(const std::string& path);
+
+// Loads the image in file, the mapped contents of path, with all its
+// mipmaps; hash identifies the contents (see hashBytes). The .ktx2 cache
+// next to path is used when it was made from the same contents with the
+// same options. Otherwise the image is decoded, its mipmaps are generated,
+// it is compressed when the options say so and the cache is written.
+// Throws std::runtime_error when the image cannot be decoded.
+void loadTexture(const std::string& path, const MappedFile& file, uint64_t hash, const TextureOptions& options,
+		 TextureData& texture, unsigned numThreads = 0);
+
+// Block compressed format for an uncompressed image: BC4 for grey, BC5 for
+// grey-alpha, BC1 for RGB and opaque RGBA when bc1 allows it, BC7 otherwise
+TextureFormat compressedFormat(const TextureData& image, bool bc1 = true);
+
+// Every level of an uncompressed image encoded in format
+void compressTexture(const TextureData& image, TextureFormat format, TextureData& compressed,
+		     unsigned numThreads = 0);
+
+#endif
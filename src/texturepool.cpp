@@ -0,0 +1,265 @@
+#include "texturepool.h"
+#include "bufferdiff.h"
+#include "common/mappedfile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+  // Decoded images wait for the GL thread in a queue of at most this many
+  const size_t maxDecoded = 4;
+  // Bytes copied through a pixel buffer per slice
+  const size_t sliceBytes = 4 << 20;
+
+  struct GlFormat {
+    GLenum internalFormat;
+    GLenum format;  // of the pixels, 0 for block compressed data
+  };
+
+  GlFormat glFormat(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::R8: return {GL_R8, GL_RED};
+    case TextureFormat::RG8: return {GL_RG8, GL_RG};
+    case TextureFormat::RGB8: return {GL_RGB8, GL_RGB};
+    case TextureFormat::BC1: return {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0};
+    case TextureFormat::BC4: return {GL_COMPRESSED_RED_RGTC1, 0};
+    case TextureFormat::BC5: return {GL_COMPRESSED_RG_RGTC2, 0};
+    case TextureFormat::BC7: return {GL_COMPRESSED_RGBA_BPTC_UNORM, 0};
+    default: return {GL_RGBA8, GL_RGBA};
+    }
+  }
+}
+
+TexturePool::TexturePool(unsigned numWorkers) {
+  for (unsigned i = 0; i < numWorkers; i++)
+    m_workers.emplace_back(&TexturePool::work, this);
+}
+
+TexturePool::~TexturePool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_jobs.clear();
+  }
+  m_wake.notify_all();
+  for (auto& worker : m_workers)
+    worker.join();
+}
+
+int TexturePool::request(const std::string& path) {
+  // Different spellings of one path share the handle
+  const std::string key = std::filesystem::absolute(path).lexically_normal().string();
+  auto found = m_handleByPath.find(key);
+  if (found != m_handleByPath.end())
+    return found->second;
+
+  const int handle = static_cast<int>(m_handleTextures.size());
+  m_handleByPath.emplace(key, handle);
+  m_handleTextures.push_back(0);
+  m_unresolved.push_back(handle);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_handleContent.push_back(pendingContent);
+    // BC1 needs an extension of GL 4.6 core, the other formats do not
+    TextureOptions options = m_options;
+    options.bc1 = options.bc1 && GLEW_EXT_texture_compression_s3tc;
+    m_jobs.push_back({handle, path, options});
+  }
+  m_wake.notify_one();
+  return handle;
+}
+
+/**
+ * Hashes the file of one job and loads it unless a file with the same
+ * contents was seen before, in which case the handle joins that content.
+ * A worker only takes a job while there is room in the decoded queue.
+ */
+void TexturePool::work() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] { return m_stop || (!m_jobs.empty() && m_decoded.size() < maxDecoded); });
+      if (m_stop)
+	return;
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+
+    MappedFile file;
+    if (!file.open(job.path)) {
+      std::cerr << "Failed to open texture " << job.path << std::endl;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_handleContent[job.handle] = failedContent;
+      continue;
+    }
+    // One thread, the workers already run in parallel
+    const uint64_t hash = hashBytes(file.data(), file.size(), 1);
+    int content;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto found = m_contentByHash.emplace(hash, m_numContents);
+      content = found.first->second;
+      m_handleContent[job.handle] = content;
+      if (!found.second)
+	continue;
+      m_numContents++;
+    }
+
+    Image image;
+    image.content = content;
+    image.path = job.path;
+    try {
+      loadTexture(job.path, file, hash, job.options, image.texture);
+    } catch (const std::exception& e) {
+      std::cerr << "Failed to load texture " << job.path << ": " << e.what() << std::endl;
+      image.texture.data = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_decoded.push_back(std::move(image));
+  }
+}
+
+/**
+ * Gives the handles whose content is uploaded their texture. This covers
+ * handles that were found to duplicate a content after its upload.
+ */
+void TexturePool::resolveHandles() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto resolved = [this](int handle) {
+    const int content = m_handleContent[handle];
+    if (content == failedContent)
+      return true;
+    if (content < 0 || size_t(content) >= m_contentDone.size() || !m_contentDone[content])
+      return false;
+    m_handleTextures[handle] = m_contentTextures[content];
+    return true;
+  };
+  m_unresolved.erase(std::remove_if(m_unresolved.begin(), m_unresolved.end(), resolved), m_unresolved.end());
+}
+
+/**
+ * Copies loaded images into textures, a slice of rows at a time: each slice
+ * is written into a pixel buffer and the texture is filled from it, so the
+ * driver copies to the GPU without the GL thread waiting. Every image
+ * brings all of its levels, so the driver generates no mipmaps.
+ */
+void TexturePool::processUploads(double budgetSeconds) {
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsed = [&start] {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+  do {
+    const TextureData& texture = m_upload.texture;
+    if (!texture.data) {
+      {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// Failed loads pass through so their handles are given up
+	while (!m_decoded.empty() && !texture.data) {
+	  m_upload = std::move(m_decoded.front());
+	  m_decoded.pop_front();
+	  if (size_t(m_upload.content) >= m_contentDone.size()) {
+	    m_contentTextures.resize(m_upload.content + 1, 0);
+	    m_contentDone.resize(m_upload.content + 1, 0);
+	  }
+	  if (!texture.data)
+	    m_contentDone[m_upload.content] = 1;
+	}
+      }
+      m_wake.notify_all();
+      if (!texture.data)
+	break;
+      int levels = 1;
+      while ((std::max(texture.width, texture.height) >> levels) > 0)
+	levels++;
+      glGenTextures(1, &m_uploadTexture);
+      glBindTexture(GL_TEXTURE_2D, m_uploadTexture);
+      glTexStorage2D(GL_TEXTURE_2D, levels, glFormat(texture.format).internalFormat, texture.width, texture.height);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      // Grey reads as grey in all three color channels, with its alpha if any
+      if (texture.format == TextureFormat::R8 || texture.format == TextureFormat::BC4) {
+	const GLint swizzle[4] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+      } else if (texture.format == TextureFormat::RG8 || texture.format == TextureFormat::BC5) {
+	const GLint swizzle[4] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+      }
+      m_uploadLevel = 0;
+      m_uploadRow = 0;
+      if (!m_pixelBuffers[0])
+	glGenBuffers(2, m_pixelBuffers);
+    }
+
+    // Whole rows of pixels, or of 4x4 blocks
+    const TextureLevel& level = texture.levels[m_uploadLevel];
+    const bool compressed = isBlockCompressed(texture.format);
+    const int rowHeight = compressed ? 4 : 1;
+    const size_t rowBytes = textureRowSize(texture.format, level.width);
+    const int rows = std::min((level.height - m_uploadRow + rowHeight - 1) / rowHeight,
+			      static_cast<int>(std::max<size_t>(sliceBytes / rowBytes, 1)));
+    const int height = std::min(rows * rowHeight, level.height - m_uploadRow);
+    const size_t bytes = rows * rowBytes;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffers[m_nextPixelBuffer]);
+    m_nextPixelBuffer ^= 1;
+    // Fresh storage, the driver may still read the old one
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+      std::memcpy(mapped, texture.data + level.offset + size_t(m_uploadRow / rowHeight) * rowBytes, bytes);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glBindTexture(GL_TEXTURE_2D, m_uploadTexture);
+      const GlFormat format = glFormat(texture.format);
+      if (compressed) {
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, static_cast<GLint>(m_uploadLevel), 0, m_uploadRow, level.width,
+				  height, format.internalFormat, static_cast<GLsizei>(bytes), nullptr);
+      } else {
+	// Rows of R8 and RGB8 pixels are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, static_cast<GLint>(m_uploadLevel), 0, m_uploadRow, level.width, height,
+			format.format, GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_uploadRow += height;
+    if (m_uploadRow >= level.height) {
+      m_uploadLevel++;
+      m_uploadRow = 0;
+    }
+
+    if (m_uploadLevel >= texture.levels.size()) {
+      m_contentTextures[m_upload.content] = m_uploadTexture;
+      m_contentDone[m_upload.content] = 1;
+      size_t size = 0;
+      for (const TextureLevel& uploaded : texture.levels)
+	size += uploaded.size;
+      std::cout << "Uploaded texture " << m_upload.path << " (" << texture.width << "x" << texture.height << " "
+		<< textureFormatName(texture.format) << ", " << (size >> 10) << " KB)\n";
+      m_upload.texture = TextureData();
+      m_uploadTexture = 0;
+    }
+  } while (elapsed() < budgetSeconds);
+  resolveHandles();
+}
+
+void TexturePool::release() {
+  for (GLuint texture : m_contentTextures)
+    if (texture)
+      glDeleteTextures(1, &texture);
+  if (m_uploadTexture)
+    glDeleteTextures(1, &m_uploadTexture);
+  if (m_pixelBuffers[0])
+    glDeleteBuffers(2, m_pixelBuffers);
+  m_contentTextures.clear();
+  m_contentDone.clear();
+  m_upload.texture = TextureData();
+  m_uploadTexture = 0;
+  m_pixelBuffers[0] = m_pixelBuffers[1] = 0;
+  std::fill(m_handleTextures.begin(), m_handleTextures.end(), 0);
+}
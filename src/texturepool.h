@@ -0,0 +1,91 @@
+#ifndef TEXTURE_POOL_H
+#define TEXTURE_POOL_H
+
+#include <GL/glew.h>
+
+#include "textureloader.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Textures shared by every object in the scene. Files are decoded on worker
+// threads and uploaded on the GL thread through pixel buffer objects, a
+// slice of rows per call. A path is loaded once, and files with the same
+// contents under different paths share one decoded image and GL texture.
+// Every image gets its mipmaps on the CPU and is cached as .ktx2 next to
+// the source, block compressed or in its own channel count.
+class TexturePool {
+public:
+  explicit TexturePool(unsigned numWorkers = 4);
+  ~TexturePool();
+  TexturePool(const TexturePool&) = delete;
+  TexturePool& operator=(const TexturePool&) = delete;
+
+  // Returns the handle of the texture in the file at path, starting to load
+  // it on the first request
+  int request(const std::string& path);
+  // GL texture of a handle, 0 while it is loading or when it failed
+  GLuint texture(int handle) const {
+    return handle >= 0 && size_t(handle) < m_handleTextures.size() ? m_handleTextures[handle] : 0;
+  }
+  // Uploads decoded images until budgetSeconds are used up, at least one
+  // slice per call so textures arrive even when meshes use the budget
+  void processUploads(double budgetSeconds);
+  // Deletes the textures and pixel buffers; needs the GL context
+  void release();
+  // Applies to the files requested after this
+  void setTextureOptions(const TextureOptions& options) { m_options = options; }
+
+private:
+  // Handle contents that are not known yet, or whose file failed to load
+  static constexpr int pendingContent = -1;
+  static constexpr int failedContent = -2;
+
+  struct Job {
+    int handle;
+    std::string path;
+    TextureOptions options;
+  };
+  struct Image {
+    int content = pendingContent;
+    std::string path;
+    TextureData texture;  // data is null when the file failed to load
+  };
+
+  void work();
+  void resolveHandles();
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::deque<Job> m_jobs;
+  std::deque<Image> m_decoded;  // waiting for the GL thread, bounded to limit memory
+  std::vector<std::thread> m_workers;
+  bool m_stop = false;
+  // Guarded by m_mutex: the content of every handle and of every file hash
+  std::vector<int> m_handleContent;
+  std::unordered_map<uint64_t, int> m_contentByHash;
+  int m_numContents = 0;
+
+  // GL thread only
+  TextureOptions m_options;
+  std::unordered_map<std::string, int> m_handleByPath;
+  std::vector<GLuint> m_handleTextures;
+  std::vector<int> m_unresolved;       // handles without a texture yet
+  std::vector<GLuint> m_contentTextures;
+  std::vector<char> m_contentDone;     // uploaded, or failed with texture 0
+  Image m_upload;                      // image being uploaded, data null when none
+  GLuint m_uploadTexture = 0;
+  size_t m_uploadLevel = 0;
+  int m_uploadRow = 0;
+  // Written in turn, so a slice never waits for the copy out of the previous one
+  GLuint m_pixelBuffers[2] = {0, 0};
+  int m_nextPixelBuffer = 0;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "vertexformat.h"
+#include "common/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+  size_t componentSize(VertexFormat format) {
+    switch (format) {
+    case VertexFormat::Float:
+      return 4;
+    case VertexFormat::Snorm8:
+      return 1;
+    case VertexFormat::Unorm16:
+    case VertexFormat::Snorm16:
+    case VertexFormat::Half:
+      return 2;
+    case VertexFormat::None:
+      break;
+    }
+    return 0;
+  }
+
+  uint16_t toUnorm16(float v) {
+    return static_cast<uint16_t>(std::lround(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f));
+  }
+
+  int8_t toSnorm8(float v) {
+    return static_cast<int8_t>(std::lround(std::min(std::max(v, -1.0f), 1.0f) * 127.0f));
+  }
+
+  int16_t toSnorm16(float v) {
+    return static_cast<int16_t>(std::lround(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f));
+  }
+
+  // Appends one attribute to the layout, keeping every attribute 4-byte aligned
+  VertexAttribute addAttribute(VertexLayout& layout, VertexFormat format, uint8_t components) {
+    VertexAttribute attribute;
+    attribute.format = format;
+    attribute.components = components;
+    attribute.offset = static_cast<uint16_t>(layout.stride);
+    layout.stride += static_cast<uint32_t>((componentSize(format) * components + 3) & ~size_t(3));
+    return attribute;
+  }
+
+  void writeAttribute(const VertexAttribute& attribute, const float* values, unsigned char* dst) {
+    dst += attribute.offset;
+    for (int i = 0; i < attribute.components; i++) {
+      switch (attribute.format) {
+      case VertexFormat::Float:
+	std::memcpy(dst + 4 * i, &values[i], 4);
+	break;
+      case VertexFormat::Unorm16: {
+	uint16_t v = toUnorm16(values[i]);
+	std::memcpy(dst + 2 * i, &v, 2);
+	break;
+      }
+      case VertexFormat::Snorm16: {
+	int16_t v = toSnorm16(values[i]);
+	std::memcpy(dst + 2 * i, &v, 2);
+	break;
+      }
+      case VertexFormat::Half: {
+	uint16_t v = floatToHalf(values[i]);
+	std::memcpy(dst + 2 * i, &v, 2);
+	break;
+      }
+      case VertexFormat::Snorm8: {
+	int8_t v = toSnorm8(values[i]);
+	std::memcpy(dst + i, &v, 1);
+	break;
+      }
+      case VertexFormat::None:
+	break;
+      }
+    }
+  }
+}
+
+VertexLayout packedLayout(bool hasNormals, bool hasUVs, bool quantizePositions,
+			  bool hasTangents) {
+  VertexLayout layout;
+  layout.position = addAttribute(layout, quantizePositions ? VertexFormat::Unorm16 : VertexFormat::Float, 3);
+  if (hasNormals)
+    layout.normal = addAttribute(layout, VertexFormat::Snorm16, 2);
+  if (hasUVs)
+    layout.uv = addAttribute(layout, VertexFormat::Half, 2);
+  if (hasTangents)
+    layout.tangent = addAttribute(layout, VertexFormat::Snorm8, 4);
+  return layout;
+}
+
+void packVertex(const VertexLayout& layout, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+		const float* position, const float* normal, const float* uv, const float* tangent,
+		unsigned char* dst) {
+  std::memset(dst, 0, layout.stride);
+
+  if (layout.position.format == VertexFormat::Unorm16) {
+    // relative to the bounds, so the full 16 bits cover the mesh
+    glm::vec3 extent = boundsMax - boundsMin;
+    float relative[3];
+    for (int i = 0; i < 3; i++)
+      relative[i] = extent[i] > 0.0f ? (position[i] - boundsMin[i]) / extent[i] : 0.0f;
+    writeAttribute(layout.position, relative, dst);
+  } else {
+    writeAttribute(layout.position, position, dst);
+  }
+
+  if (layout.octNormals()) {
+    glm::vec2 e = octEncode(glm::vec3(normal[0], normal[1], normal[2]));
+    float encoded[2] = {e.x, e.y};
+    writeAttribute(layout.normal, encoded, dst);
+  } else if (layout.normal.present()) {
+    writeAttribute(layout.normal, normal, dst);
+  }
+
+  if (layout.uv.present())
+    writeAttribute(layout.uv, uv, dst);
+  if (layout.tangent.present())
+    writeAttribute(layout.tangent, tangent, dst);
+}
+
+void packVertices(const VertexLayout& layout, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+		  const std::vector<float>& positions, const std::vector<float>& normals,
+		  const std::vector<float>& uvs, const std::vector<float>& tangents,
+		  std::vector<unsigned char>& out) {
+  const size_t numVertices = positions.size() / 3;
+  out.resize(numVertices * layout.stride);
+  // threads only pay off for larger meshes
+  parallelFor(numVertices, numVertices < 65536 ? 1 : 0, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++)
+      packVertex(layout, boundsMin, boundsMax, &positions[3 * i],
+		 layout.normal.present() ? &normals[3 * i] : nullptr,
+		 layout.uv.present() ? &uvs[2 * i] : nullptr,
+		 layout.tangent.present() ? &tangents[4 * i] : nullptr,
+		 &out[i * layout.stride]);
+  });
+}
+
+glm::vec3 unpackPosition(const VertexLayout& layout, const glm::vec3& boundsMin,
+			 const glm::vec3& boundsMax, const unsigned char* vertex) {
+  vertex += layout.position.offset;
+  glm::vec3 p;
+  if (layout.position.format == VertexFormat::Unorm16) {
+    uint16_t q[3];
+    std::memcpy(q, vertex, sizeof(q));
+    for (int i = 0; i < 3; i++)
+      p[i] = q[i] / 65535.0f;
+  } else {
+    std::memcpy(&p[0], vertex, 3 * sizeof(float));
+  }
+  return positionOffset(layout, boundsMin) + p * positionScale(layout, boundsMin, boundsMax);
+}
+
+glm::vec3 positionOffset(const VertexLayout& layout, const glm::vec3& boundsMin) {
+  return layout.position.format == VertexFormat::Unorm16 ? boundsMin : glm::vec3(0.0f);
+}
+
+glm::vec3 positionScale(const VertexLayout& layout, const glm::vec3& boundsMin,
+			const glm::vec3& boundsMax) {
+  return layout.position.format == VertexFormat::Unorm16 ? boundsMax - boundsMin : glm::vec3(1.0f);
+}
+
+// Round to nearest even, overflow goes to infinity, tiny values to zero
+uint16_t floatToHalf(float value) {
+  uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000u;
+  const uint32_t bits = x & 0x7fffffffu;
+
+  if (bits >= 0x7f800000u)  // inf or nan
+    return static_cast<uint16_t>(sign | 0x7c00u | (bits > 0x7f800000u ? 0x200u : 0u));
+  if (bits >= 0x477ff000u)  // rounds past the largest half
+    return static_cast<uint16_t>(sign | 0x7c00u);
+  if (bits < 0x38800000u) {  // subnormal half
+    if (bits < 0x33000000u)
+      return static_cast<uint16_t>(sign);
+    const uint32_t exponent = bits >> 23;
+    const uint32_t mantissa = (bits & 0x7fffffu) | 0x800000u;
+    const uint32_t shift = 126 - exponent;
+    uint32_t h = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1)))
+      h++;
+    return static_cast<uint16_t>(sign | h);
+  }
+
+  uint32_t h = (bits - 0x38000000u) >> 13;
+  const uint32_t rest = bits & 0x1fffu;
+  if (rest > 0x1000u || (rest == 0x1000u && (h & 1)))
+    h++;
+  return static_cast<uint16_t>(sign | h);
+}
+
+float halfToFloat(uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+  const uint32_t exponent = (value >> 10) & 0x1fu;
+  const uint32_t mantissa = value & 0x3ffu;
+  uint32_t bits;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+    } else {
+      // normalize the subnormal
+      int e = -1;
+      uint32_t m = mantissa;
+      do {
+	e++;
+	m <<= 1;
+      } while ((m & 0x400u) == 0);
+      bits = sign | static_cast<uint32_t>(127 - 15 - e) << 23 | (m & 0x3ffu) << 13;
+    }
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000u | mantissa << 13;
+  } else {
+    bits = sign | (exponent + 127 - 15) << 23 | mantissa << 13;
+  }
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+glm::vec2 octEncode(const glm::vec3& n) {
+  const float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+  if (l1 == 0.0f)
+    return glm::vec2(0.0f, 0.0f);
+  glm::vec2 p(n.x / l1, n.y / l1);
+  if (n.z < 0.0f) {
+    // fold the lower hemisphere over the diagonals
+    const float x = (1.0f - std::fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+    const float y = (1.0f - std::fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+    p = glm::vec2(x, y);
+  }
+  return p;
+}
+
+glm::vec3 octDecode(const glm::vec2& e) {
+  glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+  const float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
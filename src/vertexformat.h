@@ -0,0 +1,75 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Storage format of one vertex attribute in the interleaved stream
+enum class VertexFormat : uint8_t {
+  None,     // attribute is not stored
+  Float,    // 32-bit float per component
+  Unorm16,  // normalized unsigned short per component
+  Snorm16,  // normalized signed short per component
+  Half,     // 16-bit float per component
+  Snorm8,   // normalized signed byte per component
+};
+
+struct VertexAttribute {
+  VertexFormat format = VertexFormat::None;
+  uint8_t components = 0;
+  uint16_t offset = 0;
+
+  bool present() const { return format != VertexFormat::None; }
+};
+
+// Interleaved vertex layout. Positions are either floats or 16-bit values
+// relative to the mesh bounds (decoded with positionOffset/positionScale in
+// the vertex shader), normals are floats or octahedral 2x16-bit, UVs half
+// floats, tangents 4x8-bit with the bitangent sign in w. Attributes a mesh
+// does not have are left out.
+struct VertexLayout {
+  uint32_t stride = 0;
+  VertexAttribute position;
+  VertexAttribute normal;
+  VertexAttribute uv;
+  VertexAttribute tangent;
+
+  bool octNormals() const { return normal.format == VertexFormat::Snorm16 && normal.components == 2; }
+};
+
+// Layout used by the loader: quantized positions, oct normals and half UVs.
+// Streaming loads do not know the bounds in advance and keep float positions.
+VertexLayout packedLayout(bool hasNormals, bool hasUVs, bool quantizePositions = true,
+			  bool hasTangents = false);
+
+// Writes vertex i into dst (layout.stride bytes). normal/uv/tangent may be
+// null when the layout does not store them.
+void packVertex(const VertexLayout& layout, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+		const float* position, const float* normal, const float* uv, const float* tangent,
+		unsigned char* dst);
+
+// Packs whole float arrays (xyz, xyz, uv, xyzw per vertex) into an
+// interleaved stream
+void packVertices(const VertexLayout& layout, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+		  const std::vector<float>& positions, const std::vector<float>& normals,
+		  const std::vector<float>& uvs, const std::vector<float>& tangents,
+		  std::vector<unsigned char>& out);
+
+// Decodes the position of vertex i back to model space
+glm::vec3 unpackPosition(const VertexLayout& layout, const glm::vec3& boundsMin,
+			 const glm::vec3& boundsMax, const unsigned char* vertex);
+
+// Shader constants that turn stored positions back into model space
+glm::vec3 positionOffset(const VertexLayout& layout, const glm::vec3& boundsMin);
+glm::vec3 positionScale(const VertexLayout& layout, const glm::vec3& boundsMin,
+			const glm::vec3& boundsMax);
+
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
+// Octahedral encoding of a unit vector into two values in [-1, 1]
+glm::vec2 octEncode(const glm::vec3& n);
+glm::vec3 octDecode(const glm::vec2& e);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef WELD_H
+#define WELD_H
+
+#include "common/parallel.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Finds for every item the first item with an equal key, itself for the
+// first occurrences. The items are split into one shard per thread by the
+// hash of their key and every shard is searched by one thread, so no table
+// is shared. keyOf(i) must be callable from several threads at once.
+template <typename Key, typename Hash, typename KeyOf>
+std::vector<uint32_t> findFirstOccurrences(size_t count, unsigned threads, const KeyOf& keyOf) {
+  if (threads == 0)
+    threads = defaultThreadCount();
+  const size_t numShards = threads;
+  auto shardOf = [numShards](const Key& key) {
+    return static_cast<size_t>((Hash()(key) * 0x9E3779B97F4A7C15ull) >> 40) % numShards;
+  };
+
+  // Per thread and shard counts, then a scatter into one list per shard
+  // that keeps the item order within the shard
+  std::vector<size_t> shardCounts(threads * numShards, 0);
+  parallelFor(count, threads, [&](size_t begin, size_t end, unsigned t) {
+    for (size_t i = begin; i < end; i++)
+      shardCounts[t * numShards + shardOf(keyOf(i))]++;
+  });
+  std::vector<size_t> shardStarts(numShards + 1, 0);
+  std::vector<size_t> cursors(threads * numShards);
+  for (size_t shard = 0, offset = 0; shard < numShards; shard++) {
+    shardStarts[shard] = offset;
+    for (unsigned t = 0; t < threads; t++) {
+      cursors[t * numShards + shard] = offset;
+      offset += shardCounts[t * numShards + shard];
+    }
+    shardStarts[shard + 1] = offset;
+  }
+  std::vector<uint32_t> shardItems(count);
+  parallelFor(count, threads, [&](size_t begin, size_t end, unsigned t) {
+    for (size_t i = begin; i < end; i++)
+      shardItems[cursors[t * numShards + shardOf(keyOf(i))]++] = static_cast<uint32_t>(i);
+  });
+
+  std::vector<uint32_t> first(count);
+  parallelFor(numShards, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t shard = begin; shard < end; shard++) {
+      std::unordered_map<Key, uint32_t, Hash> unique;
+      unique.reserve(shardStarts[shard + 1] - shardStarts[shard]);
+      for (size_t i = shardStarts[shard]; i < shardStarts[shard + 1]; i++) {
+	const uint32_t item = shardItems[i];
+	first[item] = unique.emplace(keyOf(item), item).first->second;
+      }
+    }
+  });
+  return first;
+}
+
+// Numbers the first occurrences consecutively in item order and returns
+// their count. offsets gets, per thread of a parallelFor over count items
+// with the same thread count, the number of the first one in its range.
+inline size_t countFirstOccurrences(const std::vector<uint32_t>& first, unsigned threads,
+				    std::vector<size_t>& offsets) {
+  if (threads == 0)
+    threads = defaultThreadCount();
+  offsets.assign(threads + 1, 0);
+  parallelFor(first.size(), threads, [&](size_t begin, size_t end, unsigned t) {
+    for (size_t i = begin; i < end; i++)
+      offsets[t + 1] += first[i] == i;
+  });
+  for (unsigned t = 0; t < threads; t++)
+    offsets[t + 1] += offsets[t];
+  return offsets[threads];
+}
+
+#endif